@@ -0,0 +1,64 @@
+(* N single process_vm_readv reads of small ranges compared with one
+   Remote.Batch read of the same ranges.
+
+   dune build @bench *)
+
+module Reader = Mach_linux.Process_vm
+module Batch = Remote.Batch.Make (Reader)
+
+let rounds = 200
+
+(* An unwinder's view of a stop: a few hundred 16 byte frame records spread
+   over some stack pages, plus pointers chased into a wider heap. *)
+let requests (target : Target.t) page_size =
+  let stack = Array.init 256 (fun i -> (target.address + (i * 64), 16)) in
+  let heap =
+    Array.init 256 (fun _ ->
+        (target.address + (Random.int (1024 * page_size / 8) * 8), 8))
+  in
+  Array.append stack heap
+
+let singles backend requests =
+  let buf = Remote.Backend.create_buffer 16 in
+  Array.iter
+    (fun (address, len) ->
+      Report.or_fail (Reader.read backend address buf 0 len))
+    requests
+
+let () =
+  let target : Target.t = Target.spawn () in
+  let backend = Reader.create target.pid in
+  let requests = requests target (Reader.page_size backend) in
+  let n = Array.length requests in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let (), t =
+        Report.time (fun () ->
+            for _ = 1 to rounds do
+              singles backend requests
+            done)
+      in
+      Report.ns_per_op "batch/single_reads" t (rounds * n);
+      List.iter
+        (fun gap ->
+          let plan = Remote.Batch.coalesce ~gap requests in
+          let results, t =
+            Report.time (fun () ->
+                let r = ref [||] in
+                for _ = 1 to rounds do
+                  r := Batch.read ~gap backend requests
+                done;
+                !r)
+          in
+          let name = Printf.sprintf "batch/gap_%d" gap in
+          Report.ns_per_op (name ^ "/per_range") t (rounds * n);
+          Report.count (name ^ "/spans") (Array.length plan.Remote.Batch.spans);
+          Array.iteri
+            (fun i r ->
+              let address, _ = requests.(i) in
+              let bytes = Report.or_fail r in
+              if Bytes.get bytes 0 <> Target.expected (address - target.address)
+              then failwith (name ^ ": batched bytes differ from the target"))
+            results)
+        [ 0; 64; 4096 ])
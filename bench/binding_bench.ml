@@ -0,0 +1,90 @@
+(* Cost of the binding layer itself: a ctypes-foreign call compared with a
+   hand-written stub for the same system call and with the stubs Cstubs
+   generates, the bindings the Linux backend is built on, and decoding a
+   struct through Ctypes compared with Remote.Decode. Each reports time and
+   allocation per call. The end-to-end workloads are a full memory map walk
+   and an all-thread register fetch.
+
+   BENCH_RESULTS=results.jsonl dune build @bench *)
+
+open Ctypes
+
+let foreign_getpid = Foreign.foreign "getpid" (void @-> returning int)
+let ops = 200_000
+
+module Libffi =
+  Mach_linux_bindings.Functions (Mach_linux_bindings.Libffi)
+
+let () =
+  Report.measure "binding/foreign-getpid" ~ops (fun () ->
+      ignore (Sys.opaque_identity (foreign_getpid ())));
+  Report.measure "binding/stub-getpid" ~ops (fun () ->
+      ignore (Sys.opaque_identity (Unix.getpid ())));
+  Report.measure "stubs/libffi-getpagesize" ~ops (fun () ->
+      ignore (Sys.opaque_identity (Libffi.getpagesize ())));
+  Report.measure "stubs/cstubs-getpagesize" ~ops (fun () ->
+      ignore (Sys.opaque_identity (Mach_linux_stubs.getpagesize ())))
+
+let () =
+  let iov = make Mach_linux.Process_vm.iovec in
+  Mach_linux.Process_vm.set_iovec iov null 4096;
+  Report.measure "decode/ctypes-getf" ~ops (fun () ->
+      ignore
+        (Sys.opaque_identity
+           (Unsigned.Size_t.to_int (getf iov Mach_linux.Process_vm.iov_len))));
+  let buf =
+    bigarray_of_ptr array1 (sizeof Mach_linux.Process_vm.iovec) Bigarray.char
+      (from_voidp char (to_voidp (addr iov)))
+  in
+  Report.measure "decode/get_int" ~ops (fun () ->
+      ignore (Sys.opaque_identity (Remote.Decode.get_int buf 8)))
+
+let () =
+  let target : Target.t = Target.spawn ~size:(1024 * 1024) () in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let memory = Mach_linux.Process_vm.create target.pid in
+      let buf = Remote.Backend.create_buffer 8 in
+      let local = make Mach_linux.Process_vm.iovec in
+      let remote = make Mach_linux.Process_vm.iovec in
+      Mach_linux.Process_vm.set_iovec local
+        (to_voidp (bigarray_start array1 buf))
+        8;
+      Mach_linux.Process_vm.set_iovec remote
+        (ptr_of_raw_address (Nativeint.of_int target.address))
+        8;
+      let pid = PosixTypes.Pid.of_int target.pid in
+      let one = Unsigned.ULong.one and zero = Unsigned.ULong.zero in
+      Report.measure "stubs/libffi-process_vm_readv" ~ops (fun () ->
+          ignore
+            (Libffi.process_vm_readv pid (addr local) one (addr remote) one
+               zero));
+      Report.measure "stubs/cstubs-process_vm_readv" ~ops (fun () ->
+          ignore
+            (Mach_linux_stubs.process_vm_readv pid (addr local) one
+               (addr remote) one zero));
+      Report.measure "binding/process_vm_readv" ~ops (fun () ->
+          Report.or_fail
+            (Mach_linux.Process_vm.read memory target.address buf 0 8));
+      Report.measure "workload/maps-walk" ~ops:2_000 (fun () ->
+          ignore
+            (Mach_linux.Process_vm.fold_regions memory ~start:0 ~stop:max_int
+               ~depth:0
+               (fun n _ -> n + 1)
+               0));
+      (* Register fetches need the child stopped under ptrace. *)
+      Report.or_fail (Mach_linux.Ptrace.attach target.pid);
+      let regs = Remote.Backend.create_buffer 512 in
+      Report.measure "binding/ptrace-getregset" ~ops (fun () ->
+          ignore
+            (Report.or_fail
+               (Mach_linux.Ptrace.get_regset target.pid
+                  Mach_linux.Ptrace.nt_prstatus regs)));
+      Report.or_fail (Mach_linux.Ptrace.detach target.pid);
+      let threads = Mach_linux.Threads.create target.pid in
+      Report.measure "workload/all-thread-registers" ~ops:2_000 (fun () ->
+          ignore
+            (Report.or_fail
+               (Mach_linux.Threads.sample threads (fun _ _ _ _ -> ()))));
+      Mach_linux.Threads.close threads)
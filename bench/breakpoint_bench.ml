@@ -0,0 +1,86 @@
+(* Inserting and removing up to 10k breakpoints in the text of a child with
+   Remote.Breakpoints, compared with one write per breakpoint. The text is
+   mapped read and execute only, so every write goes through the ptrace
+   fallback as it would in a debugger.
+
+   dune build @bench *)
+
+module Memory = Mach_linux.Ptrace_memory
+module Breakpoints = Remote.Breakpoints.Make (Memory)
+
+let spacing = 64
+
+(* The largest read and execute mapping of [pid], its own text or libc's. *)
+let text pid =
+  Remote.Maps.fold_file (Remote.Maps.path_of_pid pid)
+    (fun best (r : Remote.Region.t) _ ->
+      if
+        Remote.Region.executable r
+        && (not (Remote.Region.writable r))
+        && r.size > snd best
+      then (r.start, r.size)
+      else best)
+    (0, 0)
+
+let check backend start original ~trapped =
+  let len = Bigarray.Array1.dim original in
+  let buf = Remote.Backend.create_buffer len in
+  Report.or_fail (Memory.read backend start buf 0 len);
+  for i = 0 to len - 1 do
+    let want =
+      if trapped && i mod spacing = 0 then '\xcc'
+      else Bigarray.Array1.get original i
+    in
+    if Bigarray.Array1.get buf i <> want then
+      failwith (Printf.sprintf "breakpoints: wrong byte at offset %d" i)
+  done
+
+let () =
+  let target : Target.t = Target.spawn ~size:4096 () in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      (* The child stays stopped, so it never runs the patched text. *)
+      Report.or_fail (Mach_linux.Ptrace.attach target.pid);
+      let start, size = text target.pid in
+      let count = min 10_000 (size / spacing) in
+      let backend = Memory.create target.pid in
+      let original = Remote.Backend.create_buffer (count * spacing) in
+      Report.or_fail (Memory.read backend start original 0 (count * spacing));
+      let bp = Breakpoints.create backend Remote.Core_file.X86_64 in
+      let inserted, t =
+        Report.time (fun () ->
+            for i = 0 to count - 1 do
+              Breakpoints.insert bp (start + (i * spacing))
+            done;
+            Report.or_fail (Breakpoints.commit bp))
+      in
+      Report.ns_per_op "breakpoints/insert" t count;
+      Report.count "breakpoints/inserted" inserted;
+      check backend start original ~trapped:true;
+      let _, t =
+        Report.time (fun () ->
+            for i = 0 to count - 1 do
+              Breakpoints.remove bp (start + (i * spacing))
+            done;
+            Report.or_fail (Breakpoints.commit bp))
+      in
+      Report.ns_per_op "breakpoints/remove" t count;
+      check backend start original ~trapped:false;
+      (* One read and two writes per breakpoint, as a naive debugger would. *)
+      let byte = Remote.Backend.create_buffer 1 in
+      let (), t =
+        Report.time (fun () ->
+            for i = 0 to count - 1 do
+              let address = start + (i * spacing) in
+              Report.or_fail (Memory.read backend address byte 0 1);
+              let old = Bigarray.Array1.get byte 0 in
+              Bigarray.Array1.set byte 0 '\xcc';
+              Report.or_fail (Memory.write backend address byte 0 1);
+              Bigarray.Array1.set byte 0 old;
+              Report.or_fail (Memory.write backend address byte 0 1)
+            done)
+      in
+      Report.ns_per_op "breakpoints/naive" t count;
+      check backend start original ~trapped:false;
+      ignore (Mach_linux.Ptrace.detach target.pid))
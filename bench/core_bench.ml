@@ -0,0 +1,88 @@
+(* Streaming an ELF core dump of a child process: throughput, growth of the
+   benchmark's peak RSS while dumping, and a check that the file holds the
+   child's memory. When gdb is installed it must load the core too.
+
+   dune build @bench *)
+
+(* VmHWM from /proc/self/status, in KiB. *)
+let peak_rss () =
+  let ic = open_in "/proc/self/status" in
+  Fun.protect
+    ~finally:(fun () -> close_in ic)
+    (fun () ->
+      let rec find () =
+        match input_line ic with
+        | line when String.starts_with ~prefix:"VmHWM:" line ->
+            Scanf.sscanf line "VmHWM: %d kB" Fun.id
+        | _ -> find ()
+        | exception End_of_file -> 0
+      in
+      find ())
+
+(* File offset of target [address] according to the PT_LOAD headers. *)
+let file_offset path address =
+  let ic = open_in_bin path in
+  Fun.protect
+    ~finally:(fun () -> close_in ic)
+    (fun () ->
+      let header = really_input_string ic 64 in
+      let u64 s off = Int64.to_int (String.get_int64_le s off) in
+      let phoff = u64 header 32 and phnum = String.get_uint16_le header 56 in
+      seek_in ic phoff;
+      let phdrs = really_input_string ic (56 * phnum) in
+      let rec find i =
+        if i = phnum then failwith "core: address not in any segment"
+        else
+          let p = 56 * i in
+          let vaddr = u64 phdrs (p + 16) and size = u64 phdrs (p + 32) in
+          if
+            String.get_int32_le phdrs p = 1l
+            && address >= vaddr
+            && address < vaddr + size
+          then u64 phdrs (p + 8) + (address - vaddr)
+          else find (i + 1)
+      in
+      find 0)
+
+let check (target : Target.t) path =
+  let ic = open_in_bin path in
+  Fun.protect
+    ~finally:(fun () -> close_in ic)
+    (fun () ->
+      let offset = file_offset path target.address in
+      seek_in ic offset;
+      let got = really_input_string ic 4096 in
+      String.iteri
+        (fun i c ->
+          if c <> Target.expected i then
+            failwith "core: dumped bytes differ from the target")
+        got)
+
+let gdb_loads path =
+  Sys.command "command -v gdb > /dev/null" <> 0
+  || Sys.command
+       (Printf.sprintf "gdb -nx -batch -ex 'info threads' -c %s > /dev/null"
+          (Filename.quote path))
+     = 0
+
+let () =
+  let target : Target.t = Target.spawn () in
+  let path = Filename.temp_file "target" ".core" in
+  Fun.protect
+    ~finally:(fun () ->
+      Target.kill target;
+      Sys.remove path)
+    (fun () ->
+      let before = peak_rss () in
+      let stats, t =
+        Report.time (fun () ->
+            Report.or_fail (Mach_linux.Core.dump target.pid path))
+      in
+      Report.throughput "core/dump" t stats.bytes;
+      Report.count "core/regions" stats.regions;
+      Report.count "core/skipped" stats.skipped;
+      Report.result "core/peak_rss_growth"
+        (float (peak_rss () - before) /. 1024.)
+        "MiB";
+      check target path;
+      if not (gdb_loads path) then failwith "core: gdb cannot load the dump")
@@ -0,0 +1,146 @@
+(* Decoding thread_basic_info and proc_bsdshortinfo records with
+   Remote.Thread_info and Remote.Proc_info compared with Ctypes getf on a
+   structure of the same layout, checked against byte fixtures.
+
+   dune build @bench *)
+
+open Ctypes
+
+let records = 4096
+
+(* The Mach structures only exist on macOS; these describe the same
+   naturally aligned layouts. *)
+type thread_basic_info
+
+let thread_basic_info : thread_basic_info structure typ =
+  structure "thread_basic_info"
+
+let user_time = field thread_basic_info "user_time" (array 2 int32_t)
+let _system_time = field thread_basic_info "system_time" (array 2 int32_t)
+let cpu_usage = field thread_basic_info "cpu_usage" int32_t
+let _policy = field thread_basic_info "policy" int32_t
+let run_state = field thread_basic_info "run_state" int32_t
+let _flags = field thread_basic_info "flags" int32_t
+let suspend_count = field thread_basic_info "suspend_count" int32_t
+let _sleep_time = field thread_basic_info "sleep_time" int32_t
+let () = seal thread_basic_info
+
+type proc_bsdshortinfo
+
+let proc_bsdshortinfo : proc_bsdshortinfo structure typ =
+  structure "proc_bsdshortinfo"
+
+let pbsi_pid = field proc_bsdshortinfo "pbsi_pid" uint32_t
+let pbsi_ppid = field proc_bsdshortinfo "pbsi_ppid" uint32_t
+let _pbsi_pgid = field proc_bsdshortinfo "pbsi_pgid" uint32_t
+let pbsi_status = field proc_bsdshortinfo "pbsi_status" uint32_t
+let _pbsi_comm = field proc_bsdshortinfo "pbsi_comm" (array 16 char)
+let _pbsi_flags = field proc_bsdshortinfo "pbsi_flags" uint32_t
+let pbsi_uid = field proc_bsdshortinfo "pbsi_uid" uint32_t
+let _pbsi_gid = field proc_bsdshortinfo "pbsi_gid" uint32_t
+let _pbsi_ruid = field proc_bsdshortinfo "pbsi_ruid" uint32_t
+let _pbsi_rgid = field proc_bsdshortinfo "pbsi_rgid" uint32_t
+let _pbsi_svuid = field proc_bsdshortinfo "pbsi_svuid" uint32_t
+let _pbsi_svgid = field proc_bsdshortinfo "pbsi_svgid" uint32_t
+let _pbsi_rfu = field proc_bsdshortinfo "pbsi_rfu" uint32_t
+let () = seal proc_bsdshortinfo
+
+let set_u32 buf off v =
+  let b = Bytes.create 4 in
+  Bytes.set_int32_ne b 0 (Int32.of_int v);
+  Bytes.iteri (fun i c -> Bigarray.Array1.set buf (off + i) c) b
+
+(* Record [i] holds values derived from [i] so every field is checked. *)
+let thread_fixture () =
+  let buf = Remote.Backend.create_buffer (records * Remote.Thread_info.size) in
+  for i = 0 to records - 1 do
+    let off = i * Remote.Thread_info.size in
+    for w = 0 to Remote.Thread_info.count - 1 do
+      set_u32 buf (off + (4 * w)) ((i * 16) + w)
+    done
+  done;
+  buf
+
+let proc_fixture () =
+  let buf = Remote.Backend.create_buffer (records * Remote.Proc_info.size) in
+  for i = 0 to records - 1 do
+    let off = i * Remote.Proc_info.size in
+    for w = 0 to (Remote.Proc_info.size / 4) - 1 do
+      set_u32 buf (off + (4 * w)) ((i * 32) + w)
+    done;
+    String.iteri
+      (fun j c -> Bigarray.Array1.set buf (off + 16 + j) c)
+      (Printf.sprintf "proc%d\000" i)
+  done;
+  buf
+
+let check_threads buf =
+  Array.iteri
+    (fun i (t : Remote.Thread_info.t) ->
+      let w k = (i * 16) + k in
+      if
+        t.user_time <> (w 0 * 1_000_000) + w 1
+        || t.system_time <> (w 2 * 1_000_000) + w 3
+        || t.cpu_usage <> w 4 || t.policy <> w 5 || t.run_state <> w 6
+        || t.flags <> w 7 || t.suspend_count <> w 8 || t.sleep_time <> w 9
+      then failwith "decode: thread_basic_info fixture mismatch")
+    (Remote.Thread_info.decode_array buf records)
+
+let check_procs buf =
+  Array.iteri
+    (fun i (p : Remote.Proc_info.t) ->
+      let w k = (i * 32) + k in
+      if
+        p.pid <> w 0 || p.ppid <> w 1 || p.pgid <> w 2 || p.status <> w 3
+        || p.comm <> Printf.sprintf "proc%d" i
+        || p.flags <> w 8 || p.uid <> w 9 || p.svgid <> w 14
+      then failwith "decode: proc_bsdshortinfo fixture mismatch")
+    (Remote.Proc_info.decode_array buf records)
+
+let structs typ buf =
+  CArray.from_ptr
+    (from_voidp typ (to_voidp (bigarray_start array1 buf)))
+    records
+
+let () =
+  let threads = thread_fixture () in
+  check_threads threads;
+  let arr = structs thread_basic_info threads in
+  let i = ref 0 in
+  let next () =
+    let r = !i in
+    i := (r + 1) mod records;
+    r
+  in
+  let ops = 1_000_000 in
+  Report.measure "decode/thread_basic_info-getf" ~ops (fun () ->
+      let s = CArray.get arr (next ()) in
+      ignore
+        (Sys.opaque_identity
+           ( CArray.get (getf s user_time) 0,
+             getf s cpu_usage,
+             getf s run_state,
+             getf s suspend_count )));
+  Report.measure "decode/thread_basic_info-decode" ~ops (fun () ->
+      ignore
+        (Sys.opaque_identity
+           (Remote.Thread_info.decode threads
+              (next () * Remote.Thread_info.size))));
+  let procs = proc_fixture () in
+  check_procs procs;
+  let arr = structs proc_bsdshortinfo procs in
+  Report.measure "decode/proc_bsdshortinfo-getf" ~ops (fun () ->
+      let s = CArray.get arr (next ()) in
+      ignore
+        (Sys.opaque_identity
+           ( getf s pbsi_pid,
+             getf s pbsi_ppid,
+             getf s pbsi_uid,
+             getf s pbsi_status )));
+  Report.measure "decode/proc_bsdshortinfo-decode" ~ops (fun () ->
+      ignore
+        (Sys.opaque_identity
+           (Remote.Proc_info.decode procs (next () * Remote.Proc_info.size))));
+  Report.measure "decode/thread_basic_info-array" ~ops:1_000 (fun () ->
+      ignore
+        (Sys.opaque_identity (Remote.Thread_info.decode_array threads records)))
@@ -0,0 +1,45 @@
+(* Exceptions handled per second by Remote.Exception_server over ptrace: a
+   child raises SIGTRAP against itself in a loop and every trap is resumed.
+
+   dune build @bench *)
+
+module Server = Remote.Exception_server.Make (Mach_linux.Exceptions)
+
+let traps = 20_000
+
+let () =
+  let target : Target.t =
+    Target.spawn ~size:4096
+      ~on_poke:(fun _ ->
+        for _ = 1 to traps do
+          Unix.kill (Unix.getpid ()) Sys.sigtrap
+        done)
+      ()
+  in
+  let source = Mach_linux.Exceptions.create () in
+  Report.or_fail (Mach_linux.Exceptions.add source target.pid);
+  Fun.protect
+    ~finally:(fun () ->
+      Mach_linux.Exceptions.remove source target.pid;
+      Target.kill target)
+    (fun () ->
+      let server = Server.create source in
+      let breakpoints = ref 0 in
+      Server.on server Remote.Exception_server.exc_breakpoint (fun _ ->
+          incr breakpoints;
+          Remote.Backend.Resume);
+      let (), t =
+        Report.time (fun () ->
+            (* The SIGUSR1 running on_poke is itself an exception, forwarded
+               so the handler runs. *)
+            Unix.kill target.pid Sys.sigusr1;
+            Report.or_fail
+              (Server.serve server ~until:(fun () -> !breakpoints >= traps));
+            ignore (Unix.read target.ack (Bytes.create 1) 0 1))
+      in
+      let stats = Server.stats server in
+      Report.result "exceptions/rate" (float stats.handled /. t) "exc/s";
+      Report.result "exceptions/batch"
+        (float stats.handled /. float stats.batches)
+        "exc/batch";
+      if !breakpoints <> traps then failwith "exceptions: lost breakpoints")
@@ -0,0 +1,65 @@
+(* Remote.Images over a synthetic map of thousands of libraries: building
+   the table, refreshing it when nothing changed and after one library was
+   loaded, and looking addresses up, then the same for a live child.
+
+   dune build @bench *)
+
+module Recorded_images = Remote.Images.Make (Remote.Maps.Tracked)
+
+let libraries = 5_000
+let lookups = 1_000_000
+
+let () =
+  let path = Synthetic.libraries libraries in
+  Fun.protect
+    ~finally:(fun () -> Sys.remove path)
+    (fun () ->
+      let source = Remote.Maps.Tracked.create path in
+      let table, t = Report.time (fun () -> Recorded_images.build source) in
+      Report.result "images/synthetic/build" (t *. 1e3) "ms";
+      if Remote.Images.length table <> libraries then
+        failwith "images: wrong number of images";
+      let changed, t =
+        Report.time (fun () -> Recorded_images.refresh table source)
+      in
+      Report.result "images/synthetic/refresh_unchanged" (t *. 1e3) "ms";
+      if changed <> 0 then failwith "images: spurious change";
+      (* dlopen: one more library at the end of the map. *)
+      ignore (Synthetic.libraries ~path (libraries + 1));
+      let resolved = (Remote.Images.stats table).Remote.Images.resolved in
+      let changed, t =
+        Report.time (fun () -> Recorded_images.refresh table source)
+      in
+      Report.result "images/synthetic/refresh_dlopen" (t *. 1e3) "ms";
+      let stats = Remote.Images.stats table in
+      Report.count "images/synthetic/refresh_dlopen/regrouped" changed;
+      Report.count "images/synthetic/refresh_dlopen/resolved"
+        (stats.Remote.Images.resolved - resolved);
+      if changed <> 1 || stats.Remote.Images.resolved - resolved <> 1 then
+        failwith "images: refresh was not incremental";
+      let span = (libraries + 1) * 0x10000 in
+      let addresses =
+        Array.init lookups (fun _ -> Synthetic.map_base + Random.int span)
+      in
+      let hits, t =
+        Report.time (fun () ->
+            Array.fold_left
+              (fun hits a ->
+                if Option.is_some (Remote.Images.find table a) then hits + 1
+                else hits)
+              0 addresses)
+      in
+      Report.ns_per_op "images/synthetic/lookup" t lookups;
+      Report.count "images/synthetic/lookup_hits" hits);
+  let target : Target.t = Target.spawn ~size:4096 () in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let source =
+        Remote.Maps.Tracked.create (Remote.Maps.path_of_pid target.pid)
+      in
+      let table, t = Report.time (fun () -> Recorded_images.build source) in
+      Report.result "images/live/build" (t *. 1e6) "us";
+      Report.count "images/live/images" (Remote.Images.length table);
+      let _, t = Report.time (fun () -> Recorded_images.refresh table source) in
+      Report.result "images/live/refresh" (t *. 1e6) "us")
@@ -0,0 +1,64 @@
+(* Delta snapshots of a 64 MiB region after the target wrote to 1% of its
+   pages, with soft-dirty page hints compared with hashing every page.
+
+   dune build @bench *)
+
+module Reader = Mach_linux.Process_vm
+module Soft = Remote.Incremental.Make (Reader) (Mach_linux.Soft_dirty)
+
+module Hashed =
+  Remote.Incremental.Make (Reader) (Remote.Incremental.Hash_only)
+
+let every = 100
+
+let () =
+  let page_size = Reader.page_size (Reader.create (Unix.getpid ())) in
+  let poke buffer =
+    let len = Bigarray.Array1.dim buffer in
+    let address = Target.address_of_buffer buffer in
+    let first = ((address + page_size - 1) / page_size * page_size) - address in
+    let rec go i =
+      if i < len then (
+        Bigarray.Array1.set buffer i
+          (Char.unsafe_chr (Char.code (Bigarray.Array1.get buffer i) + 1));
+        go (i + (every * page_size)))
+    in
+    go first
+  in
+  let target : Target.t = Target.spawn ~on_poke:poke () in
+  let backend = Reader.create target.pid in
+  (* Whole pages inside the child's buffer. *)
+  let start = (target.address + page_size - 1) / page_size * page_size in
+  let stop =
+    (target.address + Bigarray.Array1.dim target.buffer) / page_size * page_size
+  in
+  let region =
+    Remote.Region.make ~start ~size:(stop - start)
+      ~protection:Remote.Region.(prot_read lor prot_write)
+      ~share_mode:Remote.Region.sm_private ~offset:0 ~object_id:0
+  in
+  let pages = (stop - start) / page_size in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let hints = Mach_linux.Soft_dirty.create ~page_size target.pid in
+      let soft = Soft.create backend hints in
+      let hashed = Hashed.create backend () in
+      let full, t = Report.time (fun () -> Soft.snapshot soft [ region ]) in
+      Report.throughput "incremental/full" t (pages * page_size);
+      ignore (Hashed.snapshot hashed [ region ]);
+      if Array.length full.addresses <> pages then
+        failwith "incremental: full snapshot is missing pages";
+      Target.poke target;
+      let check name (d : Remote.Incremental.delta) t =
+        Report.ns_per_op (name ^ "/delta") t pages;
+        Report.count (name ^ "/pages_read") d.pages_read;
+        Report.count (name ^ "/pages_changed") (Array.length d.addresses);
+        if Array.length d.addresses <> (pages + every - 1) / every then
+          failwith (name ^ ": wrong number of changed pages")
+      in
+      let d, t = Report.time (fun () -> Soft.snapshot soft [ region ]) in
+      check "incremental/soft_dirty" d t;
+      let d, t = Report.time (fun () -> Hashed.snapshot hashed [ region ]) in
+      check "incremental/hashed" d t;
+      Mach_linux.Soft_dirty.close hints)
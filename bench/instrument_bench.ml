@@ -0,0 +1,97 @@
+(* Overhead of Remote.Instrument: reads from an in-memory mock backend bare,
+   through a disabled registry and through an enabled one, from one domain
+   and from several at once, then the same for process_vm_readv against a
+   child. Prints the recorded summary as text at the end.
+
+   dune build @bench *)
+
+module Mock = struct
+  type t = Remote.Backend.buffer
+
+  let page_size _ = 4096
+
+  let read t address buf off len =
+    if address < 0 || len < 0 || address > Bigarray.Array1.dim t - len then
+      Error (Remote.Backend.Unix_error Unix.EFAULT)
+    else (
+      Bigarray.Array1.blit
+        (Bigarray.Array1.sub t address len)
+        (Bigarray.Array1.sub buf off len);
+      Ok ())
+end
+
+module Mock_reader = Remote.Instrument.Reader (Mock)
+module Live_reader = Remote.Instrument.Reader (Mach_linux.Process_vm)
+
+let ops = 1_000_000
+let size = 1 lsl 20
+
+let () =
+  let mock = Remote.Backend.create_buffer size in
+  let buf = Remote.Backend.create_buffer 64 in
+  let registry = Remote.Instrument.create () in
+  let reader = Mock_reader.create ~prefix:"mock" registry mock in
+  let address i = (i * 64) land (size - 1) in
+  let i = ref 0 in
+  Report.measure "instrument/mock-bare" ~ops (fun () ->
+      incr i;
+      ignore (Sys.opaque_identity (Mock.read mock (address !i) buf 0 64)));
+  Report.measure "instrument/mock-disabled" ~ops (fun () ->
+      incr i;
+      ignore
+        (Sys.opaque_identity (Mock_reader.read reader (address !i) buf 0 64)));
+  Remote.Instrument.enable registry;
+  Report.measure "instrument/mock-enabled" ~ops (fun () ->
+      incr i;
+      ignore
+        (Sys.opaque_identity (Mock_reader.read reader (address !i) buf 0 64)));
+  (* Every domain records into its own shard. *)
+  let domains = Remote.Pool.recommended () in
+  let (_ : unit array), t =
+    Report.time (fun () ->
+        Remote.Pool.run domains (fun d ->
+            let buf = Remote.Backend.create_buffer 64 in
+            for i = 1 to ops do
+              ignore
+                (Sys.opaque_identity
+                   (Mock_reader.read reader (address (i + d)) buf 0 64))
+            done))
+  in
+  Report.ns_per_op "instrument/mock-enabled-parallel" t (ops * domains);
+  for _ = 1 to 100 do
+    ignore (Mock_reader.read reader size buf 0 64)
+  done;
+  let summary = Remote.Instrument.snapshot registry in
+  (* The enabled measurement also made 1000 warm-up calls. *)
+  (match summary with
+  | [ { Remote.Instrument.calls; errors = 100; _ } ]
+    when calls = (ops * (domains + 1)) + 1_000 + 100 ->
+      ()
+  | _ -> failwith "instrument: wrong counts");
+  print_string (Remote.Instrument.to_text summary)
+
+let () =
+  let target : Target.t = Target.spawn ~size:(1024 * 1024) () in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let memory = Mach_linux.Process_vm.create target.pid in
+      let buf = Remote.Backend.create_buffer 4096 in
+      let registry = Remote.Instrument.create () in
+      let reader = Live_reader.create ~prefix:"process_vm" registry memory in
+      let ops = 100_000 in
+      Report.measure "instrument/live-bare" ~ops (fun () ->
+          ignore
+            (Sys.opaque_identity
+               (Mach_linux.Process_vm.read memory target.address buf 0 4096)));
+      Report.measure "instrument/live-disabled" ~ops (fun () ->
+          ignore
+            (Sys.opaque_identity
+               (Live_reader.read reader target.address buf 0 4096)));
+      Remote.Instrument.enable registry;
+      Report.measure "instrument/live-enabled" ~ops (fun () ->
+          ignore
+            (Sys.opaque_identity
+               (Live_reader.read reader target.address buf 0 4096)));
+      print_string
+        (Remote.Instrument.to_text (Remote.Instrument.snapshot registry)))
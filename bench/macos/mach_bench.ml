@@ -0,0 +1,52 @@
+(* Cost of the bindings in src/mach.ml against the calling task: a trap with
+   no arguments, a call with an out-parameter, a thread state fetch, and the
+   end-to-end region walk and thread listing behind simple_vmmap and the
+   samplers. Each reports time and allocation per call, and one read is
+   compared through libffi and through the stubs Cstubs generates.
+
+   BENCH_RESULTS=results.jsonl dune build @bench *)
+
+open Ctypes
+
+let ops = 100_000
+
+module Libffi = Mach_bindings.Functions (Mach_bindings.Libffi)
+module Direct = Mach_bindings.Functions (Mach_stubs)
+
+let () =
+  let task = Mach.mach_task_self () in
+  Report.measure "mach/mach_task_self" ~ops (fun () ->
+      ignore (Sys.opaque_identity (Mach.mach_task_self ())));
+  let pid = allocate PosixTypes.pid_t (PosixTypes.Pid.of_int 0) in
+  Report.measure "mach/pid_for_task" ~ops (fun () ->
+      ignore (Mach.pid_for_task task pid));
+  let flavor, words =
+    match Mach_macos.Host.machine () with
+    | Remote.Core_file.X86_64 -> (Mach.x86_thread_state64, 42)
+    | Remote.Core_file.Arm64 ->
+        (Mach.arm_thread_state64, Mach.arm_thread_state64_count)
+  in
+  let state = allocate_n Mach.thread_state_t ~count:words in
+  let count = allocate Mach.mach_msg_type_number_t 0l in
+  let thread = Mach.mach_thread_self () in
+  Report.measure "mach/thread_get_state" ~ops (fun () ->
+      count <-@ Int32.of_int words;
+      ignore (Mach.thread_get_state thread flavor state count));
+  (* The same read through libffi and through the generated stubs. *)
+  let buf = Remote.Backend.create_buffer 8 in
+  let local =
+    raw_address_of_ptr (to_voidp (bigarray_start array1 buf))
+    |> Int64.of_nativeint |> Unsigned.UInt64.of_int64
+  in
+  let len = Unsigned.UInt64.of_int 8 in
+  let outsize = allocate uint64_t Unsigned.UInt64.zero in
+  Report.measure "stubs/libffi-mach_vm_read_overwrite" ~ops (fun () ->
+      ignore (Libffi.mach_vm_read_overwrite task local len local outsize));
+  Report.measure "stubs/cstubs-mach_vm_read_overwrite" ~ops (fun () ->
+      ignore (Direct.mach_vm_read_overwrite task local len local outsize));
+  let regions = Mach_macos.Regions.create task in
+  Report.measure "workload/region-walk" ~ops:1_000 (fun () ->
+      ignore (Mach_macos.Regions.fold regions (fun n _ -> n + 1) 0));
+  Report.measure "workload/thread-list" ~ops:10_000 (fun () ->
+      Mach_macos.Threads.release
+        (Report.or_fail (Mach_macos.Threads.list task)))
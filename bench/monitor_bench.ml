@@ -0,0 +1,50 @@
+(* Rounds of Remote.Monitor over /proc: tasks per second on one domain and
+   on all of them, with the host's processes repeated to a fleet of at least
+   1024 targets, and a sanity check of the stats read for a forked child.
+
+   dune build @bench *)
+
+module Monitor = Remote.Monitor.Make (Mach_linux.Task_stats)
+
+let fleet = 1024
+let rounds = 20
+
+let targets () =
+  let pids =
+    Sys.readdir "/proc" |> Array.to_list
+    |> List.filter_map int_of_string_opt
+    |> Array.of_list
+  in
+  let n = Array.length pids in
+  Array.init (max fleet n) (fun i -> pids.(i mod n))
+
+let () =
+  let source = Mach_linux.Task_stats.create () in
+  let target : Target.t = Target.spawn ~size:4096 () in
+  let monitor = Monitor.create ~domains:1 source in
+  Monitor.set_targets monitor [| target.pid |];
+  ignore (Monitor.round monitor);
+  let s = Monitor.stats monitor 0 in
+  if Monitor.status monitor 0 <> Remote.Monitor.Collected then
+    failwith "monitor: child not collected";
+  if s.threads < 1 || s.resident <= 0 || s.virtual_size < s.resident then
+    failwith "monitor: implausible stats for the child";
+  Target.kill target;
+  let targets = targets () in
+  List.iter
+    (fun domains ->
+      let monitor = Monitor.create ~domains source in
+      Monitor.set_targets monitor targets;
+      ignore (Monitor.round monitor);
+      let last = ref (Monitor.round monitor) in
+      let (), t =
+        Report.time (fun () ->
+            for _ = 1 to rounds do
+              last := Monitor.round monitor
+            done)
+      in
+      let name = Printf.sprintf "monitor/%d-domains" domains in
+      Report.result name (float (rounds * Array.length targets) /. t) "tasks/s";
+      Report.count (name ^ "/collected") !last.collected;
+      Report.count (name ^ "/threads") !last.threads)
+    (List.sort_uniq compare [ 1; Remote.Pool.recommended () ])
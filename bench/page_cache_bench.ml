@@ -0,0 +1,60 @@
+(* Small remote reads issued straight to process_vm_readv compared with the
+   same reads served through Remote.Page_cache.
+
+   dune build @bench *)
+
+module Reader = Mach_linux.Process_vm
+module Cache = Remote.Page_cache.Make (Reader)
+
+let reads = 200_000
+let width = 8
+
+let direct backend addresses =
+  let buf = Remote.Backend.create_buffer width in
+  Array.iter
+    (fun a -> Report.or_fail (Reader.read backend a buf 0 width))
+    addresses
+
+let cached cache addresses =
+  let dst = Bytes.create width in
+  Array.iter
+    (fun a -> Report.or_fail (Cache.read_into cache a dst 0 width))
+    addresses
+
+let run name backend (target : Target.t) addresses =
+  let (), t = Report.time (fun () -> direct backend addresses) in
+  Report.ns_per_op (name ^ "/direct") t reads;
+  let cache = Cache.create ~capacity:1024 ~prefetch:8 backend in
+  let (), t = Report.time (fun () -> cached cache addresses) in
+  Report.ns_per_op (name ^ "/cached") t reads;
+  let { Cache.hits; misses; fetches; _ } = Cache.stats cache in
+  Report.count (name ^ "/hits") hits;
+  Report.count (name ^ "/misses") misses;
+  Report.count (name ^ "/fetches") fetches;
+  (* The cache must hand back exactly what is in the child. *)
+  let a = addresses.(reads / 2) in
+  let got = Report.or_fail (Cache.read cache a width) in
+  for i = 0 to width - 1 do
+    if Bytes.get got i <> Target.expected (a - target.address + i) then
+      failwith (name ^ ": cached bytes differ from the target")
+  done
+
+let () =
+  let target : Target.t = Target.spawn () in
+  let backend = Reader.create target.pid in
+  let size = Bigarray.Array1.dim target.buffer in
+  (* A structure walk: consecutive words across the whole buffer. *)
+  let sequential =
+    Array.init reads (fun i -> target.address + (i * width mod size))
+  in
+  (* Pointer chasing within a working set of 256 pages. *)
+  let working_set = 256 * Reader.page_size backend in
+  let random =
+    Array.init reads (fun _ ->
+        target.address + (Random.int (working_set / width) * width))
+  in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      run "page_cache/sequential" backend target sequential;
+      run "page_cache/random" backend target random)
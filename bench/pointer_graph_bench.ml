@@ -0,0 +1,101 @@
+(* Remote.Pointer_graph over a child process per number of domains, and over
+   a snapshot file of the same buffer. The buffer holds two chains of linked
+   pages; only the first is reachable from the root, so the second must come
+   out as leaked. POINTER_GRAPH_MB sets the buffer size (default 256) to
+   scan multi-gigabyte targets.
+
+   dune build @bench *)
+
+module Reader = Mach_linux.Process_vm
+module Graph = Remote.Pointer_graph.Make (Reader)
+module Snapshot_graph = Remote.Pointer_graph.Make (Remote.View.Reader)
+
+let page = 4096
+
+let size =
+  Option.value ~default:256
+    (Option.bind (Sys.getenv_opt "POINTER_GRAPH_MB") int_of_string_opt)
+  lsl 20
+
+(* First page boundary in the buffer and the number of whole pages after
+   it, less one so the chains stay clear of the buffer's end. *)
+let layout address =
+  let first = (address + page - 1) land lnot (page - 1) in
+  (first, ((address + size - first) / page) - 1)
+
+let prepare buf =
+  let address = Target.address_of_buffer buf in
+  let first, pages = layout address in
+  let link k =
+    let b = Bytes.create 8 in
+    Bytes.set_int64_le b 0 (Int64.of_int (first + ((k + 1) * page)));
+    Bytes.iteri
+      (fun i c ->
+        Bigarray.Array1.set buf (first - address + (k * page) + 8 + i) c)
+      b
+  in
+  for k = 0 to pages - 2 do
+    if k <> (pages / 2) - 1 then link k
+  done
+
+let () =
+  let target : Target.t = Target.spawn ~size ~prepare () in
+  let first, pages = layout target.address in
+  let in_chains a = a >= first && a < first + (pages * page) in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let regions =
+        Reader.regions (Reader.create target.pid) ~start:0 ~stop:max_int
+          ~depth:0
+        |> List.of_seq
+      in
+      List.iter
+        (fun domains ->
+          let (graph, stats), t =
+            Report.time (fun () ->
+                Graph.build ~domains
+                  ~reader:(fun () -> Reader.create target.pid)
+                  regions)
+          in
+          let name = Printf.sprintf "pointer_graph/child/domains_%d" domains in
+          Report.throughput name t stats.bytes;
+          let marks, t =
+            Report.time (fun () ->
+                Remote.Pointer_graph.reachable graph [| first |])
+          in
+          Report.ns_per_op "pointer_graph/reachable/node" t
+            (Remote.Pointer_graph.nodes graph);
+          let leaked =
+            Remote.Pointer_graph.fold_unreachable graph marks
+              (fun n a -> if in_chains a then n + 1 else n)
+              0
+          in
+          if leaked <> pages - (pages / 2) then
+            failwith
+              (Printf.sprintf "pointer_graph: %d pages leaked, expected %d"
+                 leaked
+                 (pages - (pages / 2)));
+          Report.count (name ^ "/edges") (Remote.Pointer_graph.length graph))
+        (List.sort_uniq Int.compare [ 1; 2; 4; Remote.Pool.recommended () ]));
+  let path, oc = Filename.open_temp_file "pointer_graph" ".snapshot" in
+  for i = first - target.address to first - target.address + (pages * page) - 1
+  do
+    output_char oc (Bigarray.Array1.get target.buffer i)
+  done;
+  close_out oc;
+  Fun.protect
+    ~finally:(fun () -> Sys.remove path)
+    (fun () ->
+      let view = Remote.View.of_file ~address:first ~len:(pages * page) path in
+      let snapshot = Remote.View.Reader.create [ view ] in
+      let region =
+        Remote.Region.make ~start:first ~size:(pages * page)
+          ~protection:Remote.Region.(prot_read lor prot_write)
+          ~share_mode:Remote.Region.sm_private ~offset:0 ~object_id:0
+      in
+      let (_, stats), t =
+        Report.time (fun () ->
+            Snapshot_graph.build ~reader:(fun () -> snapshot) [ region ])
+      in
+      Report.throughput "pointer_graph/snapshot" t stats.bytes)
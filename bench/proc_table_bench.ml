@@ -0,0 +1,38 @@
+(* Refreshing Remote.Proc_table from /proc: cost per refresh and per process
+   once the tables are warm, and the deltas seen when a child is started and
+   killed.
+
+   dune build @bench *)
+
+module Table = Remote.Proc_table.Make (Mach_linux.Processes)
+
+let refreshes = 50
+
+let () =
+  let table = Table.create (Mach_linux.Processes.create ()) in
+  ignore (Report.or_fail (Table.refresh table));
+  let target : Target.t = Target.spawn ~size:4096 () in
+  let d = Report.or_fail (Table.refresh table) in
+  let seen = ref false in
+  Table.iter_added table (fun pid -> if pid = target.pid then seen := true);
+  if not !seen then failwith "proc_table: new child not reported as added";
+  let i = Table.find table target.pid in
+  if i < 0 || Table.ppid table i <> Unix.getpid () then
+    failwith "proc_table: child has the wrong parent";
+  Report.count "proc_table/added" d.added;
+  Target.kill target;
+  let d = Report.or_fail (Table.refresh table) in
+  let gone = ref false in
+  Table.iter_exited table (fun pid -> if pid = target.pid then gone := true);
+  if not !gone then failwith "proc_table: killed child not reported as exited";
+  Report.count "proc_table/exited" d.exited;
+  Report.count "proc_table/processes" (Table.length table);
+  Report.measure "proc_table/refresh" ~ops:refreshes (fun () ->
+      ignore (Report.or_fail (Table.refresh table)));
+  let (), t =
+    Report.time (fun () ->
+        for _ = 1 to refreshes do
+          ignore (Report.or_fail (Table.refresh table))
+        done)
+  in
+  Report.ns_per_op "proc_table/process" t (refreshes * Table.length table)
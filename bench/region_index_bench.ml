@@ -0,0 +1,68 @@
+(* Lookup latency of Remote.Region_index and the cost of refreshing part of
+   it compared with rebuilding it, over a synthetic 100k region map and a
+   live child's map.
+
+   dune build @bench *)
+
+module Recorded_index = Remote.Region_index.Make (Remote.Maps.Recorded)
+module Live_index = Remote.Region_index.Make (Mach_linux.Process_vm)
+
+let regions = 100_000
+let lookups = 1_000_000
+
+let lookup_bench name index addresses =
+  let hits, t =
+    Report.time (fun () ->
+        Array.fold_left
+          (fun hits a ->
+            if Remote.Region_index.find_index index a >= 0 then hits + 1
+            else hits)
+          0 addresses)
+  in
+  Report.ns_per_op (name ^ "/lookup") t (Array.length addresses);
+  Report.count (name ^ "/lookup_hits") hits
+
+let () =
+  let path = Synthetic.maps regions in
+  Fun.protect
+    ~finally:(fun () -> Sys.remove path)
+    (fun () ->
+      let index, t = Report.time (fun () -> Recorded_index.build path) in
+      Report.result "region_index/synthetic/build" (t *. 1e3) "ms";
+      let span = regions * Synthetic.map_stride in
+      let addresses =
+        Array.init lookups (fun _ -> Synthetic.map_base + Random.int span)
+      in
+      lookup_bench "region_index/synthetic" index addresses;
+      (* A library was mapped or unmapped: refresh 16 regions around it. *)
+      let start = Synthetic.map_base + (regions / 2 * Synthetic.map_stride) in
+      let stop = start + (16 * Synthetic.map_stride) in
+      let fetched, t =
+        Report.time (fun () ->
+            Recorded_index.refresh_range index path start stop)
+      in
+      Report.result "region_index/synthetic/refresh_16" (t *. 1e3) "ms";
+      Report.count "region_index/synthetic/refresh_16/fetched" fetched;
+      let _, t = Report.time (fun () -> Recorded_index.refresh index path) in
+      Report.result "region_index/synthetic/refresh_all" (t *. 1e3) "ms";
+      if Remote.Region_index.length index <> regions then
+        failwith "region_index: refresh changed the number of regions");
+  let target : Target.t = Target.spawn () in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let backend = Mach_linux.Process_vm.create target.pid in
+      let index = Live_index.build backend in
+      if Remote.Region_index.find_index index target.address < 0 then
+        failwith "region_index: child buffer is not mapped";
+      let addresses =
+        Array.init lookups (fun _ ->
+            target.address + Random.int (Bigarray.Array1.dim target.buffer))
+      in
+      lookup_bench "region_index/child" index addresses;
+      let _, t =
+        Report.time (fun () ->
+            Live_index.refresh_range index backend target.address
+              (target.address + 1))
+      in
+      Report.result "region_index/child/refresh_one" (t *. 1e6) "us")
@@ -0,0 +1,53 @@
+(* Streaming a 100k region map with Remote.Maps compared with building the
+   list of regions first, plus a walk of a live child's map.
+
+   dune build @bench *)
+
+let regions = 100_000
+
+let heap_words f =
+  Gc.full_major ();
+  let before = (Gc.quick_stat ()).top_heap_words in
+  let r = f () in
+  (r, (Gc.quick_stat ()).top_heap_words - before)
+
+let () =
+  let path = Synthetic.maps regions in
+  Fun.protect
+    ~finally:(fun () -> Sys.remove path)
+    (fun () ->
+      let (resident, growth), t =
+        Report.time (fun () ->
+            heap_words (fun () ->
+                Remote.Maps.fold_file path
+                  (fun acc r _ -> acc + r.Remote.Region.size)
+                  0))
+      in
+      Report.ns_per_op "regions/fold/per_region" t regions;
+      Report.result "regions/fold/heap_growth" (float (growth * 8)) "bytes";
+      let (listed, growth), t =
+        Report.time (fun () ->
+            heap_words (fun () ->
+                Remote.Maps.fold_file path (fun acc r _ -> r :: acc) []
+                |> List.rev))
+      in
+      Report.ns_per_op "regions/list/per_region" t regions;
+      Report.result "regions/list/heap_growth" (float (growth * 8)) "bytes";
+      if
+        List.length listed <> regions
+        || List.fold_left (fun acc r -> acc + r.Remote.Region.size) 0 listed
+           <> resident
+      then failwith "regions: fold and list disagree");
+  let target : Target.t = Target.spawn ~size:4096 () in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let backend = Mach_linux.Process_vm.create target.pid in
+      let n, t =
+        Report.time (fun () ->
+            Mach_linux.Process_vm.regions backend ~start:0 ~stop:max_int
+              ~depth:0
+            |> Seq.fold_left (fun n _ -> n + 1) 0)
+      in
+      Report.ns_per_op "regions/child/per_region" t n;
+      Report.count "regions/child/regions" n)
@@ -0,0 +1,60 @@
+(** Timing and output helpers shared by the benchmarks.
+
+    Every result is printed as one [name value unit] line so runs can be
+    compared with standard text tools. When [BENCH_RESULTS] names a file, each
+    result is also appended to it as one JSON object per line, tagged with the
+    benchmark executable, for tracking regressions across runs. *)
+
+let time f =
+  let t0 = Unix.gettimeofday () in
+  let r = f () in
+  (r, Unix.gettimeofday () -. t0)
+
+let bench = Filename.remove_extension (Filename.basename Sys.executable_name)
+
+let results =
+  Option.map
+    (open_out_gen [ Open_wronly; Open_append; Open_creat ] 0o644)
+    (Sys.getenv_opt "BENCH_RESULTS")
+
+let json_float f =
+  if Float.is_finite f then Printf.sprintf "%.17g" f else "null"
+
+let result name value unit =
+  Printf.printf "%-48s %14.2f %s\n%!" name value unit;
+  Option.iter
+    (fun oc ->
+      Printf.fprintf oc
+        "{\"bench\":%S,\"name\":%S,\"value\":%s,\"unit\":%S}\n%!" bench name
+        (json_float value) unit)
+    results
+
+let ns_per_op name seconds ops =
+  result name (seconds *. 1e9 /. float ops) "ns/op"
+
+let count name n = result name (float n) "count"
+
+let throughput name seconds bytes =
+  result name (float bytes /. seconds /. 1e9) "GB/s"
+
+(** [measure name ~ops f] calls [f] [ops] times after a short warm-up and
+    reports the time per call and the minor heap words each call
+    allocated. *)
+let measure name ~ops f =
+  for _ = 1 to min ops 1_000 do
+    f ()
+  done;
+  let before = Gc.minor_words () in
+  let (), t =
+    time (fun () ->
+        for _ = 1 to ops do
+          f ()
+        done)
+  in
+  let words = Gc.minor_words () -. before in
+  ns_per_op name t ops;
+  result (name ^ "/alloc") (words /. float ops) "words/op"
+
+let or_fail = function
+  | Ok v -> v
+  | Error e -> failwith (Remote.Backend.error_to_string e)
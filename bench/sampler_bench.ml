@@ -0,0 +1,31 @@
+(* Cost of one Remote.Sampler round over a child process through ptrace:
+   interrupting every thread, reading its registers and resuming it.
+
+   dune build @bench *)
+
+module Sampler = Remote.Sampler.Make (Mach_linux.Threads)
+
+let rounds = 2_000
+
+let () =
+  let target : Target.t = Target.spawn ~size:4096 () in
+  let source = Mach_linux.Threads.create target.pid in
+  Fun.protect
+    ~finally:(fun () ->
+      Mach_linux.Threads.close source;
+      Target.kill target)
+    (fun () ->
+      let sampler = Sampler.create ~capacity:1024 source in
+      let (), t =
+        Report.time (fun () ->
+            for _ = 1 to rounds do
+              ignore (Report.or_fail (Sampler.sample sampler))
+            done)
+      in
+      let threads = Sampler.total sampler in
+      Report.result "sampler/round" (t *. 1e6 /. float rounds) "us/round";
+      Report.result "sampler/thread" (t *. 1e6 /. float threads) "us/sample";
+      Report.count "sampler/stacks"
+        (List.length (Sampler.folded sampler));
+      if Sampler.length sampler <> min threads 1024 then
+        failwith "sampler: ring buffer lost samples")
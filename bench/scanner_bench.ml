@@ -0,0 +1,80 @@
+(* Remote.Scanner throughput over a child process per number of domains, and
+   over a mapped snapshot file of the same memory.
+
+   dune build @bench *)
+
+module Reader = Mach_linux.Process_vm
+module Scanner = Remote.Scanner.Make (Reader)
+module Snapshot_scanner = Remote.Scanner.Make (Remote.View.Reader)
+
+let signature = "\xde\xad\xbe\xef\xca\xfe\xba\xbe"
+let planted = 100
+
+(* Signatures every 600 KiB, and a pointer back to the buffer every 1 MiB. *)
+let prepare buf =
+  for k = 0 to planted - 1 do
+    String.iteri
+      (fun i c -> Bigarray.Array1.set buf ((k * 600 * 1024) + 3 + i) c)
+      signature
+  done;
+  for k = 0 to (Bigarray.Array1.dim buf / (1 lsl 20)) - 1 do
+    let b = Bytes.create 8 in
+    Bytes.set_int64_le b 0 (Int64.of_int (Target.address_of_buffer buf));
+    Bytes.iteri (fun i c -> Bigarray.Array1.set buf ((k lsl 20) + 64 + i) c) b
+  done
+
+let () =
+  let target : Target.t = Target.spawn ~prepare () in
+  let size = Bigarray.Array1.dim target.buffer in
+  let m =
+    Remote.Scanner.compile
+      [
+        Remote.Scanner.of_string signature;
+        Remote.Scanner.of_hex "de ad ?? ef";
+        Remote.Scanner.pointer target.address;
+      ]
+  in
+  let ranges = [ (target.address, size) ] in
+  let expect name (stats : Remote.Scanner.stats) =
+    let want = (2 * planted) + (size lsr 20) in
+    if stats.matches <> want then
+      failwith
+        (Printf.sprintf "%s: %d matches, expected %d" name stats.matches want)
+  in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      List.iter
+        (fun domains ->
+          let stats, t =
+            Report.time (fun () ->
+                Scanner.scan ~domains
+                  ~reader:(fun () -> Reader.create target.pid)
+                  ranges m ignore)
+          in
+          let name = Printf.sprintf "scanner/child/domains_%d" domains in
+          expect name stats;
+          Report.throughput name t stats.bytes)
+        (List.sort_uniq Int.compare [ 1; 2; 4; Remote.Pool.recommended () ]));
+  let path, oc = Filename.open_temp_file "scanner" ".snapshot" in
+  for i = 0 to size - 1 do
+    output_char oc (Bigarray.Array1.get target.buffer i)
+  done;
+  close_out oc;
+  Fun.protect
+    ~finally:(fun () -> Sys.remove path)
+    (fun () ->
+      let view = Remote.View.of_file ~address:target.address ~len:size path in
+      let n = ref 0 in
+      let (), t =
+        Report.time (fun () ->
+            Remote.Scanner.scan_view m view (fun _ -> incr n))
+      in
+      Report.throughput "scanner/snapshot/view" t size;
+      let snapshot = Remote.View.Reader.create [ view ] in
+      let stats, t =
+        Report.time (fun () ->
+            Snapshot_scanner.scan ~reader:(fun () -> snapshot) ranges m ignore)
+      in
+      expect "scanner/snapshot" stats;
+      Report.throughput "scanner/snapshot/domains" t stats.bytes)
@@ -0,0 +1,96 @@
+(* Stop and resume latency of Remote.Stop_session over ptrace for a child
+   with many threads, against fetching registers per query and writing
+   each edit straight away. Each round stops the child, reads every
+   thread's stack pointer [queries] times, rewrites one register of one
+   thread with its own value and resumes.
+
+   STOP_SESSION_THREADS=500 dune build @bench *)
+
+module States = Mach_linux.Thread_states
+module Session = Remote.Stop_session.Make (States)
+
+let threads =
+  Option.fold ~none:200 ~some:int_of_string
+    (Sys.getenv_opt "STOP_SESSION_THREADS")
+
+let rounds = 50
+let queries = 10
+
+(* rsp in user_regs_struct; the benchmark only runs on x86_64. *)
+let sp = 152
+let general = Remote.Backend.General
+
+let idle () =
+  while true do
+    Thread.delay 60.
+  done
+
+let () =
+  let target : Target.t =
+    Target.spawn ~size:4096
+      ~on_poke:(fun _ ->
+        for _ = 1 to threads do
+          ignore (Thread.create idle ())
+        done)
+      ()
+  in
+  Target.poke target;
+  let states = States.create target.pid in
+  Fun.protect
+    ~finally:(fun () ->
+      States.close states;
+      Target.kill target)
+    (fun () ->
+      let session = Session.create states in
+      let n = ref 0 in
+      let (), t =
+        Report.time (fun () ->
+            for _ = 1 to rounds do
+              n := Report.or_fail (Session.stop session);
+              let tids = Session.threads session in
+              for _ = 1 to queries do
+                Array.iter
+                  (fun tid ->
+                    let r = Session.get_int session tid general sp in
+                    ignore (Report.or_fail r))
+                  tids
+              done;
+              let first = tids.(0) in
+              let v =
+                Report.or_fail (Session.get_int session first general sp)
+              in
+              Report.or_fail (Session.set_int session first general sp v);
+              if Report.or_fail (Session.resume session) <> 1 then
+                failwith "stop_session: wrong write-back"
+            done)
+      in
+      Report.count "stop-session/threads" !n;
+      Report.result "stop-session/round" (t *. 1e6 /. float rounds) "us/round";
+      let stats = Session.stats session in
+      Report.count "stop-session/fetches" stats.Remote.Stop_session.fetches;
+      Report.count "stop-session/writes" stats.Remote.Stop_session.writes;
+      (* The same work with a kernel call per register read and per edit. *)
+      let size = States.state_size states general in
+      let buf = Remote.Backend.create_buffer size in
+      let (), t =
+        Report.time (fun () ->
+            for _ = 1 to rounds do
+              let tids = Report.or_fail (States.stop states) in
+              for _ = 1 to queries do
+                Array.iter
+                  (fun tid ->
+                    let r = States.get_state states tid general buf 0 in
+                    ignore (Report.or_fail r))
+                  tids
+              done;
+              let len =
+                Report.or_fail (States.get_state states tids.(0) general buf 0)
+              in
+              Report.or_fail
+                (States.set_state states tids.(0) general buf 0 len);
+              Report.or_fail (States.resume states)
+            done)
+      in
+      Report.result "stop-session/uncached-round"
+        (t *. 1e6 /. float rounds)
+        "us/round")
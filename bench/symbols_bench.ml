@@ -0,0 +1,85 @@
+(* Remote.Symbols over the system ELF images this benchmark has mapped:
+   cold indexing, warm loads from the on-disk cache, and lookup latency one
+   pc at a time and in batches.
+
+   dune build @bench *)
+
+let libraries () =
+  Remote.Maps.fold_file "/proc/self/maps"
+    (fun acc _ name ->
+      if
+        String.length name > 0
+        && name.[0] = '/'
+        && Sys.file_exists name
+        && not (List.mem name acc)
+      then name :: acc
+      else acc)
+    []
+  |> List.rev
+  (* Skip mapped files that are not images, e.g. locale archives. *)
+  |> List.filter (fun path ->
+         match Remote.Symbols.of_file path with
+         | _ -> true
+         | exception Invalid_argument _ -> false)
+
+let rec remove_tree path =
+  if Sys.is_directory path then (
+    Array.iter
+      (fun f -> remove_tree (Filename.concat path f))
+      (Sys.readdir path);
+    Sys.rmdir path)
+  else Sys.remove path
+
+let lookups = 200_000
+
+let () =
+  let libs = libraries () in
+  let cache_dir =
+    Filename.concat (Filename.get_temp_dir_name ()) "bench-symbols"
+  in
+  Fun.protect
+    ~finally:(fun () -> if Sys.file_exists cache_dir then remove_tree cache_dir)
+    (fun () ->
+      let cold, t =
+        Report.time (fun () ->
+            List.map (fun p -> Remote.Symbols.of_file ~cache_dir p) libs)
+      in
+      Report.result "symbols/cold"
+        (t *. 1e3 /. float (List.length libs))
+        "ms/image";
+      let warm, t =
+        Report.time (fun () ->
+            List.map (fun p -> Remote.Symbols.of_file ~cache_dir p) libs)
+      in
+      Report.result "symbols/warm"
+        (t *. 1e6 /. float (List.length libs))
+        "us/image";
+      Report.count "symbols/functions"
+        (List.fold_left (fun n s -> n + Remote.Symbols.length s) 0 cold);
+      let index =
+        List.fold_left
+          (fun a b ->
+            if Remote.Symbols.length b > Remote.Symbols.length a then b else a)
+          (List.hd warm) warm
+      in
+      let n = Remote.Symbols.length index in
+      if n = 0 then failwith "symbols: no functions found";
+      (* Every symbol must resolve to itself. *)
+      for i = 0 to n - 1 do
+        let start, _ = Remote.Symbols.range index i in
+        match Remote.Symbols.lookup index start with
+        | Some (name, 0) when name = Remote.Symbols.name index i -> ()
+        | _ -> failwith "symbols: lookup of a symbol start failed"
+      done;
+      let pcs =
+        Array.init lookups (fun _ ->
+            let start, stop = Remote.Symbols.range index (Random.int n) in
+            start + Random.int (max 1 (min 4096 (stop - start))))
+      in
+      let (), t =
+        Report.time (fun () ->
+            Array.iter (fun pc -> ignore (Remote.Symbols.find index pc)) pcs)
+      in
+      Report.ns_per_op "symbols/find" t lookups;
+      let _, t = Report.time (fun () -> Remote.Symbols.resolve index pcs) in
+      Report.ns_per_op "symbols/resolve_batch" t lookups)
@@ -0,0 +1,45 @@
+(** Synthetic inputs shared by the benchmarks. *)
+
+let map_base = 0x7f00_0000_0000
+let map_stride = 0x3000
+
+(** [maps regions] writes a temporary file in the [/proc/<pid>/maps] format
+    holding [regions] regions, alternating anonymous and file backed ones with
+    guard gaps, like a large heavily threaded JVM. Returns its path. *)
+let maps regions =
+  let path, oc = Filename.open_temp_file "regions" ".maps" in
+  for i = 0 to regions - 1 do
+    let start = map_base + (i * map_stride) in
+    if i mod 2 = 0 then
+      Printf.fprintf oc "%x-%x rw-p 00000000 00:00 0\n" start (start + 0x2000)
+    else
+      Printf.fprintf oc "%x-%x r-xp %08x 08:01 %d /usr/lib/libsynthetic%d.so\n"
+        start (start + 0x2000) (i * 0x1000) (1000 + i) (i mod 97)
+  done;
+  close_out oc;
+  path
+
+(** [libraries ?path n] writes a [/proc/<pid>/maps] listing of [n] shared
+    libraries, each with read-only, text, read-only data and writable
+    segments followed by an anonymous region, to [path] or a new temporary
+    file. Returns its path. *)
+let libraries ?path n =
+  let path, oc =
+    match path with
+    | Some path -> (path, open_out path)
+    | None -> Filename.open_temp_file "libraries" ".maps"
+  in
+  let segments = [| "r--p"; "r-xp"; "r--p"; "rw-p" |] in
+  for i = 0 to n - 1 do
+    let base = map_base + (i * 0x10000) in
+    Array.iteri
+      (fun k perms ->
+        let start = base + (k * 0x1000) in
+        Printf.fprintf oc "%x-%x %s %08x 08:01 %d /usr/lib/libsynthetic%d.so\n"
+          start (start + 0x1000) perms (k * 0x1000) (100_000 + i) i)
+      segments;
+    Printf.fprintf oc "%x-%x rw-p 00000000 00:00 0\n" (base + 0x4000)
+      (base + 0x6000)
+  done;
+  close_out oc;
+  path
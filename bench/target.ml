@@ -0,0 +1,62 @@
+(** A forked child process to read from.
+
+    The child is a copy of the benchmark itself, so a buffer allocated before
+    the fork sits at the same address in the child and the benchmark knows
+    exactly where to read and what it should find there. *)
+
+type t = {
+  pid : int;
+  buffer : Remote.Backend.buffer;
+  address : int;
+  ack : Unix.file_descr;  (** Readable end of the child's ack pipe. *)
+}
+
+let address_of_buffer buf =
+  Ctypes.(raw_address_of_ptr (to_voidp (bigarray_start array1 buf)))
+  |> Nativeint.to_int
+
+(** Byte expected at offset [i] of the child's buffer. *)
+let expected i = Char.unsafe_chr (i land 0xff)
+
+(** [spawn ?size ?prepare ?on_poke ()] forks a child holding a [size] byte
+    buffer filled with {!expected}, after [prepare] has had a chance to change
+    it. The child runs [on_poke] on its copy of the buffer each time it is
+    {!poke}d. *)
+let spawn ?(size = 64 * 1024 * 1024) ?(prepare = ignore) ?(on_poke = ignore) ()
+    =
+  let buffer = Remote.Backend.create_buffer size in
+  for i = 0 to size - 1 do
+    Bigarray.Array1.unsafe_set buffer i (expected i)
+  done;
+  prepare buffer;
+  let ack, ack_child = Unix.pipe () in
+  (* Install the handler before forking so a poke cannot beat it. *)
+  let previous =
+    Sys.signal Sys.sigusr1
+      (Sys.Signal_handle
+         (fun _ ->
+           on_poke buffer;
+           ignore (Unix.write_substring ack_child "." 0 1)))
+  in
+  match Unix.fork () with
+  | 0 ->
+      let rec idle () =
+        (try Unix.sleep 60 with Unix.Unix_error (Unix.EINTR, _, _) -> ());
+        idle ()
+      in
+      idle ()
+  | pid ->
+      Sys.set_signal Sys.sigusr1 previous;
+      Unix.close ack_child;
+      { pid; buffer; address = address_of_buffer buffer; ack }
+
+(** Run the child's [on_poke] and wait until it has finished. *)
+let poke t =
+  Unix.kill t.pid Sys.sigusr1;
+  let b = Bytes.create 1 in
+  ignore (Unix.read t.ack b 0 1)
+
+let kill t =
+  Unix.kill t.pid Sys.sigkill;
+  ignore (Unix.waitpid [] t.pid);
+  Unix.close t.ack
@@ -0,0 +1,73 @@
+(* Capturing a child into a Remote.Task_snapshot and serving it back: capture
+   throughput, scattered 4 KiB reads from the mapped file compared with
+   process_vm_readv on the live child, and the same reads from one shared
+   snapshot on every domain.
+
+   dune build @bench *)
+
+module Snapshot = Remote.Task_snapshot
+
+let reads = 100_000
+let block = 4096
+
+let () =
+  let target : Target.t = Target.spawn () in
+  let size = Bigarray.Array1.dim target.buffer in
+  let path = Filename.temp_file "task" ".snapshot" in
+  Fun.protect
+    ~finally:(fun () ->
+      Target.kill target;
+      Sys.remove path)
+    (fun () ->
+      let stats, t =
+        Report.time (fun () ->
+            Report.or_fail (Mach_linux.Snapshot.capture target.pid path))
+      in
+      Report.throughput "task_snapshot/capture" t stats.bytes;
+      let snapshot = Snapshot.open_file path in
+      (match Snapshot.proc_info snapshot with
+      | Some p when p.pid = target.pid -> ()
+      | _ -> failwith "task_snapshot: wrong proc_info");
+      let threads =
+        Report.or_fail (Snapshot.sample snapshot (fun _ _ _ _ -> ()))
+      in
+      if threads < 1 then failwith "task_snapshot: no threads";
+      let whole = Remote.Backend.create_buffer size in
+      Report.or_fail (Snapshot.read snapshot target.address whole 0 size);
+      for i = 0 to size - 1 do
+        if Bigarray.Array1.get whole i <> Target.expected i then
+          failwith (Printf.sprintf "task_snapshot: wrong byte at offset %d" i)
+      done;
+      Report.count "task_snapshot/regions" stats.regions;
+      let buf = Remote.Backend.create_buffer block in
+      let address i = target.address + (i * 7919 * block mod (size - block)) in
+      let live = Mach_linux.Process_vm.create target.pid in
+      let (), t =
+        Report.time (fun () ->
+            for i = 0 to reads - 1 do
+              Report.or_fail
+                (Mach_linux.Process_vm.read live (address i) buf 0 block)
+            done)
+      in
+      Report.ns_per_op "task_snapshot/read/live" t reads;
+      let (), t =
+        Report.time (fun () ->
+            for i = 0 to reads - 1 do
+              Report.or_fail (Snapshot.read snapshot (address i) buf 0 block)
+            done)
+      in
+      Report.ns_per_op "task_snapshot/read/snapshot" t reads;
+      let domains = Remote.Pool.recommended () in
+      let _, t =
+        Report.time (fun () ->
+            Remote.Pool.run domains (fun d ->
+                let buf = Remote.Backend.create_buffer block in
+                for i = 0 to reads - 1 do
+                  Report.or_fail
+                    (Snapshot.read snapshot (address (i + d)) buf 0 block)
+                done))
+      in
+      Report.throughput
+        (Printf.sprintf "task_snapshot/read/shared_%d" domains)
+        t
+        (domains * reads * block))
@@ -0,0 +1,89 @@
+(* Unwinding a 200 frame chain built in a child's memory with
+   Remote.Unwinder, compared with one process_vm_readv per frame, and the
+   latency of a real backtrace of the child's thread.
+
+   dune build @bench *)
+
+module Reader = Mach_linux.Process_vm
+
+(* Counts backend calls, to show how many frames each read covers. *)
+module Counting = struct
+  type t = { reader : Reader.t; mutable calls : int }
+
+  let page_size t = Reader.page_size t.reader
+
+  let read t address buf off len =
+    t.calls <- t.calls + 1;
+    Reader.read t.reader address buf off len
+end
+
+module Unwinder = Remote.Unwinder.Make (Counting)
+
+let depth = 200
+let frame_size = 96
+let chain = 4096
+
+(* Frame k sits at [chain + k * frame_size] in the buffer: saved frame
+   pointer of frame k + 1, then a fake return address. *)
+let prepare buf =
+  let base = Target.address_of_buffer buf + chain in
+  for k = 0 to depth - 1 do
+    let at = chain + (k * frame_size) in
+    let next = if k = depth - 1 then 0 else base + ((k + 1) * frame_size) in
+    let b = Bytes.create 16 in
+    Bytes.set_int64_le b 0 (Int64.of_int next);
+    Bytes.set_int64_le b 8 (Int64.of_int (0x400000 + k));
+    Bytes.iteri (fun i c -> Bigarray.Array1.set buf (at + i) c) b
+  done
+
+(* One read per frame, as the hand-written walks did. *)
+let naive backend fp =
+  let buf = Remote.Backend.create_buffer 16 in
+  let rec walk fp n =
+    if fp = 0 then n
+    else (
+      Report.or_fail (Reader.read backend fp buf 0 16);
+      walk (Remote.Decode.get_int buf 0) (n + 1))
+  in
+  walk fp 0
+
+let iterations = 2_000
+
+let () =
+  let target : Target.t = Target.spawn ~size:(1 lsl 20) ~prepare () in
+  let reader = Reader.create target.pid in
+  let fp = target.address + chain in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let (), t =
+        Report.time (fun () ->
+            for _ = 1 to iterations do
+              if naive reader fp <> depth then failwith "unwind: naive walk"
+            done)
+      in
+      Report.ns_per_op "unwind/per_frame_reads" t iterations;
+      let counting = { Counting.reader; calls = 0 } in
+      let unwinder = Unwinder.create ~max_frames:1024 counting in
+      let (), t =
+        Report.time (fun () ->
+            for _ = 1 to iterations do
+              Unwinder.invalidate unwinder;
+              let frames = Unwinder.backtrace unwinder ~pc:0 ~sp:fp ~fp in
+              if
+                Array.length frames <> depth + 1
+                || frames.(depth) <> 0x400000 + depth - 1
+              then failwith "unwind: wrong backtrace"
+            done)
+      in
+      Report.ns_per_op "unwind/chunked" t iterations;
+      Report.result "unwind/reads_per_unwind"
+        (float counting.calls /. float iterations)
+        "reads";
+      let traces, t =
+        Report.time (fun () ->
+            Report.or_fail (Mach_linux.Backtrace.all target.pid))
+      in
+      Report.result "unwind/thread_backtrace"
+        (t *. 1e6 /. float (List.length traces))
+        "us/thread")
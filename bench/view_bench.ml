@@ -0,0 +1,51 @@
+(* Dumping a large region as a Remote.View compared with reading it into
+   OCaml bytes, measuring time and OCaml heap allocation.
+
+   dune build @bench *)
+
+module Reader = Mach_linux.Process_vm
+
+let heap_words f =
+  let before = Gc.minor_words () +. (Gc.quick_stat ()).major_words in
+  let r = f () in
+  let after = Gc.minor_words () +. (Gc.quick_stat ()).major_words in
+  (r, after -. before)
+
+let checksum get len =
+  let sum = ref 0 in
+  for i = 0 to len - 1 do
+    sum := !sum + Char.code (get i)
+  done;
+  !sum
+
+let () =
+  let target : Target.t = Target.spawn () in
+  let backend = Reader.create target.pid in
+  let len = Bigarray.Array1.dim target.buffer in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let (bytes, words), t =
+        Report.time (fun () ->
+            heap_words (fun () ->
+                let buf = Remote.Backend.create_buffer len in
+                Report.or_fail (Reader.read backend target.address buf 0 len);
+                let dst = Bytes.create len in
+                Remote.Backend.blit_to_bytes buf 0 dst 0 len;
+                dst))
+      in
+      Report.throughput "view/bytes" t len;
+      Report.result "view/bytes/heap" (words *. 8.) "bytes";
+      let (view, words), t =
+        Report.time (fun () ->
+            heap_words (fun () ->
+                Report.or_fail (Reader.view backend target.address len)))
+      in
+      Report.throughput "view/view" t len;
+      Report.result "view/view/heap" (words *. 8.) "bytes";
+      let data = Remote.View.data view in
+      if
+        checksum (Bytes.get bytes) len
+        <> checksum (Bigarray.Array1.get data) len
+      then failwith "view: view and bytes differ";
+      Remote.View.release view)
@@ -0,0 +1,100 @@
+(* Catching every store to one byte of a child: a hardware watchpoint from
+   Remote.Watchpoints, which stops only on the stores, against single
+   stepping the child and checking the byte after every instruction.
+
+   dune build @bench *)
+
+module Watchpoints = Remote.Watchpoints.Make (Mach_linux.Debug_registers)
+module Memory = Mach_linux.Ptrace_memory
+
+let writes = 2_000
+let sigtrap = 5
+
+(* Run the child's on_poke under ptrace. [trap] is called on each SIGTRAP
+   and says whether to keep stepping, or resume freely once it is done. *)
+let drive (target : Target.t) ~step ~trap =
+  Unix.kill target.pid Sys.sigusr1;
+  let resume ?signal () =
+    if step then Mach_linux.Ptrace.step ?signal target.pid
+    else Mach_linux.Ptrace.cont ?signal target.pid
+  in
+  let rec loop () =
+    match Report.or_fail (Mach_linux.Ptrace.wait target.pid) with
+    | Some (Mach_linux.Ptrace.Stopped s) when s = sigtrap ->
+        if trap () then (
+          Report.or_fail (resume ());
+          loop ())
+        else Report.or_fail (Mach_linux.Ptrace.cont target.pid)
+    | Some (Mach_linux.Ptrace.Stopped signal) ->
+        (* The SIGUSR1 that runs on_poke. *)
+        Report.or_fail (resume ~signal ());
+        loop ()
+    | Some _ -> failwith "watchpoints: child exited"
+    | None -> loop ()
+  in
+  loop ();
+  ignore (Unix.read target.ack (Bytes.create 1) 0 1)
+
+let () =
+  let target : Target.t =
+    Target.spawn ~size:4096
+      ~on_poke:(fun buf ->
+        for i = 1 to writes do
+          Bigarray.Array1.unsafe_set buf 0 (Char.unsafe_chr (i land 0xff))
+        done)
+      ()
+  in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      Report.or_fail (Mach_linux.Ptrace.attach target.pid);
+      let registers =
+        Report.or_fail
+          (Mach_linux.Debug_registers.create target.pid
+             Remote.Core_file.X86_64)
+      in
+      let wp = Watchpoints.create registers Remote.Core_file.X86_64 in
+      let slot =
+        match
+          Watchpoints.add wp ~kind:Remote.Watchpoints.Write ~len:1
+            target.address
+        with
+        | Some slot -> slot
+        | None -> failwith "watchpoints: no free slot"
+      in
+      ignore (Report.or_fail (Watchpoints.commit wp));
+      let hits = ref 0 in
+      let (), t =
+        Report.time (fun () ->
+            drive target ~step:false ~trap:(fun () ->
+                (match
+                   Report.or_fail
+                     (Watchpoints.hit wp target.pid ~address:target.address)
+                 with
+                | Some s when s = slot -> incr hits
+                | _ -> ());
+                !hits < writes))
+      in
+      if !hits <> writes then failwith "watchpoints: lost hits";
+      Report.ns_per_op "watchpoints/hardware" t writes;
+      Watchpoints.remove wp slot;
+      ignore (Report.or_fail (Watchpoints.commit wp));
+      (* Without the watchpoint, step and compare the byte each time, as
+         emulation without debug registers has to. *)
+      let memory = Memory.create target.pid in
+      let byte = Remote.Backend.create_buffer 1 in
+      let last = ref (Bigarray.Array1.get target.buffer 0) in
+      let changes = ref 0 and steps = ref 0 in
+      let (), t =
+        Report.time (fun () ->
+            drive target ~step:true ~trap:(fun () ->
+                incr steps;
+                Report.or_fail (Memory.read memory target.address byte 0 1);
+                let b = Bigarray.Array1.get byte 0 in
+                if b <> !last then (
+                  last := b;
+                  incr changes);
+                !changes < writes))
+      in
+      Report.ns_per_op "watchpoints/single-step" t writes;
+      Report.count "watchpoints/single-steps" !steps)
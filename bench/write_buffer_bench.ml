@@ -0,0 +1,95 @@
+(* Patching 10k scattered words of a child through Remote.Write_buffer,
+   compared with one process_vm_writev per word. Every fourth word overlaps
+   the one before it, so merging is exercised as well as batching. A run
+   of adjacent writes, which all merge into one extent, is timed as well.
+
+   dune build @bench *)
+
+module Memory = Mach_linux.Process_vm
+module Write_buffer = Remote.Write_buffer.Make (Memory)
+
+let count = 10_000
+let spacing = 24
+let word = 8
+
+(* Offset of the [i]th write: most are [spacing] apart, every fourth starts
+   inside the previous one. *)
+let offset i = (i * spacing) - if i mod 4 = 3 then spacing - 4 else 0
+let size = (count * spacing) + 4096
+
+let fill buf i =
+  for b = 0 to word - 1 do
+    Bigarray.Array1.set buf b (Char.unsafe_chr ((i + b + 0x80) land 0xff))
+  done
+
+let check backend (target : Target.t) =
+  let expected = Remote.Backend.create_buffer size in
+  for i = 0 to size - 1 do
+    Bigarray.Array1.set expected i (Target.expected i)
+  done;
+  let w = Remote.Backend.create_buffer word in
+  for i = 0 to count - 1 do
+    fill w i;
+    Bigarray.Array1.blit w (Bigarray.Array1.sub expected (offset i) word)
+  done;
+  let buf = Remote.Backend.create_buffer size in
+  Report.or_fail (Memory.read backend target.address buf 0 size);
+  if buf <> expected then failwith "write_buffer: target memory is wrong"
+
+let () =
+  let target : Target.t = Target.spawn ~size () in
+  Fun.protect
+    ~finally:(fun () -> Target.kill target)
+    (fun () ->
+      let backend = Memory.create target.pid in
+      let wb = Write_buffer.create backend in
+      let w = Remote.Backend.create_buffer word in
+      let spans, t =
+        Report.time (fun () ->
+            for i = 0 to count - 1 do
+              fill w i;
+              Write_buffer.write wb (target.address + offset i) w 0 word
+            done;
+            Report.or_fail (Write_buffer.commit wb))
+      in
+      Report.ns_per_op "write_buffer/write+commit" t count;
+      Report.count "write_buffer/spans" spans;
+      check backend target;
+      (* Reads see writes that have not been committed yet. *)
+      let back = Remote.Backend.create_buffer word in
+      Bigarray.Array1.fill w '\xff';
+      Write_buffer.write wb target.address w 0 word;
+      Report.or_fail (Write_buffer.read wb (target.address + 4) back 0 word);
+      if
+        Bigarray.Array1.get back 0 <> '\xff'
+        || Bigarray.Array1.get back 4 = '\xff'
+      then failwith "write_buffer: read does not see the pending write";
+      Write_buffer.discard wb;
+      let (), t =
+        Report.time (fun () ->
+            for i = 0 to count - 1 do
+              fill w i;
+              Report.or_fail
+                (Memory.write backend (target.address + offset i) w 0 word)
+            done)
+      in
+      Report.ns_per_op "write_buffer/naive" t count;
+      check backend target;
+      (* Adjacent words: one growing extent and one span. *)
+      let spans, t =
+        Report.time (fun () ->
+            for i = 0 to (size / word) - 1 do
+              fill w i;
+              Write_buffer.write wb (target.address + (i * word)) w 0 word
+            done;
+            Report.or_fail (Write_buffer.commit wb))
+      in
+      Report.ns_per_op "write_buffer/adjacent" t (size / word);
+      if spans <> 1 then failwith "write_buffer: adjacent writes not merged";
+      let buf = Remote.Backend.create_buffer size in
+      Report.or_fail (Memory.read backend target.address buf 0 size);
+      for i = 0 to (size / word) - 1 do
+        fill w i;
+        if Bigarray.Array1.sub buf (i * word) word <> w then
+          failwith "write_buffer: adjacent writes are wrong"
+      done)
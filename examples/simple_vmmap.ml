@@ -19,11 +19,6 @@ open PosixTypes
 open Ctypes
 open Mach
 
-(* TODO Add these constants into mach.ml *)
-
-let vm_region_submap_info_count_64 =
-  sizeof vm_region_submap_info_data_64_t / sizeof natural_t
-
 (** From `mach/kern_return.h` *)
 
 let format_display_size (size : uint64_t) =
@@ -88,60 +83,35 @@ let get_memory_protection (prot : int32) =
 let vmmap task start_ end_ (depth : int) =
   let pid = allocate pid_t (PosixTypes.Pid.of_int 0) in
   let _ = Mach.pid_for_task !@task pid in
-  let result = ref [] in
-  let start_ = ref start_ in
-  let break = ref false in
-  while !break == false do
-    let address = allocate mach_vm_address_t !start_ in
-    let size = allocate mach_vm_size_t Unsigned.UInt64.zero in
-    let depth0 = allocate vm_region_recurse_info_t (Int32.of_int depth) in
-    let info =
-      allocate vm_region_submap_info_data_64_t
-        (make vm_region_submap_info_data_64_t)
-    in
-    let count =
-      allocate mach_msg_type_number_t
-        (Int32.of_int vm_region_submap_info_count_64)
-    in
-    let kr =
-      Mach.mach_vm_region_recurse !@task address size depth0
-        (to_voidp info |> from_voidp vm_region_recurse_info_t)
-        count
-    in
-
-    if (not (Int32.equal kr kern_success)) || !@address > end_ then
-      (* TODO no break statement in OCaml we need to restructure this as tailrec recursion *)
-      break := true
-    else
-      let address_start = !@address in
-      let address_end = Unsigned.UInt64.add address_start !@size in
-      (* macOS has current permissions and max permissions as
-         info.protection and info.max_protection.
-         Here we simplify that to current permissions.
-       *)
-      let pr, pw, px = get_memory_protection (getf !@info protection) in
-      let ps = '-' in
-      let pathname = CArray.make char (4 + 4096) in
-      let _kr =
-        Mach.proc_regionfilename !@pid !@address
-          (to_voidp (CArray.start pathname))
-          (Unsigned.UInt32.of_int (4 + 4096))
-      in
-      let pathname_str =
-        CArray.to_list pathname |> List.to_seq |> String.of_seq
-      in
-      let offset = Unsigned.UInt64.zero in
-      let device_major = 0 in
-      let device_minor = 0 in
-      let inode = Unsigned.UInt64.zero in
-      let entry =
-        mk_entry address_start address_end pr pw px ps offset device_major
-          device_minor inode pathname_str
-      in
-      result := entry :: !result;
-      start_ := Unsigned.UInt64.add !@address !@size
-  done;
-  !result
+  let pathname = CArray.make char (4 + 4096) in
+  let regions = Mach_macos.Regions.create !@task in
+  (* Regions are fetched one at a time as the sequence is consumed, so the
+     first line prints before the map has been walked. *)
+  Mach_macos.Regions.to_seq ~start:start_ ~stop:end_ ~depth regions
+  |> Seq.map (fun (region : Remote.Region.t) ->
+         let address_start = Unsigned.UInt64.of_int region.start in
+         let address_end = Unsigned.UInt64.of_int (Remote.Region.stop region) in
+         (* macOS has current permissions and max permissions as
+            info.protection and info.max_protection.
+            Here we simplify that to current permissions.
+          *)
+         let pr, pw, px =
+           get_memory_protection (Int32.of_int region.protection)
+         in
+         let ps = '-' in
+         let _kr =
+           Mach.proc_regionfilename !@pid address_start
+             (to_voidp (CArray.start pathname))
+             (Unsigned.UInt32.of_int (4 + 4096))
+         in
+         let pathname_str = coerce (ptr char) string (CArray.start pathname) in
+         CArray.set pathname 0 '\000';
+         let offset = Unsigned.UInt64.of_int region.offset in
+         let device_major = 0 in
+         let device_minor = 0 in
+         let inode = Unsigned.UInt64.zero in
+         mk_entry address_start address_end pr pw px ps offset device_major
+           device_minor inode pathname_str)
 
 let () =
   if Array.length Sys.argv <> 2 then
@@ -160,11 +130,7 @@ let () =
       Printf.printf "Virtal Memory Map (depth=%u) for PID %d\n" depth
         (Pid.to_int pid);
       Printf.printf "          START - END             [ VSIZE ] PRT FILE\n";
-      let maps =
-        vmmap task Unsigned.UInt64.zero Unsigned.UInt64.max_int depth
-      in
-
-      List.iter
+      Seq.iter
         (fun map ->
           Printf.printf "%016u-%016u [ %s ] %c%c%c%c %6s\n"
             (Unsigned.UInt64.to_int map.address_start)
@@ -176,4 +142,4 @@ let () =
             (if map.perm_execute then 'x' else '-')
             (if map.perm_shared then 's' else '-')
             map.pathname)
-        (List.rev maps))
+        (vmmap task 0 max_int depth))
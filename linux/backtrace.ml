@@ -0,0 +1,18 @@
+(** Frame pointer backtraces of every thread of a Linux process, reading stack
+    memory with [process_vm_readv] while ptrace holds the threads stopped. *)
+
+module Unwinder = Remote.Unwinder.Make (Process_vm)
+
+(** [all ?max_frames pid] returns [(tid, frames)] for every thread of [pid],
+    [frames] being the program counter followed by return addresses. The
+    caller must be allowed to ptrace [pid]. *)
+let all ?max_frames pid =
+  let threads = Threads.create pid in
+  let unwinder = Unwinder.create ?max_frames (Process_vm.create pid) in
+  let traces = ref [] in
+  Fun.protect
+    ~finally:(fun () -> Threads.close threads)
+    (fun () ->
+      Threads.sample threads (fun tid pc sp fp ->
+          traces := (tid, Unwinder.backtrace unwinder ~pc ~sp ~fp) :: !traces)
+      |> Result.map (fun _ -> List.rev !traces))
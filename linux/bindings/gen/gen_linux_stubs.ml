@@ -0,0 +1,29 @@
+(* Writes the C stubs or the OCaml module binding
+   Mach_linux_bindings.Functions directly, for ../../stubs. Each stub returns
+   errno alongside the result.
+
+   gen_linux_stubs.exe (c|ml) *)
+
+let prefix = "mach_linux_stub"
+
+let prelude =
+  {|#define _GNU_SOURCE
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+|}
+
+let () =
+  let fmt = Format.std_formatter in
+  let errno = Cstubs.return_errno in
+  (match Sys.argv with
+  | [| _; "c" |] ->
+      Format.pp_print_string fmt prelude;
+      Cstubs.write_c fmt ~errno ~prefix (module Mach_linux_bindings.Functions)
+  | [| _; "ml" |] ->
+      Cstubs.write_ml fmt ~errno ~prefix (module Mach_linux_bindings.Functions)
+  | _ ->
+      prerr_endline "usage: gen_linux_stubs (c|ml)";
+      exit 2);
+  Format.pp_print_flush fmt ()
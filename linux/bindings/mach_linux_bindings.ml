@@ -0,0 +1,68 @@
+open Ctypes
+
+(** Types from `sys/uio.h` *)
+
+type iovec
+
+let iovec : iovec structure typ = structure "iovec"
+let iov_base = field iovec "iov_base" (ptr void)
+let iov_len = field iovec "iov_len" size_t
+let () = seal iovec
+
+(** Functions from `sys/uio.h`, `sys/ptrace.h`, `sys/wait.h` and
+    `unistd.h`. Each sets [errno] on failure; the instances turn that into
+    [Unix.Unix_error]. *)
+module Functions (F : Ctypes.FOREIGN) = struct
+  open F
+
+  (* ssize_t process_vm_readv(pid_t pid,
+         const struct iovec *local_iov, unsigned long liovcnt,
+         const struct iovec *remote_iov, unsigned long riovcnt,
+         unsigned long flags); *)
+  let process_vm_readv =
+    foreign "process_vm_readv"
+      (PosixTypes.pid_t @-> ptr iovec @-> ulong @-> ptr iovec @-> ulong
+     @-> ulong @-> returning PosixTypes.ssize_t)
+
+  (* ssize_t process_vm_writev(pid_t pid,
+         const struct iovec *local_iov, unsigned long liovcnt,
+         const struct iovec *remote_iov, unsigned long riovcnt,
+         unsigned long flags); *)
+  let process_vm_writev =
+    foreign "process_vm_writev"
+      (PosixTypes.pid_t @-> ptr iovec @-> ulong @-> ptr iovec @-> ulong
+     @-> ulong @-> returning PosixTypes.ssize_t)
+
+  (* long ptrace(enum __ptrace_request request, pid_t pid, void *addr,
+         void *data);
+
+     glibc declares it variadic. The generated stubs call it from C, which
+     handles that; through libffi every argument is passed in an integer
+     register on the architectures we support, so a fixed four argument call
+     is equivalent. *)
+  let ptrace =
+    foreign "ptrace"
+      (int @-> PosixTypes.pid_t @-> ptr void @-> ptr void @-> returning long)
+
+  (* pid_t waitpid(pid_t pid, int *wstatus, int options); *)
+  let waitpid =
+    foreign "waitpid"
+      (PosixTypes.pid_t @-> ptr int @-> int @-> returning PosixTypes.pid_t)
+
+  let getpagesize = foreign "getpagesize" (void @-> returning int)
+end
+
+(** Dynamic binding through libffi, raising [Unix.Unix_error] when a call
+    sets [errno]. *)
+module Libffi = struct
+  type 'a fn = 'a Ctypes.fn
+  type 'a return = 'a
+
+  let ( @-> ) = Ctypes.( @-> )
+  let returning = Ctypes.returning
+
+  type 'a result = 'a
+
+  let foreign name fn = Foreign.foreign ~check_errno:true name fn
+  let foreign_value name typ = Foreign.foreign_value name typ
+end
@@ -0,0 +1,56 @@
+(** ELF core dumps of a live Linux process.
+
+    Every thread is stopped with ptrace while the dump is written, so memory
+    and registers come from the same moment, and resumed afterwards. *)
+
+module Writer = Remote.Core_file.Make (Process_vm)
+
+let stop_all pid =
+  match Ptrace.threads pid with
+  | Error e -> Error e
+  | Ok tids ->
+      List.fold_left
+        (fun acc tid ->
+          match acc with
+          | Error _ -> acc
+          | Ok stopped -> (
+              match Ptrace.attach tid with
+              | Ok () -> Ok (tid :: stopped)
+              | Error e ->
+                  List.iter (fun t -> ignore (Ptrace.detach t)) stopped;
+                  Error e))
+        (Ok []) tids
+
+(** [dump ?chunk_size ?depth pid path] writes an ELF core of [pid] to [path].
+    The caller must be allowed to ptrace [pid]. *)
+let dump ?chunk_size ?depth pid path =
+  match stop_all pid with
+  | Error e -> Error e
+  | Ok stopped ->
+      Fun.protect
+        ~finally:(fun () ->
+          List.iter (fun t -> ignore (Ptrace.detach t)) stopped)
+        (fun () ->
+          let threads =
+            List.rev stopped
+            |> List.filter_map (fun tid ->
+                   Result.to_option (Ptrace.thread_state tid))
+          in
+          match threads with
+          | [] -> Error (Remote.Backend.Unix_error Unix.ESRCH)
+          | first :: _ -> (
+              match
+                Ptrace.machine_of_regs_size
+                  (String.length first.Remote.Core_file.state)
+              with
+              | None -> Error (Remote.Backend.Unix_error Unix.ENOSYS)
+              | Some machine ->
+                  let backend = Process_vm.create pid in
+                  let regions =
+                    Process_vm.regions backend ~start:0 ~stop:max_int ~depth:0
+                    |> List.of_seq
+                  in
+                  Ok
+                    (Writer.write ?chunk_size ?depth backend
+                       ~format:Remote.Core_file.Elf ~machine ~threads regions
+                       path)))
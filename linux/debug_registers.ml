@@ -0,0 +1,110 @@
+(** Debug registers of a traced Linux process as a
+    {!Remote.Backend.DEBUG_REGISTERS}.
+
+    On x86_64 they live in [struct user] at [u_debugreg] and take one
+    [PTRACE_PEEKUSER] or [PTRACE_POKEUSER] per register. DR7 is written
+    last, since the kernel checks the enabled slots against DR0 to DR3. On
+    arm64 they are the [NT_ARM_HW_WATCH] register set, moved whole. Either
+    way the thread must be in a ptrace stop. *)
+
+(* offsetof (struct user, u_debugreg) on x86_64. *)
+let u_debugreg = 848
+let nt_arm_hw_watch = 0x403
+
+(* struct user_hwdebug_state: dbg_info, padding, then 16 of { addr; ctrl;
+   padding }. *)
+let hwdebug_size = 8 + (16 * 16)
+
+type t = {
+  pid : int;
+  machine : Remote.Core_file.machine;
+  slots : int;
+  regset : Remote.Backend.buffer;
+}
+
+(** [create pid machine] for the stopped process [pid]. On arm64 the number
+    of watchpoints comes from the kernel. *)
+let create pid machine =
+  let regset = Remote.Backend.create_buffer hwdebug_size in
+  match machine with
+  | Remote.Core_file.X86_64 -> Ok { pid; machine; slots = 4; regset }
+  | Remote.Core_file.Arm64 -> (
+      match Ptrace.get_regset pid nt_arm_hw_watch regset with
+      | Error e -> Error e
+      | Ok _ ->
+          let slots = Remote.Decode.get_uint8 regset 0 in
+          Ok { pid; machine; slots; regset })
+
+let slots t = t.slots
+
+let threads t = Ptrace.threads t.pid
+
+let peek tid n =
+  match
+    Ptrace.ptrace Ptrace.ptrace_peekuser (Ptrace.pid tid)
+      (Ptrace.word (u_debugreg + (8 * n)))
+      Ctypes.null
+  with
+  | w -> Ok (Signed.Long.to_int w)
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+let poke tid n v =
+  Result.map ignore
+    (Ptrace.call Ptrace.ptrace_pokeuser tid
+       (Ptrace.word (u_debugreg + (8 * n)))
+       (Ptrace.word v))
+
+let set_u32 buf off v =
+  for i = 0 to 3 do
+    Bigarray.Array1.set buf (off + i)
+      (Char.unsafe_chr ((v lsr (8 * i)) land 0xff))
+  done
+
+let set_u64 buf off v =
+  set_u32 buf off (v land 0xffff_ffff);
+  set_u32 buf (off + 4) (v lsr 32)
+
+let ( >>= ) = Result.bind
+
+let get t tid (state : Remote.Backend.debug_state) =
+  match t.machine with
+  | Remote.Core_file.X86_64 ->
+      let rec values i =
+        if i = 4 then Ok ()
+        else
+          peek tid i >>= fun v ->
+          state.values.(i) <- v;
+          values (i + 1)
+      in
+      values 0 >>= fun () ->
+      peek tid 6 >>= fun dr6 ->
+      peek tid 7 >>= fun dr7 ->
+      state.status <- dr6;
+      state.controls.(0) <- dr7;
+      Ok ()
+  | Remote.Core_file.Arm64 ->
+      Ptrace.get_regset tid nt_arm_hw_watch t.regset >>= fun _ ->
+      for i = 0 to t.slots - 1 do
+        state.values.(i) <- Remote.Decode.get_int t.regset (8 + (16 * i));
+        state.controls.(i) <- Remote.Decode.get_uint32 t.regset (16 + (16 * i))
+      done;
+      Ok ()
+
+let set t tid (state : Remote.Backend.debug_state) =
+  match t.machine with
+  | Remote.Core_file.X86_64 ->
+      (* Clear DR7 first so no half-updated slot is ever enabled. *)
+      let rec values i =
+        if i = 4 then Ok ()
+        else poke tid i state.values.(i) >>= fun () -> values (i + 1)
+      in
+      poke tid 7 0 >>= fun () ->
+      values 0 >>= fun () ->
+      poke tid 6 state.status >>= fun () -> poke tid 7 state.controls.(0)
+  | Remote.Core_file.Arm64 ->
+      for i = 0 to t.slots - 1 do
+        set_u64 t.regset (8 + (16 * i)) state.values.(i);
+        set_u32 t.regset (16 + (16 * i)) state.controls.(i);
+        set_u32 t.regset (20 + (16 * i)) 0
+      done;
+      Ptrace.set_regset tid nt_arm_hw_watch t.regset (8 + (16 * t.slots))
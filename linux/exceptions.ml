@@ -0,0 +1,151 @@
+(** Exceptions of traced Linux processes, as a {!Remote.Backend.EVENTS}.
+
+    A signal stopping a traced thread plays the part of a Mach exception and
+    is reported with the same numbering: [SIGSEGV] and [SIGBUS] as
+    [EXC_BAD_ACCESS] with the faulting address as subcode, [SIGILL] as
+    [EXC_BAD_INSTRUCTION], [SIGFPE] as [EXC_ARITHMETIC], [SIGTRAP] as
+    [EXC_BREAKPOINT], and any other signal as [EXC_SOFTWARE] with code
+    [EXC_SOFT_SIGNAL] and the signal as subcode, as macOS does. Answering
+    [Resume] suppresses the signal; [Forward] delivers it.
+
+    Exceptions are collected with [waitpid(-1)], so every child of the
+    calling process is reaped by the source, and the calling thread must be
+    the one that called {!add}. *)
+
+type t = {
+  tasks : (int, int) Hashtbl.t;  (** Thread id to process id. *)
+  siginfo : Remote.Backend.buffer;
+  mutable replies : (int * int) list;  (** Thread, signal to deliver. *)
+}
+
+let create () =
+  {
+    tasks = Hashtbl.create 64;
+    siginfo = Remote.Backend.create_buffer 128;
+    replies = [];
+  }
+
+(* Linux signal numbers, which Sys does not expose. *)
+let sigill = 4
+let sigtrap = 5
+let sigbus = 7
+let sigfpe = 8
+let sigsegv = 11
+
+(** [add t pid] starts catching the exceptions of every thread of [pid],
+    including threads it creates later. The threads keep running. *)
+let add t pid =
+  match Ptrace.threads pid with
+  | Error e -> Error e
+  | Ok tids ->
+      List.fold_left
+        (fun acc tid ->
+          match acc with
+          | Error _ -> acc
+          | Ok () ->
+              Hashtbl.replace t.tasks tid pid;
+              Result.map ignore
+                (Ptrace.call Ptrace.ptrace_seize tid Ctypes.null
+                   (Ptrace.word Ptrace.ptrace_o_traceclone)))
+        (Ok ()) tids
+
+let fault_address t tid =
+  let info = Ctypes.(to_voidp (bigarray_start array1 t.siginfo)) in
+  match Ptrace.call Ptrace.ptrace_getsiginfo tid Ctypes.null info with
+  | Ok _ -> Remote.Decode.get_int t.siginfo 16 (* si_addr *)
+  | Error _ -> 0
+
+let fill t (ev : Remote.Backend.exception_event) tid signal =
+  ev.task <- Option.value ~default:tid (Hashtbl.find_opt t.tasks tid);
+  ev.thread <- tid;
+  ev.reply <- signal;
+  ev.code <- 0;
+  ev.subcode <- 0;
+  if signal = sigsegv || signal = sigbus then (
+    ev.exception_type <- Remote.Exception_server.exc_bad_access;
+    ev.code <- signal;
+    ev.subcode <- fault_address t tid)
+  else if signal = sigill then
+    ev.exception_type <- Remote.Exception_server.exc_bad_instruction
+  else if signal = sigfpe then
+    ev.exception_type <- Remote.Exception_server.exc_arithmetic
+  else if signal = sigtrap then
+    ev.exception_type <- Remote.Exception_server.exc_breakpoint
+  else (
+    ev.exception_type <- Remote.Exception_server.exc_software;
+    ev.code <- Remote.Exception_server.exc_soft_signal;
+    ev.subcode <- signal)
+
+(* Block, or poll until [deadline] backing off from 10us to 1ms between
+   polls; waitpid itself has no timeout. Having nothing left to wait for is
+   the same as a timeout. *)
+let rec wait ~forever deadline pause =
+  match Ptrace.wait_any ~nohang:(not forever) () with
+  | Ok None when Unix.gettimeofday () < deadline ->
+      Unix.sleepf pause;
+      wait ~forever deadline (Float.min 1e-3 (pause *. 2.))
+  | Error (Remote.Backend.Unix_error Unix.ECHILD) -> Ok None
+  | r -> r
+
+let next t ~timeout ev =
+  let forever = timeout < 0. and deadline = Unix.gettimeofday () +. timeout in
+  let rec loop () =
+    match wait ~forever deadline 1e-5 with
+    | Error e -> Error e
+    | Ok None -> Ok false
+    | Ok (Some (tid, status)) -> (
+        match Ptrace.status_of_int status with
+        | Ptrace.Exited _ | Ptrace.Signaled _ ->
+            Hashtbl.remove t.tasks tid;
+            loop ()
+        | Ptrace.Stopped _ when Ptrace.event status <> 0 ->
+            (* Clone and interrupt stops are ours, not the target's. A new
+               thread belongs to the process of the thread that cloned it. *)
+            if Ptrace.event status = 3 (* PTRACE_EVENT_CLONE *) then (
+              let msg = Ctypes.allocate Ctypes.ulong Unsigned.ULong.zero in
+              (match
+                 Ptrace.call Ptrace.ptrace_geteventmsg tid Ctypes.null
+                   (Ctypes.to_voidp msg)
+               with
+              | Ok _ ->
+                  Hashtbl.replace t.tasks
+                    (Unsigned.ULong.to_int (Ctypes.( !@ ) msg))
+                    (Option.value ~default:tid (Hashtbl.find_opt t.tasks tid))
+              | Error _ -> ()));
+            ignore (Ptrace.cont tid);
+            loop ()
+        | Ptrace.Stopped signal ->
+            fill t ev tid signal;
+            Ok true)
+  in
+  loop ()
+
+let reply t (ev : Remote.Backend.exception_event) action =
+  let signal =
+    match action with
+    | Remote.Backend.Resume -> 0
+    | Remote.Backend.Forward -> ev.reply
+  in
+  t.replies <- (ev.thread, signal) :: t.replies
+
+let flush t =
+  List.iter
+    (fun (tid, signal) -> ignore (Ptrace.cont ~signal tid))
+    (List.rev t.replies);
+  t.replies <- []
+
+(** Stop catching exceptions of [pid]'s threads, which must not have
+    unanswered exceptions. *)
+let remove t pid =
+  Hashtbl.filter_map_inplace
+    (fun tid p ->
+      if p = pid then (
+        (match Threads.interrupt tid with
+        | Ok () -> (
+            match Threads.stopped tid with
+            | Ok signal -> ignore (Ptrace.detach ~signal tid)
+            | Error _ -> ())
+        | Error _ -> ());
+        None)
+      else Some p)
+    t.tasks
@@ -0,0 +1,165 @@
+open Ctypes
+
+(** Types from `sys/uio.h` *)
+
+type iovec = Mach_linux_bindings.iovec
+
+let iovec = Mach_linux_bindings.iovec
+let iov_base = Mach_linux_bindings.iov_base
+let iov_len = Mach_linux_bindings.iov_len
+let process_vm_readv = Syscalls.process_vm_readv
+let process_vm_writev = Syscalls.process_vm_writev
+let getpagesize = Syscalls.getpagesize
+
+(** Remote memory of a Linux process as a {!Remote.Backend.READER}.
+
+    This is the stand-in for [mach_vm_read] used to exercise the portable tools
+    in Linux CI. The caller needs ptrace access to [pid], which a parent always
+    has over its own children. *)
+
+(** Most iovecs accepted by one call, [IOV_MAX] from `limits.h`. *)
+let iov_max = 1024
+
+type t = {
+  pid : PosixTypes.pid_t;
+  page_size : int;
+  local : iovec structure;
+  remotes : iovec structure CArray.t;
+}
+
+let create pid =
+  {
+    pid = PosixTypes.Pid.of_int pid;
+    page_size = getpagesize ();
+    local = make iovec;
+    remotes = CArray.make iovec iov_max;
+  }
+
+let page_size t = t.page_size
+let pointer_of_address address = ptr_of_raw_address (Nativeint.of_int address)
+
+let set_iovec iov base len =
+  setf iov iov_base base;
+  setf iov iov_len (Unsigned.Size_t.of_int len)
+
+let readv t count =
+  match
+    process_vm_readv t.pid (addr t.local) Unsigned.ULong.one
+      (CArray.start t.remotes) (Unsigned.ULong.of_int count) Unsigned.ULong.zero
+  with
+  | n -> Ok (PosixTypes.Ssize.to_int n)
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+let read t address buf off len =
+  if off < 0 || len < 0 || off > Bigarray.Array1.dim buf - len then
+    invalid_arg "Process_vm.read";
+  set_iovec t.local (to_voidp (bigarray_start array1 buf +@ off)) len;
+  set_iovec (CArray.get t.remotes 0) (pointer_of_address address) len;
+  match readv t 1 with
+  | Ok n when n = len -> Ok ()
+  | Ok n -> Error (Remote.Backend.Short_transfer n)
+  | Error e -> Error e
+
+(** [write t address buf off len] writes with [process_vm_writev], which
+    honours page protections like any user space store, so read-only pages
+    such as code fail with [EFAULT]; {!Ptrace_memory} falls back to ptrace for
+    those. *)
+let write t address buf off len =
+  if off < 0 || len < 0 || off > Bigarray.Array1.dim buf - len then
+    invalid_arg "Process_vm.write";
+  set_iovec t.local (to_voidp (bigarray_start array1 buf +@ off)) len;
+  set_iovec (CArray.get t.remotes 0) (pointer_of_address address) len;
+  match
+    process_vm_writev t.pid (addr t.local) Unsigned.ULong.one
+      (CArray.start t.remotes) Unsigned.ULong.one Unsigned.ULong.zero
+  with
+  | n when PosixTypes.Ssize.to_int n = len -> Ok ()
+  | n -> Error (Remote.Backend.Short_transfer (PosixTypes.Ssize.to_int n))
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+(* Move every span of [spans] with [call], which is process_vm_readv or
+   process_vm_writev taking the number of remote iovecs. The local side is
+   contiguous so one iovec covers every span. Both calls stop at the first
+   remote span they cannot transfer completely, so mark that one failed and
+   carry on from the next. *)
+let transfer_spans t call name spans buf =
+  let n = Array.length spans in
+  let results = Array.make n (Ok ()) in
+  let offsets = Array.make (n + 1) 0 in
+  Array.iteri (fun i (_, len) -> offsets.(i + 1) <- offsets.(i) + len) spans;
+  if offsets.(n) > Bigarray.Array1.dim buf then invalid_arg name;
+  let base = bigarray_start array1 buf in
+  let rec from first =
+    if first < n then (
+      let count = min iov_max (n - first) in
+      let last = first + count in
+      set_iovec t.local
+        (to_voidp (base +@ offsets.(first)))
+        (offsets.(last) - offsets.(first));
+      for i = 0 to count - 1 do
+        let address, len = spans.(first + i) in
+        set_iovec (CArray.get t.remotes i) (pointer_of_address address) len
+      done;
+      match call t count with
+      | Error e ->
+          results.(first) <- Error e;
+          from (first + 1)
+      | Ok transferred ->
+          let rec settle i =
+            if i < last && offsets.(i + 1) - offsets.(first) <= transferred then
+              settle (i + 1)
+            else i
+          in
+          let i = settle first in
+          if i < last then (
+            results.(i) <-
+              Error
+                (Remote.Backend.Short_transfer
+                   (transferred - (offsets.(i) - offsets.(first))));
+            from (i + 1))
+          else from last)
+  in
+  from 0;
+  results
+
+let read_spans t spans buf =
+  transfer_spans t readv "Process_vm.read_spans" spans buf
+
+let writev t count =
+  match
+    process_vm_writev t.pid (addr t.local) Unsigned.ULong.one
+      (CArray.start t.remotes) (Unsigned.ULong.of_int count) Unsigned.ULong.zero
+  with
+  | n -> Ok (PosixTypes.Ssize.to_int n)
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+(** [write_spans t spans buf] writes up to {!iov_max} spans per
+    [process_vm_writev]. Like {!write}, it fails with [EFAULT] on read-only
+    pages. *)
+let write_spans t spans buf =
+  transfer_spans t writev "Process_vm.write_spans" spans buf
+
+(** [view t address len] reads [len] bytes at [address] into a fresh off-heap
+    buffer. Linux cannot map another process's memory, and [/proc/<pid>/mem]
+    does not support mmap, so this costs the one kernel copy but still never
+    touches the OCaml heap. *)
+let view t address len =
+  let data = Remote.Backend.create_buffer len in
+  match read t address data 0 len with
+  | Ok () -> Ok (Remote.View.make ~address data)
+  | Error e -> Error e
+
+(** The process's memory map, streamed from [/proc/<pid>/maps]. Linux has no
+    submaps and no range query, so [depth] is ignored and every query parses
+    the whole file. *)
+let maps_path t = Remote.Maps.path_of_pid (PosixTypes.Pid.to_int t.pid)
+
+let fold_named_regions t ~start ~stop ~depth f acc =
+  Remote.Maps.Recorded.fold_named_regions (maps_path t) ~start ~stop ~depth f
+    acc
+
+let fold_regions t ~start ~stop ~depth f acc =
+  Remote.Maps.Recorded.fold_regions (maps_path t) ~start ~stop ~depth f acc
+
+let regions t ~start ~stop ~depth =
+  Remote.Maps.Recorded.regions (maps_path t) ~start ~stop ~depth
@@ -0,0 +1,99 @@
+(** The process table from [/proc], as a {!Remote.Backend.PROCESSES}.
+
+    Each process costs a [stat] of its directory for the owner and a read of
+    [/proc/<pid>/stat] for the rest, into one reusable buffer. Linux states
+    are mapped onto the macOS [p_stat] values. *)
+
+type t = { stat : Bytes.t }
+
+let create () = { stat = Bytes.create 1024 }
+
+let set_u32 (buf : Remote.Backend.buffer) off v =
+  for i = 0 to 3 do
+    Bigarray.Array1.unsafe_set buf (off + i)
+      (Char.unsafe_chr ((v lsr (8 * i)) land 0xff))
+  done
+
+let pids () =
+  let pids =
+    Sys.readdir "/proc" |> Array.to_list
+    |> List.filter_map int_of_string_opt
+    |> Array.of_list
+  in
+  Array.sort Int.compare pids;
+  pids
+
+let status_of_state = function
+  | 'R' -> Remote.Proc_info.srun
+  | 'T' | 't' -> Remote.Proc_info.sstop
+  | 'Z' | 'X' -> Remote.Proc_info.szomb
+  | _ -> Remote.Proc_info.ssleep
+
+(* Read /proc/<pid>/stat into [t.stat], returning its length. *)
+let read_stat t pid =
+  match Unix.openfile (Printf.sprintf "/proc/%d/stat" pid) [ O_RDONLY ] 0 with
+  | exception Unix.Unix_error _ -> 0
+  | fd ->
+      Fun.protect
+        ~finally:(fun () -> Unix.close fd)
+        (fun () ->
+          try Unix.read fd t.stat 0 (Bytes.length t.stat)
+          with Unix.Unix_error _ -> 0)
+
+(* Fields after the command, which is in parentheses and may itself contain
+   spaces and parentheses: "pid (comm) state ppid pgrp ...". *)
+let fields t len =
+  match Bytes.rindex_from_opt t.stat (len - 1) ')' with
+  | None -> None
+  | Some close -> (
+      let rest = Bytes.sub_string t.stat (close + 2) (len - close - 2) in
+      match String.split_on_char ' ' rest with
+      | state :: ppid :: pgrp :: _ when state <> "" ->
+          let open_ = Bytes.index t.stat '(' in
+          Some
+            ( state.[0],
+              int_of_string ppid,
+              int_of_string pgrp,
+              Bytes.sub_string t.stat (open_ + 1) (close - open_ - 1) )
+      | _ -> None)
+
+(** [record t buf off pid] writes the [proc_bsdshortinfo] of [pid] at [off]
+    in [buf], or returns [false] if it has exited or cannot be read. *)
+let record t (buf : Remote.Backend.buffer) off pid =
+  match (Unix.stat (Printf.sprintf "/proc/%d" pid), read_stat t pid) with
+  | exception Unix.Unix_error _ -> false
+  | _, 0 -> false
+  | st, len -> (
+      match fields t len with
+      | None -> false
+      | Some (state, ppid, pgid, comm) ->
+          let size = Remote.Proc_info.size in
+          Bigarray.Array1.fill (Bigarray.Array1.sub buf off size) '\000';
+          set_u32 buf off pid;
+          set_u32 buf (off + 4) ppid;
+          set_u32 buf (off + 8) pgid;
+          set_u32 buf (off + 12) (status_of_state state);
+          String.iteri
+            (fun i c ->
+              if i < Remote.Proc_info.maxcomlen then
+                Bigarray.Array1.set buf (off + 16 + i) c)
+            comm;
+          (* /proc only gives the owner: use it for every id. *)
+          for i = 0 to 2 do
+            set_u32 buf (off + 36 + (8 * i)) st.st_uid;
+            set_u32 buf (off + 40 + (8 * i)) st.st_gid
+          done;
+          true)
+
+let snapshot t (buf : Remote.Backend.buffer) =
+  let size = Remote.Proc_info.size in
+  let capacity = Bigarray.Array1.dim buf / size in
+  let n = ref 0 in
+  Array.iter
+    (fun pid ->
+      (* A process that exits while being read is left out. Past the end of
+         [buf] processes are only counted. *)
+      if !n >= capacity then incr n
+      else if record t buf (!n * size) pid then incr n)
+    (pids ());
+  Ok !n
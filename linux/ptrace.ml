@@ -0,0 +1,166 @@
+open Ctypes
+
+(** Types and functions from `sys/ptrace.h` and `sys/wait.h` *)
+
+let ptrace = Syscalls.ptrace
+let ptrace_peekdata = 2
+let ptrace_peekuser = 3
+let ptrace_pokedata = 5
+let ptrace_pokeuser = 6
+let ptrace_cont = 7
+let ptrace_singlestep = 9
+let ptrace_attach = 16
+let ptrace_detach = 17
+let ptrace_setoptions = 0x4200
+let ptrace_geteventmsg = 0x4201
+let ptrace_getsiginfo = 0x4202
+let ptrace_setsiginfo = 0x4203
+let ptrace_getregset = 0x4204
+let ptrace_setregset = 0x4205
+let ptrace_seize = 0x4206
+let ptrace_interrupt = 0x4207
+
+(** Options for [PTRACE_SETOPTIONS] and [PTRACE_SEIZE] *)
+
+let ptrace_o_traceclone = 0x8
+
+(** The [PTRACE_EVENT_*] of a [PTRACE_INTERRUPT] stop or a group-stop *)
+
+let ptrace_event_stop = 128
+
+(** Register set types from `elf.h` *)
+
+let nt_prstatus = 1
+let nt_fpregset = 2
+
+let waitpid = Syscalls.waitpid
+
+(** Wait for clone threads as well as processes. *)
+let wall = 0x40000000
+
+let wnohang = 1
+
+(** Thread-level tracing of a Linux process.
+
+    Every call goes to one thread id, as ptrace does. The tracer must be the
+    thread that attached. *)
+
+type status = Exited of int | Signaled of int | Stopped of int
+
+let status_of_int s =
+  if s land 0x7f = 0 then Exited ((s lsr 8) land 0xff)
+  else if s land 0xff = 0x7f then Stopped ((s lsr 8) land 0xff)
+  else Signaled (s land 0x7f)
+
+let pid = PosixTypes.Pid.of_int
+let word n = ptr_of_raw_address (Nativeint.of_int n)
+
+let call request tid addr data =
+  match ptrace request (pid tid) addr data with
+  | r -> Ok (Signed.Long.to_int r)
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+(** [wait ?nohang tid] reaps the next state change of [tid], or [None] with
+    [~nohang:true] when there is none yet. *)
+let wait ?(nohang = false) tid =
+  let status = allocate int 0 in
+  match waitpid (pid tid) status (wall lor if nohang then wnohang else 0) with
+  | r when PosixTypes.Pid.to_int r = 0 -> Ok None
+  | _ -> Ok (Some (status_of_int !@status))
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+(** [wait_raw ?nohang tid] is {!wait} with the raw status, for the ptrace
+    event in its high bits, see {!event}. *)
+let wait_raw ?(nohang = false) tid =
+  let status = allocate int 0 in
+  match waitpid (pid tid) status (wall lor if nohang then wnohang else 0) with
+  | r when PosixTypes.Pid.to_int r = 0 -> Ok None
+  | _ -> Ok (Some !@status)
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+(** [wait_any ?nohang ()] reaps the next state change of any traced thread or
+    child as [(tid, raw status)], or [None] with [~nohang:true] when there is
+    none yet. The high bits of the raw status carry ptrace event stops,
+    see {!event}. *)
+let wait_any ?(nohang = false) () =
+  let status = allocate int 0 in
+  match waitpid (pid (-1)) status (wall lor if nohang then wnohang else 0) with
+  | r when PosixTypes.Pid.to_int r = 0 -> Ok None
+  | r -> Ok (Some (PosixTypes.Pid.to_int r, !@status))
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+(** The [PTRACE_EVENT_*] of a raw stop status, 0 for a plain signal stop. *)
+let event status = (status lsr 16) land 0xff
+
+(** Thread ids of process [pid], from [/proc/<pid>/task], main thread first,
+    or [ESRCH] once the process has gone. *)
+let threads pid =
+  match Sys.readdir (Printf.sprintf "/proc/%d/task" pid) with
+  | exception Sys_error _ -> Error (Remote.Backend.Unix_error Unix.ESRCH)
+  | entries ->
+      Ok
+        (Array.to_list entries
+        |> List.filter_map int_of_string_opt
+        |> List.sort (fun a b ->
+               if a = pid then -1 else if b = pid then 1 else Int.compare a b))
+
+(** Attach to [tid] and wait until it has stopped. Signals other than the
+    attach [SIGSTOP] that arrive meanwhile are lost. *)
+let attach tid =
+  match call ptrace_attach tid null null with
+  | Error e -> Error e
+  | Ok _ ->
+      let rec settle () =
+        match wait tid with
+        | Ok (Some (Stopped _)) -> Ok ()
+        | Ok (Some (Exited _ | Signaled _)) ->
+            Error (Remote.Backend.Unix_error Unix.ESRCH)
+        | Ok None -> settle ()
+        | Error e -> Error e
+      in
+      settle ()
+
+let detach ?(signal = 0) tid =
+  Result.map ignore (call ptrace_detach tid null (word signal))
+
+(** [cont ?signal tid] resumes a stopped thread, delivering [signal]. *)
+let cont ?(signal = 0) tid =
+  Result.map ignore (call ptrace_cont tid null (word signal))
+
+let step ?(signal = 0) tid =
+  Result.map ignore (call ptrace_singlestep tid null (word signal))
+
+(** [get_regset tid set buf] fetches register set [set] of the stopped [tid]
+    into [buf] and returns its size in bytes. *)
+let get_regset tid set (buf : Remote.Backend.buffer) =
+  let iov = make Process_vm.iovec in
+  Process_vm.set_iovec iov
+    (to_voidp (bigarray_start array1 buf))
+    (Bigarray.Array1.dim buf);
+  match call ptrace_getregset tid (word set) (to_voidp (addr iov)) with
+  | Ok _ -> Ok (Unsigned.Size_t.to_int (getf iov Process_vm.iov_len))
+  | Error e -> Error e
+
+(** [set_regset tid set buf len] writes the first [len] bytes of [buf] back as
+    register set [set]. *)
+let set_regset tid set (buf : Remote.Backend.buffer) len =
+  let iov = make Process_vm.iovec in
+  Process_vm.set_iovec iov (to_voidp (bigarray_start array1 buf)) len;
+  Result.map ignore (call ptrace_setregset tid (word set) (to_voidp (addr iov)))
+
+(** Size of [user_regs_struct] tells the architecture apart. *)
+let machine_of_regs_size = function
+  | 216 -> Some Remote.Core_file.X86_64
+  | 272 -> Some Remote.Core_file.Arm64
+  | _ -> None
+
+(** The general purpose registers of a stopped thread as a
+    {!Remote.Core_file.thread}. *)
+let thread_state tid =
+  let buf = Remote.Backend.create_buffer 512 in
+  match get_regset tid nt_prstatus buf with
+  | Error e -> Error e
+  | Ok n ->
+      let state = Bytes.create n in
+      Remote.Backend.blit_to_bytes buf 0 state 0 n;
+      Ok { Remote.Core_file.tid; flavor = 0; state = Bytes.to_string state }
@@ -0,0 +1,86 @@
+(** Memory of a traced Linux process as a {!Remote.Backend.WRITER} that can
+    patch code.
+
+    Writes go through [process_vm_writev] in one call when the pages are
+    writable. Pages that are not, such as the text that breakpoints go into,
+    are written a word at a time with [PTRACE_POKEDATA], which ignores page
+    protections the way a debugger needs. That fallback requires the thread
+    [pid] to be in a ptrace stop. *)
+
+type t = { memory : Process_vm.t; pid : int }
+
+let create pid = { memory = Process_vm.create pid; pid }
+let page_size t = Process_vm.page_size t.memory
+let read t = Process_vm.read t.memory
+
+(* Words are handled as Int64: an OCaml int would lose the top bit. *)
+let peek t address =
+  match
+    Ptrace.ptrace Ptrace.ptrace_peekdata (Ptrace.pid t.pid)
+      (Ptrace.word address) Ctypes.null
+  with
+  | w -> Ok (Signed.Long.to_int64 w)
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+
+let poke t address word =
+  Result.map ignore
+    (Ptrace.call Ptrace.ptrace_pokedata t.pid (Ptrace.word address)
+       (Ctypes.ptr_of_raw_address (Int64.to_nativeint word)))
+
+(* Store [len] bytes one word at a time. A partial last word is merged with
+   the bytes already in the target. *)
+let poke_range t address buf off len =
+  let rec loop i =
+    if i >= len then Ok ()
+    else
+      let word =
+        if len - i >= 8 then Ok (Remote.Decode.get_int64 buf (off + i))
+        else
+          Result.map
+            (fun old ->
+              let fresh = ref old in
+              for b = 0 to len - i - 1 do
+                let shift = 8 * b in
+                fresh :=
+                  Int64.logor
+                    (Int64.logand !fresh
+                       (Int64.lognot (Int64.shift_left 0xffL shift)))
+                    (Int64.shift_left
+                       (Int64.of_int
+                          (Remote.Decode.get_uint8 buf (off + i + b)))
+                       shift)
+              done;
+              !fresh)
+            (peek t (address + i))
+      in
+      match word with
+      | Error e -> Error e
+      | Ok w -> (
+          match poke t (address + i) w with
+          | Ok () -> loop (i + 8)
+          | Error e -> Error e)
+  in
+  loop 0
+
+(* Finish a write that [process_vm_writev] could not: read-only pages fail
+   it with EFAULT when they come first and cut it short when they come
+   later, so poke what was left. *)
+let finish t address buf off len = function
+  | Error (Remote.Backend.Unix_error Unix.EFAULT) ->
+      poke_range t address buf off len
+  | Error (Remote.Backend.Short_transfer n) ->
+      poke_range t (address + n) buf (off + n) (len - n)
+  | r -> r
+
+let write t address buf off len =
+  finish t address buf off len (Process_vm.write t.memory address buf off len)
+
+let write_spans t spans buf =
+  let results = Process_vm.write_spans t.memory spans buf in
+  let off = ref 0 in
+  Array.mapi
+    (fun i (address, len) ->
+      let r = finish t address buf !off len results.(i) in
+      off := !off + len;
+      r)
+    spans
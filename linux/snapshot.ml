@@ -0,0 +1,52 @@
+(** {!Remote.Task_snapshot} files of a live Linux process.
+
+    As for {!Core}, every thread is stopped with ptrace while the snapshot is
+    written and resumed afterwards. *)
+
+module Writer = Remote.Task_snapshot.Make (Process_vm)
+
+(** [capture ?chunk_size ?depth pid path] saves [pid] to [path]. The caller
+    must be allowed to ptrace [pid]. *)
+let capture ?chunk_size ?depth pid path =
+  match Core.stop_all pid with
+  | Error e -> Error e
+  | Ok stopped ->
+      Fun.protect
+        ~finally:(fun () ->
+          List.iter (fun t -> ignore (Ptrace.detach t)) stopped)
+        (fun () ->
+          let threads =
+            List.rev stopped
+            |> List.filter_map (fun tid ->
+                   Result.to_option (Ptrace.thread_state tid))
+          in
+          match threads with
+          | [] -> Error (Remote.Backend.Unix_error Unix.ESRCH)
+          | first :: _ -> (
+              match
+                Ptrace.machine_of_regs_size
+                  (String.length first.Remote.Core_file.state)
+              with
+              | None -> Error (Remote.Backend.Unix_error Unix.ENOSYS)
+              | Some machine ->
+                  let backend = Process_vm.create pid in
+                  let regions =
+                    Process_vm.fold_named_regions backend ~start:0
+                      ~stop:max_int ~depth:0
+                      (fun acc r name -> (r, name) :: acc)
+                      []
+                    |> List.rev
+                  in
+                  let size = Remote.Proc_info.size in
+                  let record = Remote.Backend.create_buffer size in
+                  let processes = Processes.create () in
+                  let proc_info =
+                    if Processes.record processes record 0 pid then (
+                      let b = Bytes.create size in
+                      Remote.Backend.blit_to_bytes record 0 b 0 size;
+                      Some (Bytes.to_string b))
+                    else None
+                  in
+                  Ok
+                    (Writer.write ?chunk_size ?depth backend ~machine ~threads
+                       ?proc_info regions path)))
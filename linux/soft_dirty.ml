@@ -0,0 +1,93 @@
+(** Page change hints from the kernel's soft-dirty bits, as a
+    {!Remote.Backend.DIRTY}.
+
+    Writing [4] to [/proc/<pid>/clear_refs] clears the soft-dirty bit of every
+    page of the process; the kernel sets it again on the next write to the
+    page. Bit 55 of each 64-bit entry of [/proc/<pid>/pagemap] exposes it. If
+    the kernel was built without [CONFIG_MEM_SOFT_DIRTY] or the files cannot be
+    opened, every page is reported dirty and callers fall back to hashing. *)
+
+type t = {
+  pid : int;
+  page_size : int;
+  mutable available : bool;
+  mutable pagemap : Unix.file_descr option;
+  mutable entries : Bytes.t;
+}
+
+let create ?(page_size = 4096) pid =
+  { pid; page_size; available = true; pagemap = None; entries = Bytes.create 0 }
+
+let soft_dirty = Int64.shift_left 1L 55
+let present_or_swapped = Int64.shift_left 3L 62
+
+let clear t =
+  if t.available then
+    try
+      let fd =
+        Unix.openfile
+          (Printf.sprintf "/proc/%d/clear_refs" t.pid)
+          [ Unix.O_WRONLY ] 0
+      in
+      Fun.protect
+        ~finally:(fun () -> Unix.close fd)
+        (fun () -> ignore (Unix.write_substring fd "4" 0 1))
+    with Unix.Unix_error _ -> t.available <- false
+
+let pagemap t =
+  match t.pagemap with
+  | Some fd -> fd
+  | None ->
+      let path = Printf.sprintf "/proc/%d/pagemap" t.pid in
+      let fd = Unix.openfile path [ Unix.O_RDONLY ] 0 in
+      t.pagemap <- Some fd;
+      fd
+
+let rec really_read fd buf off len =
+  if len > 0 then
+    let n = Unix.read fd buf off len in
+    if n = 0 then raise End_of_file else really_read fd buf (off + n) (len - n)
+
+(* Private anonymous regions that were never writable cannot have changed
+   in place. Shared mappings can be written through another mapping, and
+   private file mappings show writes to the file until a page is copied. *)
+let region_unchanged _ ~(before : Remote.Region.t) ~(after : Remote.Region.t) =
+  before.start = after.start
+  && before.size = after.size
+  && before.offset = after.offset
+  && before.object_id = after.object_id
+  && before.protection = after.protection
+  && before.share_mode = Remote.Region.sm_private
+  && after.share_mode = Remote.Region.sm_private
+  && before.max_protection land Remote.Region.prot_write = 0
+
+let dirty_pages t (r : Remote.Region.t) flags =
+  t.available
+  &&
+  let pages = r.size / t.page_size in
+  if Bytes.length t.entries < pages * 8 then
+    t.entries <- Bytes.create (pages * 8);
+  match
+    let fd = pagemap t in
+    ignore (Unix.lseek fd (r.start / t.page_size * 8) Unix.SEEK_SET);
+    really_read fd t.entries 0 (pages * 8)
+  with
+  | () ->
+      for i = 0 to pages - 1 do
+        let e = Bytes.get_int64_ne t.entries (i * 8) in
+        (* A page that is neither present nor swapped has never been touched
+           since it was mapped, or was dropped; read it to find out. *)
+        let dirty =
+          Int64.logand e soft_dirty <> 0L
+          || Int64.logand e present_or_swapped = 0L
+        in
+        Bytes.set flags i (if dirty then '\001' else '\000')
+      done;
+      true
+  | exception (Unix.Unix_error _ | End_of_file) ->
+      t.available <- false;
+      false
+
+let close t =
+  Option.iter Unix.close t.pagemap;
+  t.pagemap <- None
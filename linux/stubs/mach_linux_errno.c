@@ -0,0 +1,16 @@
+/* errno to Unix.error through the runtime's own table, so every errno the
+   unix library knows maps to its constructor and the rest to
+   EUNKNOWNERR, exactly as Unix raises them. */
+
+#include <caml/mlvalues.h>
+#include <caml/version.h>
+#include <caml/unixsupport.h>
+
+value mach_linux_unix_error_of_code(value code)
+{
+#if OCAML_VERSION_MAJOR >= 5
+  return caml_unix_error_of_code(Int_val(code));
+#else
+  return unix_error_of_code(Int_val(code));
+#endif
+}
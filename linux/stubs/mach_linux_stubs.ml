@@ -0,0 +1,29 @@
+(** {!Mach_linux_bindings.Functions} bound through generated C stubs, with the
+    same types as the libffi instance.
+
+    The stubs return [errno] next to each result, which is raised as
+    [Unix.Unix_error] here as [~check_errno] does for libffi. *)
+
+module C = Mach_linux_bindings.Functions (Generated)
+
+(* The unix library's own errno table, so errors compare equal to the ones
+   Unix raises. *)
+external unix_error : int -> Unix.error = "mach_linux_unix_error_of_code"
+
+let check name (r, errno) =
+  let errno = Signed.SInt.to_int errno in
+  if errno = 0 then r else raise (Unix.Unix_error (unix_error errno, name, ""))
+
+let process_vm_readv pid local nlocal remote nremote flags =
+  check "process_vm_readv"
+    (C.process_vm_readv pid local nlocal remote nremote flags)
+
+let process_vm_writev pid local nlocal remote nremote flags =
+  check "process_vm_writev"
+    (C.process_vm_writev pid local nlocal remote nremote flags)
+
+let ptrace request pid addr data =
+  check "ptrace" (C.ptrace request pid addr data)
+
+let waitpid pid status options = check "waitpid" (C.waitpid pid status options)
+let getpagesize () = fst (C.getpagesize ())
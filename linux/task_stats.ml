@@ -0,0 +1,64 @@
+(** Resource usage of processes from [/proc/<pid>/stat], as a
+    {!Remote.Backend.TASKS}.
+
+    The stat line already sums the time of every thread, so one read per
+    process is enough. Each worker reads into its own buffer and parses the
+    fields in place, without splitting the line into strings. *)
+
+type t = { page_size : int; ticks : int }
+
+type worker = { source : t; stat : Bytes.t }
+
+(* USER_HZ, which /proc reports times in, is 100 on every architecture the
+   kernel supports today. *)
+let create () = { page_size = Process_vm.getpagesize (); ticks = 100 }
+let worker source = { source; stat = Bytes.create 1024 }
+
+let read w pid =
+  match Unix.openfile (Printf.sprintf "/proc/%d/stat" pid) [ O_RDONLY ] 0 with
+  | exception Unix.Unix_error (e, _, _) -> Error (Remote.Backend.Unix_error e)
+  | fd ->
+      Fun.protect
+        ~finally:(fun () -> Unix.close fd)
+        (fun () ->
+          match Unix.read fd w.stat 0 (Bytes.length w.stat) with
+          | exception Unix.Unix_error (e, _, _) ->
+              Error (Remote.Backend.Unix_error e)
+          | len -> Ok len)
+
+(* Decimal field [n] (1-based, as in proc(5)) of the stat line of length
+   [len]. Fields are counted from the state, the third, since the command
+   before it may contain spaces. *)
+let field w len close n =
+  let rec skip i k =
+    if k = 0 then i
+    else if i >= len then len
+    else skip (i + 1) (if Bytes.get w.stat i = ' ' then k - 1 else k)
+  in
+  let rec number i v =
+    if i >= len then v
+    else
+      match Bytes.get w.stat i with
+      | '0' .. '9' as c -> number (i + 1) ((v * 10) + Char.code c - 48)
+      | _ -> v
+  in
+  number (skip (close + 2) (n - 3)) 0
+
+let collect w pid ~deadline (stats : Remote.Backend.task_stats) =
+  if Unix.gettimeofday () > deadline then
+    Error (Remote.Backend.Unix_error Unix.ETIMEDOUT)
+  else
+    match read w pid with
+    | Error e -> Error e
+    | Ok len -> (
+        match Bytes.rindex_from_opt w.stat (len - 1) ')' with
+        | None -> Error (Remote.Backend.Short_transfer len)
+        | Some close ->
+            let f = field w len close in
+            let us ticks = ticks * 1_000_000 / w.source.ticks in
+            stats.user_time <- us (f 14);
+            stats.system_time <- us (f 15);
+            stats.threads <- f 20;
+            stats.virtual_size <- f 23;
+            stats.resident <- f 24 * w.source.page_size;
+            Ok ())
@@ -0,0 +1,103 @@
+(** Stopping a traced Linux process and moving its threads' register sets,
+    as a {!Remote.Backend.THREAD_STATES}.
+
+    Threads are seized once, as in {!Threads}, so a stop is one
+    [PTRACE_INTERRUPT] per thread rather than an attach. The general and
+    float sets are [NT_PRSTATUS] and [NT_FPREGSET]; the exception set is
+    the thread's pending [siginfo_t]. Signals that arrive while stopped are
+    delivered on resume. *)
+
+type t = {
+  pid : int;
+  mutable seized : int list;
+  mutable stopped : (int * int) list;  (** Thread and its pending signal. *)
+}
+
+let create pid = { pid; seized = []; stopped = [] }
+
+(* Large enough for user_regs_struct and user_fpregs_struct on x86_64 and
+   arm64. *)
+let state_size _ = function
+  | Remote.Backend.General -> 512
+  | Remote.Backend.Float -> 1024
+  | Remote.Backend.Exception -> 128
+
+let stop t =
+  if t.stopped <> [] then invalid_arg "Thread_states.stop: already stopped";
+  match Ptrace.threads t.pid with
+  | Error e -> Error e
+  | Ok current -> (
+      List.iter
+        (fun tid ->
+          if not (List.mem tid t.seized) then ignore (Threads.seize tid))
+        current;
+      t.seized <- current;
+      (* Interrupt them all before waiting for any, so they stop together. *)
+      let interrupted =
+        List.filter (fun tid -> Result.is_ok (Threads.interrupt tid)) current
+      in
+      t.stopped <-
+        List.filter_map
+          (fun tid ->
+            match Threads.stopped tid with
+            | Ok signal -> Some (tid, signal)
+            | Error _ -> None)
+          interrupted;
+      match t.stopped with
+      | [] -> Error (Remote.Backend.Unix_error Unix.ESRCH)
+      | stopped -> Ok (Array.of_list (List.map fst stopped)))
+
+let resume t =
+  let error =
+    List.fold_left
+      (fun error (tid, signal) ->
+        match Ptrace.cont ~signal tid with
+        | Ok () -> error
+        | Error e -> if error = None then Some e else error)
+      None t.stopped
+  in
+  t.stopped <- [];
+  match error with Some e -> Error e | None -> Ok ()
+
+let regset = function
+  | Remote.Backend.General -> Ptrace.nt_prstatus
+  | _ -> Ptrace.nt_fpregset
+
+let siginfo request tid buf off =
+  Ptrace.call request tid Ctypes.null
+    Ctypes.(to_voidp (bigarray_start array1 buf +@ off))
+
+let get_state t tid set buf off =
+  match set with
+  | Remote.Backend.Exception ->
+      Result.map
+        (fun _ -> state_size t set)
+        (siginfo Ptrace.ptrace_getsiginfo tid buf off)
+  | _ ->
+      Ptrace.get_regset tid (regset set)
+        (Bigarray.Array1.sub buf off (state_size t set))
+
+let set_state _ tid set buf off len =
+  match set with
+  | Remote.Backend.Exception ->
+      Result.map ignore (siginfo Ptrace.ptrace_setsiginfo tid buf off)
+  | _ ->
+      Ptrace.set_regset tid (regset set) (Bigarray.Array1.sub buf off len) len
+
+(** Stop tracing. The threads keep running. *)
+let close t =
+  List.iter
+    (fun (tid, signal) -> ignore (Ptrace.detach ~signal tid))
+    t.stopped;
+  List.iter
+    (fun tid ->
+      if
+        (not (List.mem_assoc tid t.stopped))
+        && Result.is_ok (Threads.interrupt tid)
+      then
+        match Threads.stopped tid with
+        | Ok signal -> ignore (Ptrace.detach ~signal tid)
+        | Error _ -> ())
+    t.seized;
+  t.stopped <- [];
+  t.seized <- []
@@ -0,0 +1,104 @@
+(** Register samples of every thread of a Linux process, as a
+    {!Remote.Backend.THREADS}.
+
+    Threads are seized once with [PTRACE_SEIZE], which does not stop them, and
+    each sample interrupts them all with [PTRACE_INTERRUPT], reads their
+    registers with [PTRACE_GETREGSET] into one preallocated buffer and resumes
+    them. Threads that appear between samples are seized on the next one. *)
+
+type t = {
+  pid : int;
+  regs : Remote.Backend.buffer;
+  mutable seized : int list;
+  mutable offsets : (int * int * int) option;  (** pc, sp, fp in [regs]. *)
+}
+
+let seize tid =
+  Result.map ignore
+    (Ptrace.call Ptrace.ptrace_seize tid Ctypes.null Ctypes.null)
+
+let interrupt tid =
+  Result.map ignore
+    (Ptrace.call Ptrace.ptrace_interrupt tid Ctypes.null Ctypes.null)
+
+(* Offsets of the program counter, stack pointer and frame pointer in
+   user_regs_struct, told apart by its size. *)
+let offsets_of_size = function
+  | 216 -> Some (128, 152, 32) (* x86_64: rip, rsp, rbp *)
+  | 272 -> Some (256, 248, 232) (* arm64: pc, sp, x29 *)
+  | _ -> None
+
+let create pid =
+  { pid; regs = Remote.Backend.create_buffer 512; seized = []; offsets = None }
+
+(* Seize threads we have not seen and forget those that have exited. *)
+let refresh t =
+  Result.map
+    (fun current ->
+      List.iter
+        (fun tid -> if not (List.mem tid t.seized) then ignore (seize tid))
+        current;
+      t.seized <- current)
+    (Ptrace.threads t.pid)
+
+(* Wait for the first stop of [tid] after {!interrupt} and return the
+   signal to deliver when it is resumed. Our interrupt and group-stops are
+   [PTRACE_EVENT_STOP]s and carry nothing to deliver. A signal that stops
+   the thread first, a breakpoint's SIGTRAP among them, is passed on; the
+   interrupt then stays pending and stops the thread again once it runs,
+   until the next wait or a detach. *)
+let rec stopped tid =
+  match Ptrace.wait_raw tid with
+  | Ok (Some status) -> (
+      match Ptrace.status_of_int status with
+      | Ptrace.Stopped _ when Ptrace.event status = Ptrace.ptrace_event_stop ->
+          Ok 0
+      | Ptrace.Stopped signal -> Ok signal
+      | Ptrace.Exited _ | Ptrace.Signaled _ ->
+          Error (Remote.Backend.Unix_error Unix.ESRCH))
+  | Ok None -> stopped tid
+  | Error e -> Error e
+
+let sample t f =
+  match refresh t with
+  | Error e -> Error e
+  | Ok () ->
+      let interrupted =
+        List.filter (fun tid -> Result.is_ok (interrupt tid)) t.seized
+      in
+      let stops = List.map (fun tid -> (tid, stopped tid)) interrupted in
+      let count = ref 0 in
+      List.iter
+        (fun (tid, stop) ->
+          match stop with
+          | Error _ -> ()
+          | Ok signal ->
+              (match Ptrace.get_regset tid Ptrace.nt_prstatus t.regs with
+              | Ok size -> (
+                  if t.offsets = None then t.offsets <- offsets_of_size size;
+                  match t.offsets with
+                  | Some (pc, sp, fp) ->
+                      incr count;
+                      f tid
+                        (Remote.Decode.get_int t.regs pc)
+                        (Remote.Decode.get_int t.regs sp)
+                        (Remote.Decode.get_int t.regs fp)
+                  | None -> ())
+              | Error _ -> ());
+              ignore (Ptrace.cont ~signal tid))
+        stops;
+      if !count = 0 && t.seized <> [] then
+        Error (Remote.Backend.Unix_error Unix.ESRCH)
+      else Ok !count
+
+(** Stop tracing. The threads keep running. Detaching needs a stopped
+    thread, so each is interrupted first. *)
+let close t =
+  List.iter
+    (fun tid ->
+      if Result.is_ok (interrupt tid) then
+        match stopped tid with
+        | Ok signal -> ignore (Ptrace.detach ~signal tid)
+        | Error _ -> ())
+    t.seized;
+  t.seized <- []
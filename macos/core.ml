@@ -0,0 +1,58 @@
+open Ctypes
+
+(** Mach-O [MH_CORE] dumps of a live task.
+
+    The task is suspended while its threads and memory are collected and
+    resumed afterwards. *)
+
+module Writer = Remote.Core_file.Make (Task_memory)
+
+let thread_state machine port =
+  let flavor, words =
+    match machine with
+    | Remote.Core_file.X86_64 ->
+        (Mach.x86_thread_state64, Mach.x86_thread_state64_count)
+    | Remote.Core_file.Arm64 ->
+        (Mach.arm_thread_state64, Mach.arm_thread_state64_count)
+  in
+  let state = allocate_n Mach.thread_state_t ~count:words in
+  let count = allocate Mach.mach_msg_type_number_t (Int32.of_int words) in
+  let kr = Mach.thread_get_state port flavor state count in
+  if not (Int32.equal kr Mach.kern_success) then None
+  else
+    let len = Int32.to_int !@count * 4 in
+    Some
+      {
+        Remote.Core_file.tid = Unsigned.UInt64.to_int port;
+        flavor = Int32.to_int flavor;
+        state = string_from_ptr (from_voidp char (to_voidp state)) ~length:len;
+      }
+
+(** [dump ?chunk_size ?depth task path] writes a Mach-O core of [task] to
+    [path]. Submaps are descended into so each leaf mapping becomes one
+    segment. *)
+let dump ?chunk_size ?depth task path =
+  let kr = Mach.task_suspend task in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    Fun.protect
+      ~finally:(fun () -> ignore (Mach.task_resume task))
+      (fun () ->
+        match Threads.list task with
+        | Error e -> Error e
+        | Ok ports ->
+            let machine = Host.machine () in
+            let threads = List.filter_map (thread_state machine) ports in
+            Threads.release ports;
+            let regions =
+              Regions.fold (Regions.create task)
+                (fun acc r ->
+                  if r.Remote.Region.is_submap then acc else r :: acc)
+                []
+              |> List.rev
+            in
+            let backend = Task_memory.create task in
+            Ok
+              (Writer.write ?chunk_size ?depth backend
+                 ~format:Remote.Core_file.Macho ~machine ~threads regions path))
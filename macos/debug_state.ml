@@ -0,0 +1,116 @@
+open Ctypes
+
+(** Debug registers of a task's threads through [thread_get_state] and
+    [thread_set_state], as a {!Remote.Backend.DEBUG_REGISTERS}.
+
+    The flavor is [x86_DEBUG_STATE64] or [ARM_DEBUG_STATE64]; both are
+    fetched into one preallocated buffer. Thread ids are thread port names.
+    The send rights from the last {!threads} call are kept until the next
+    one, so the names stay valid while they are programmed. *)
+
+type t = {
+  task : Mach.task_t;
+  machine : Remote.Core_file.machine;
+  flavor : Mach.thread_state_flavor_t;
+  words : int;
+  state : Remote.Backend.buffer;
+  state_ptr : Mach.thread_state_t ptr;
+  count : Mach.mach_msg_type_number_t ptr;
+  mutable ports : Mach.thread_act_t list;
+}
+
+(* Apple's arm64 cores have four watchpoint register pairs. *)
+let arm_watchpoints = 4
+
+let create task =
+  let machine = Host.machine () in
+  let flavor, words =
+    match machine with
+    | Remote.Core_file.X86_64 ->
+        (Mach.x86_debug_state64, Mach.x86_debug_state64_count)
+    | Remote.Core_file.Arm64 ->
+        (Mach.arm_debug_state64, Mach.arm_debug_state64_count)
+  in
+  let state = Remote.Backend.create_buffer (words * 4) in
+  {
+    task;
+    machine;
+    flavor;
+    words;
+    state;
+    state_ptr =
+      bigarray_start array1 state |> to_voidp |> from_voidp Mach.thread_state_t;
+    count = allocate Mach.mach_msg_type_number_t 0l;
+    ports = [];
+  }
+
+let slots t =
+  match t.machine with
+  | Remote.Core_file.X86_64 -> 4
+  | Remote.Core_file.Arm64 -> arm_watchpoints
+
+let threads t =
+  Threads.release t.ports;
+  t.ports <- [];
+  match Threads.list t.task with
+  | Error e -> Error e
+  | Ok ports ->
+      t.ports <- ports;
+      Ok (List.map Unsigned.UInt64.to_int ports)
+
+let set_u64 buf off v =
+  for i = 0 to 7 do
+    Bigarray.Array1.set buf (off + i)
+      (Char.unsafe_chr ((v lsr (8 * i)) land 0xff))
+  done
+
+(* Offsets of the watchpoint value and control registers. *)
+let wvr i = 256 + (8 * i)
+let wcr i = 384 + (8 * i)
+
+let get t thread (state : Remote.Backend.debug_state) =
+  t.count <-@ Int32.of_int t.words;
+  let kr =
+    Mach.thread_get_state
+      (Unsigned.UInt64.of_int thread)
+      t.flavor t.state_ptr t.count
+  in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else (
+    (match t.machine with
+    | Remote.Core_file.X86_64 ->
+        for i = 0 to 3 do
+          state.values.(i) <- Remote.Decode.get_int t.state (8 * i)
+        done;
+        state.status <- Remote.Decode.get_int t.state 48;
+        state.controls.(0) <- Remote.Decode.get_int t.state 56
+    | Remote.Core_file.Arm64 ->
+        for i = 0 to arm_watchpoints - 1 do
+          state.values.(i) <- Remote.Decode.get_int t.state (wvr i);
+          state.controls.(i) <- Remote.Decode.get_int t.state (wcr i)
+        done);
+    Ok ())
+
+(* The buffer still holds this thread's state from [get], so only the
+   registers we own are replaced. *)
+let set t thread (state : Remote.Backend.debug_state) =
+  (match t.machine with
+  | Remote.Core_file.X86_64 ->
+      for i = 0 to 3 do
+        set_u64 t.state (8 * i) state.values.(i)
+      done;
+      set_u64 t.state 48 state.status;
+      set_u64 t.state 56 state.controls.(0)
+  | Remote.Core_file.Arm64 ->
+      for i = 0 to arm_watchpoints - 1 do
+        set_u64 t.state (wvr i) state.values.(i);
+        set_u64 t.state (wcr i) state.controls.(i)
+      done);
+  let kr =
+    Mach.thread_set_state
+      (Unsigned.UInt64.of_int thread)
+      t.flavor t.state_ptr (Int32.of_int t.words)
+  in
+  if Int32.equal kr Mach.kern_success then Ok ()
+  else Error (Remote.Backend.Kern_return kr)
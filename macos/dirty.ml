@@ -0,0 +1,29 @@
+(** Change hints from [vm_region_submap_info_64], as a
+    {!Remote.Backend.DIRTY}.
+
+    Mach reports dirtied page counts per region but nothing per page, so the
+    hint can only skip whole regions: those backed by the same VM object with
+    the same protection that have never had a page dirtied, or that are not
+    writable and private to the task ([SM_PRIVATE]: anonymous, or with every
+    page already copied). A shared or copy-on-write region can change through
+    another mapping of its object however it is protected here. Everything
+    else is hashed. *)
+
+type t = unit
+
+let create () = ()
+
+let region_unchanged () ~(before : Remote.Region.t) ~(after : Remote.Region.t)
+    =
+  before.start = after.start
+  && before.size = after.size
+  && before.object_id = after.object_id
+  && before.offset = after.offset
+  && before.protection = after.protection
+  && ((before.share_mode = Remote.Region.sm_private
+      && after.share_mode = Remote.Region.sm_private
+      && not (Remote.Region.writable before))
+     || (before.pages_dirtied = 0 && after.pages_dirtied = 0))
+
+let dirty_pages () _ _ = false
+let clear () = ()
@@ -0,0 +1,178 @@
+open Ctypes
+
+(** Exceptions of any number of tasks, received through one port set, as a
+    {!Remote.Backend.EVENTS}.
+
+    Each task gets its own exception port with the
+    [EXCEPTION_STATE_IDENTITY | MACH_EXCEPTION_CODES] behaviour, so the kernel
+    sends [mach_exception_raise_state_identity] requests. They are received
+    into one preallocated buffer and decoded in place. Replies echo the thread
+    state unchanged and are built in a preallocated array of slots, then sent
+    back to back by {!flush}. *)
+
+let mach_exception_raise_state_identity = 2407
+let request_size = 4096
+
+(* Reply: header, NDR record, RetCode, flavor, new_stateCnt, new_state. *)
+let reply_header_size = 44
+let reply_size = reply_header_size + (4 * 614) (* THREAD_STATE_MAX *)
+
+type t = {
+  set : Mach.mach_port_name_t;
+  name : Mach.mach_port_name_t ptr;
+  request : Remote.Backend.buffer;
+  request_ptr : unit ptr;
+  replies : Remote.Backend.buffer;
+  replies_ptr : char ptr;
+  capacity : int;
+  mutable pending : int;
+  flavor : Mach.thread_state_flavor_t;
+}
+
+let self () = Mach.mach_task_self ()
+let ok kr = Int32.equal kr Mach.kern_success
+
+(** [create ?batch ()] queues up to [batch] replies (default 64) before
+    sending them on its own. *)
+let create ?(batch = 64) () =
+  let name = allocate Mach.mach_port_name_t 0l in
+  let kr =
+    Mach.mach_port_allocate (self ()) Mach.mach_port_right_port_set name
+  in
+  if not (ok kr) then Error (Remote.Backend.Kern_return kr)
+  else
+    let request = Remote.Backend.create_buffer request_size in
+    let replies = Remote.Backend.create_buffer (batch * reply_size) in
+    Ok
+      {
+        set = !@name;
+        name;
+        request;
+        request_ptr = to_voidp (bigarray_start array1 request);
+        replies;
+        replies_ptr = bigarray_start array1 replies;
+        capacity = batch;
+        pending = 0;
+        flavor =
+          (match Host.machine () with
+          | Remote.Core_file.X86_64 -> Mach.x86_thread_state64
+          | Remote.Core_file.Arm64 -> Mach.arm_thread_state64);
+      }
+
+let default_mask =
+  List.fold_left Int32.logor 0l
+    Mach.
+      [
+        exc_mask_bad_access;
+        exc_mask_bad_instruction;
+        exc_mask_arithmetic;
+        exc_mask_emulation;
+        exc_mask_software;
+        exc_mask_breakpoint;
+      ]
+
+(** [add ?mask t task] routes the exceptions of [task] selected by [mask] to
+    this server, replacing the task's exception ports for them. *)
+let add ?(mask = default_mask) t task =
+  let ( >>= ) kr f =
+    if ok kr then f () else Error (Remote.Backend.Kern_return kr)
+  in
+  Mach.mach_port_allocate (self ()) Mach.mach_port_right_receive t.name
+  >>= fun () ->
+  let port = !@(t.name) in
+  let right = Unsigned.UInt64.of_int (Int32.to_int port) in
+  Mach.mach_port_insert_right (self ()) port right Mach.mach_msg_type_make_send
+  >>= fun () ->
+  Mach.mach_port_move_member (self ()) port t.set >>= fun () ->
+  let behavior =
+    Unsigned.UInt32.logor
+      (Unsigned.UInt32.of_int32 Mach.exception_state_identity)
+      (Unsigned.UInt32.of_int32 Mach.mach_exception_codes)
+  in
+  Mach.task_set_exception_ports task mask right behavior t.flavor >>= fun () ->
+  Ok ()
+
+let u32 t off = Remote.Decode.get_uint32 t.request off
+
+let set_u32 buf off v =
+  Bigarray.Array1.set buf off (Char.unsafe_chr (v land 0xff));
+  Bigarray.Array1.set buf (off + 1) (Char.unsafe_chr ((v lsr 8) land 0xff));
+  Bigarray.Array1.set buf (off + 2) (Char.unsafe_chr ((v lsr 16) land 0xff));
+  Bigarray.Array1.set buf (off + 3) (Char.unsafe_chr ((v lsr 24) land 0xff))
+
+(* The code array is variable length, so the fields after it move with
+   codeCnt. *)
+let state_offset t = 68 + (8 * u32 t 64)
+
+let next t ~timeout (ev : Remote.Backend.exception_event) =
+  let options, ms =
+    if timeout < 0. then (Mach.mach_rcv_msg, 0l)
+    else
+      ( Int32.logor Mach.mach_rcv_msg Mach.mach_rcv_timeout,
+        Int32.of_float (timeout *. 1000.) )
+  in
+  let kr =
+    Mach.mach_msg t.request_ptr options 0l (Int32.of_int request_size) t.set ms
+      0l
+  in
+  if Int32.equal kr Mach.mach_rcv_timed_out then Ok false
+  else if not (ok kr) then Error (Remote.Backend.Kern_return kr)
+  else if u32 t 20 <> mach_exception_raise_state_identity then
+    (* Not an exception request; nothing to answer. *)
+    Ok false
+  else (
+    ev.thread <- u32 t 28;
+    ev.task <- u32 t 40;
+    ev.exception_type <- u32 t 60;
+    ev.code <-
+      (if u32 t 64 > 0 then Remote.Decode.get_int t.request 68 else 0);
+    ev.subcode <-
+      (if u32 t 64 > 1 then Remote.Decode.get_int t.request 76 else 0);
+    ev.reply <- u32 t 8;
+    Ok true)
+
+let release name =
+  ignore (Mach.mach_port_deallocate (self ()) (Int32.of_int name))
+
+let flush t =
+  for i = 0 to t.pending - 1 do
+    let slot = i * reply_size in
+    ignore
+      (Mach.mach_msg
+         (to_voidp (t.replies_ptr +@ slot))
+         Mach.mach_send_msg
+         (Int32.of_int (Remote.Decode.get_uint32 t.replies (slot + 4)))
+         0l 0l 0l 0l)
+  done;
+  t.pending <- 0
+
+(* Build the reply to the request in [t.request] in the next free slot. *)
+let reply t (ev : Remote.Backend.exception_event) action =
+  if t.pending = t.capacity then flush t;
+  let slot = t.pending * reply_size in
+  let r = t.replies in
+  let state = state_offset t in
+  let count = min 614 (u32 t (state + 4)) in
+  let size = reply_header_size + (4 * count) in
+  set_u32 r slot (u32 t 0 land 0x1f);
+  set_u32 r (slot + 4) size;
+  set_u32 r (slot + 8) ev.reply;
+  set_u32 r (slot + 12) 0;
+  set_u32 r (slot + 16) 0;
+  set_u32 r (slot + 20) (u32 t 20 + 100);
+  Bigarray.Array1.blit
+    (Bigarray.Array1.sub t.request 52 8)
+    (Bigarray.Array1.sub r (slot + 24) 8);
+  set_u32 r (slot + 32)
+    (match action with
+    | Remote.Backend.Resume -> 0
+    | Remote.Backend.Forward -> Int32.to_int Mach.kern_failure);
+  set_u32 r (slot + 36) (u32 t state);
+  set_u32 r (slot + 40) count;
+  Bigarray.Array1.blit
+    (Bigarray.Array1.sub t.request (state + 8) (4 * count))
+    (Bigarray.Array1.sub r (slot + reply_header_size) (4 * count));
+  t.pending <- t.pending + 1;
+  (* The request carried send rights for the thread and task. *)
+  release ev.thread;
+  release ev.task
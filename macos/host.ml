@@ -0,0 +1,28 @@
+open Ctypes
+open Foreign
+
+(** Facts about the host machine. *)
+
+(* int sysctlbyname(const char *name, void *oldp, size_t *oldlenp,
+       void *newp, size_t newlen); *)
+let sysctlbyname =
+  foreign "sysctlbyname"
+    (string @-> ptr void @-> ptr size_t @-> ptr void @-> size_t
+   @-> returning int)
+
+(** CPU types from `mach/machine.h` *)
+
+let cpu_type_x86_64 = 0x01000007
+let cpu_type_arm64 = 0x0100000c
+
+(** Architecture of the host, which is also that of every task we can inspect.
+    Under Rosetta this is the emulated x86_64. *)
+let machine () =
+  let cputype = allocate int32_t 0l in
+  let len = allocate size_t (Unsigned.Size_t.of_int 4) in
+  ignore
+    (sysctlbyname "hw.cputype" (to_voidp cputype) len null
+       Unsigned.Size_t.zero);
+  if Int32.to_int !@cputype = cpu_type_arm64 then Remote.Core_file.Arm64
+  else Remote.Core_file.X86_64
+
@@ -0,0 +1,126 @@
+(** [Mach] with the routines the backends call per page, region or thread
+    recorded in {!registry}.
+
+    Every other binding is [Mach]'s own. {!Task_memory}, {!Regions} and
+    {!Threads} bind [module Mach = Mach_instrumented] at their top; nothing
+    is recorded until [Remote.Instrument.enable registry], and until then
+    each wrapped routine costs a branch. Probes are named after the
+    routines, and timed with [mach_absolute_time]. *)
+
+include Mach
+
+let mach_absolute_time =
+  Foreign.foreign "mach_absolute_time" Ctypes.(void @-> returning uint64_t)
+
+(* kern_return_t mach_timebase_info(mach_timebase_info_t info), the struct
+   being two uint32_t, numer then denom. *)
+let mach_timebase_info =
+  Foreign.foreign "mach_timebase_info"
+    Ctypes.(ptr uint32_t @-> returning Mach.kern_return_t)
+
+(* Nanoseconds from [mach_absolute_time] ticks: 1:1 on Intel, 125/3 on
+   Apple silicon. *)
+let clock () =
+  let info = Ctypes.allocate_n Ctypes.uint32_t ~count:2 in
+  ignore (mach_timebase_info info);
+  let get i = Unsigned.UInt32.to_int Ctypes.(!@(info +@ i)) in
+  let numer = get 0 and denom = max 1 (get 1) in
+  if numer = denom then fun () ->
+    Unsigned.UInt64.to_int (mach_absolute_time ())
+  else fun () ->
+    Unsigned.UInt64.to_int (mach_absolute_time ()) * numer / denom
+
+let registry = Remote.Instrument.create ~clock:(clock ()) ()
+let probe = Remote.Instrument.probe registry
+
+let p_region_recurse = probe "mach_vm_region_recurse"
+let p_read = probe "mach_vm_read"
+let p_read_overwrite = probe "mach_vm_read_overwrite"
+let p_write = probe "mach_vm_write"
+let p_protect = probe "mach_vm_protect"
+let p_task_threads = probe "task_threads"
+let p_task_info = probe "task_info"
+let p_task_suspend = probe "task_suspend"
+let p_task_resume = probe "task_resume"
+let p_thread_get_state = probe "thread_get_state"
+let p_thread_set_state = probe "thread_set_state"
+let p_thread_info = probe "thread_info"
+let p_pid_for_task = probe "pid_for_task"
+
+(* Each is eta-expanded so a disabled registry costs no closure. *)
+let on () = Remote.Instrument.enabled registry
+
+let mach_vm_region_recurse task address size depth info count =
+  if not (on ()) then
+    Mach.mach_vm_region_recurse task address size depth info count
+  else
+    Remote.Instrument.kern p_region_recurse (fun () ->
+        Mach.mach_vm_region_recurse task address size depth info count)
+
+let mach_vm_read task address size data count =
+  if not (on ()) then Mach.mach_vm_read task address size data count
+  else
+    Remote.Instrument.kern p_read (fun () ->
+        Mach.mach_vm_read task address size data count)
+
+let mach_vm_read_overwrite task address size data out =
+  if not (on ()) then Mach.mach_vm_read_overwrite task address size data out
+  else
+    Remote.Instrument.kern p_read_overwrite (fun () ->
+        Mach.mach_vm_read_overwrite task address size data out)
+
+let mach_vm_write task address data count =
+  if not (on ()) then Mach.mach_vm_write task address data count
+  else
+    Remote.Instrument.kern p_write (fun () ->
+        Mach.mach_vm_write task address data count)
+
+let mach_vm_protect task address size set_maximum protection =
+  if not (on ()) then
+    Mach.mach_vm_protect task address size set_maximum protection
+  else
+    Remote.Instrument.kern p_protect (fun () ->
+        Mach.mach_vm_protect task address size set_maximum protection)
+
+let task_threads task list count =
+  if not (on ()) then Mach.task_threads task list count
+  else
+    Remote.Instrument.kern p_task_threads (fun () ->
+        Mach.task_threads task list count)
+
+let task_info task flavor info count =
+  if not (on ()) then Mach.task_info task flavor info count
+  else
+    Remote.Instrument.kern p_task_info (fun () ->
+        Mach.task_info task flavor info count)
+
+let task_suspend task =
+  if not (on ()) then Mach.task_suspend task
+  else Remote.Instrument.kern p_task_suspend (fun () -> Mach.task_suspend task)
+
+let task_resume task =
+  if not (on ()) then Mach.task_resume task
+  else Remote.Instrument.kern p_task_resume (fun () -> Mach.task_resume task)
+
+let thread_get_state thread flavor state count =
+  if not (on ()) then Mach.thread_get_state thread flavor state count
+  else
+    Remote.Instrument.kern p_thread_get_state (fun () ->
+        Mach.thread_get_state thread flavor state count)
+
+let thread_set_state thread flavor state count =
+  if not (on ()) then Mach.thread_set_state thread flavor state count
+  else
+    Remote.Instrument.kern p_thread_set_state (fun () ->
+        Mach.thread_set_state thread flavor state count)
+
+let thread_info thread flavor info count =
+  if not (on ()) then Mach.thread_info thread flavor info count
+  else
+    Remote.Instrument.kern p_thread_info (fun () ->
+        Mach.thread_info thread flavor info count)
+
+let pid_for_task task pid =
+  if not (on ()) then Mach.pid_for_task task pid
+  else
+    Remote.Instrument.kern p_pid_for_task (fun () -> Mach.pid_for_task task pid)
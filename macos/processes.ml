@@ -0,0 +1,57 @@
+open Ctypes
+
+(** The process table from [proc_listpids] and [proc_pidinfo], as a
+    {!Remote.Backend.PROCESSES}.
+
+    macOS has no call returning the info of many processes at once, so a
+    snapshot costs one [proc_pidinfo] per process, but the kernel writes each
+    [proc_bsdshortinfo] straight into its slot of the caller's buffer. *)
+
+type t = { mutable pids : int32 CArray.t }
+
+let create () = { pids = CArray.make int32_t 1024 }
+
+(* All pids, sorted, growing [t.pids] until they fit. *)
+let rec list t =
+  let capacity = CArray.length t.pids in
+  let bytes =
+    Mach.proc_listpids Mach.proc_all_pids Unsigned.UInt32.zero
+      (to_voidp (CArray.start t.pids))
+      (capacity * 4)
+  in
+  if bytes <= 0 then Error (Remote.Backend.Unix_error Unix.EPERM)
+  else
+    let n = bytes / 4 in
+    if n >= capacity then (
+      t.pids <- CArray.make int32_t (2 * capacity);
+      list t)
+    else
+      let pids = Array.init n (fun i -> Int32.to_int (CArray.get t.pids i)) in
+      Array.sort Int.compare pids;
+      Ok pids
+
+(** [record t buf off pid] has the kernel write the [proc_bsdshortinfo] of
+    [pid] at [off] in [buf], or returns [false] if it has exited or we may
+    not inspect it. *)
+let record _ (buf : Remote.Backend.buffer) off pid =
+  let size = Remote.Proc_info.size in
+  Mach.proc_pidinfo (PosixTypes.Pid.of_int pid)
+    Remote.Proc_info.pidt_shortbsdinfo Unsigned.UInt64.zero
+    (to_voidp (bigarray_start array1 buf +@ off))
+    size
+  = size
+
+let snapshot t (buf : Remote.Backend.buffer) =
+  match list t with
+  | Error e -> Error e
+  | Ok pids ->
+      let size = Remote.Proc_info.size in
+      let capacity = Bigarray.Array1.dim buf / size in
+      let n = ref 0 in
+      Array.iter
+        (fun pid ->
+          if pid > 0 then
+            if !n >= capacity then incr n
+            else if record t buf (!n * size) pid then incr n)
+        pids;
+      Ok !n
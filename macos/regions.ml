@@ -0,0 +1,109 @@
+open Ctypes
+
+(** Streaming enumeration of a task's memory map with
+    [mach_vm_region_recurse], as a {!Remote.Backend.REGIONS}.
+
+    One set of out-parameters is allocated per enumerator and reused for every
+    call, and the submap info is decoded straight from the buffer the kernel
+    filled, so walking tens of thousands of regions allocates one small record
+    per region and nothing else. *)
+
+module Mach = Mach_instrumented
+
+type t = {
+  task : Mach.task_t;
+  address : Mach.mach_vm_address_t ptr;
+  size : Mach.mach_vm_size_t ptr;
+  depth : Mach.natural_t ptr;
+  count : Mach.mach_msg_type_number_t ptr;
+  info : Remote.Backend.buffer;
+  info_ptr : Mach.vm_region_recurse_info_t ptr;
+  pid : PosixTypes.pid_t;  (** For [proc_regionfilename]. *)
+  path : char CArray.t;
+}
+
+let maxpathlen = 1024
+
+let create task =
+  let info = Remote.Backend.create_buffer Remote.Region.submap_info_size in
+  let pid = allocate PosixTypes.pid_t (PosixTypes.Pid.of_int 0) in
+  ignore (Mach.pid_for_task task pid);
+  {
+    task;
+    address = allocate Mach.mach_vm_address_t Unsigned.UInt64.zero;
+    size = allocate Mach.mach_vm_size_t Unsigned.UInt64.zero;
+    depth = allocate Mach.natural_t 0l;
+    count = allocate Mach.mach_msg_type_number_t 0l;
+    info;
+    info_ptr =
+      bigarray_start array1 info |> to_voidp
+      |> from_voidp Mach.vm_region_recurse_info_t;
+    pid = !@pid;
+    path = CArray.make char maxpathlen;
+  }
+
+(** [next t address depth] is the first region at or above [address]. *)
+let next t address depth =
+  t.address <-@ Unsigned.UInt64.of_int address;
+  t.depth <-@ Int32.of_int depth;
+  t.count <-@ Int32.of_int Mach.vm_region_submap_info_count_64;
+  let kr =
+    Mach.mach_vm_region_recurse t.task t.address t.size t.depth t.info_ptr
+      t.count
+  in
+  if not (Int32.equal kr Mach.kern_success) then None
+  else
+    Some
+      (Remote.Region.of_submap_info
+         ~start:(Unsigned.UInt64.to_int !@(t.address))
+         ~size:(Unsigned.UInt64.to_int !@(t.size))
+         ~depth:(Int32.to_int !@(t.depth))
+         t.info)
+
+let fold_regions t ~start ~stop ~depth f acc =
+  let rec loop address acc =
+    if address >= stop then acc
+    else
+      match next t address depth with
+      | Some r when r.Remote.Region.start < stop ->
+          loop (Remote.Region.stop r) (f acc r)
+      | _ -> acc
+  in
+  loop start acc
+
+let regions t ~start ~stop ~depth =
+  let rec from address () =
+    if address >= stop then Seq.Nil
+    else
+      match next t address depth with
+      | Some r when r.Remote.Region.start < stop ->
+          Seq.Cons (r, from (Remote.Region.stop r))
+      | _ -> Seq.Nil
+  in
+  from start
+
+(** Path of the file mapped at [address], or [""]. The kernel writes into one
+    buffer reused by every call. *)
+let path_of t address =
+  let n =
+    Mach.proc_regionfilename t.pid
+      (Unsigned.UInt64.of_int address)
+      (to_voidp (CArray.start t.path))
+      (Unsigned.UInt32.of_int maxpathlen)
+  in
+  if n <= 0 then "" else string_from_ptr (CArray.start t.path) ~length:n
+
+let region_name t (r : Remote.Region.t) = path_of t r.start
+
+let fold_named_regions t ~start ~stop ~depth f acc =
+  fold_regions t ~start ~stop ~depth
+    (fun acc r -> f acc r (path_of t r.Remote.Region.start))
+    acc
+
+(** [fold ?start ?stop ?depth t f acc] is {!fold_regions} with the whole
+    address space and the depth used by [vmmap] as defaults. *)
+let fold ?(start = 0) ?(stop = max_int) ?(depth = 2048) t f acc =
+  fold_regions t ~start ~stop ~depth f acc
+
+let to_seq ?(start = 0) ?(stop = max_int) ?(depth = 2048) t =
+  regions t ~start ~stop ~depth
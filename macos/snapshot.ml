@@ -0,0 +1,49 @@
+open Ctypes
+
+(** {!Remote.Task_snapshot} files of a live task.
+
+    As for {!Core}, the task is suspended while its threads and memory are
+    saved and resumed afterwards. Submaps are descended into, so each leaf
+    mapping is saved as one region. *)
+
+module Writer = Remote.Task_snapshot.Make (Task_memory)
+
+let proc_info task =
+  let pid = allocate PosixTypes.pid_t (PosixTypes.Pid.of_int 0) in
+  if not (Int32.equal (Mach.pid_for_task task pid) Mach.kern_success) then None
+  else
+    let size = Remote.Proc_info.size in
+    let record = Remote.Backend.create_buffer size in
+    if Processes.record () record 0 (PosixTypes.Pid.to_int !@pid) then (
+      let b = Bytes.create size in
+      Remote.Backend.blit_to_bytes record 0 b 0 size;
+      Some (Bytes.to_string b))
+    else None
+
+(** [capture ?chunk_size ?depth task path] saves [task] to [path]. *)
+let capture ?chunk_size ?depth task path =
+  let kr = Mach.task_suspend task in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    Fun.protect
+      ~finally:(fun () -> ignore (Mach.task_resume task))
+      (fun () ->
+        match Threads.list task with
+        | Error e -> Error e
+        | Ok ports ->
+            let machine = Host.machine () in
+            let threads = List.filter_map (Core.thread_state machine) ports in
+            Threads.release ports;
+            let regions =
+              Regions.fold_named_regions (Regions.create task) ~start:0
+                ~stop:max_int ~depth:2048
+                (fun acc r name ->
+                  if r.Remote.Region.is_submap then acc else (r, name) :: acc)
+                []
+              |> List.rev
+            in
+            let backend = Task_memory.create task in
+            Ok
+              (Writer.write ?chunk_size ?depth backend ~machine ~threads
+                 ?proc_info:(proc_info task) regions path))
@@ -0,0 +1,199 @@
+open Ctypes
+open Foreign
+
+(** Remote memory of a Mach task as a {!Remote.Backend.WRITER}.
+
+    Reads use [mach_vm_read_overwrite], so the kernel copies straight into the
+    caller's buffer instead of [mach_vm_read] mapping a fresh region that then
+    has to be returned with [vm_deallocate]. *)
+
+module Mach = Mach_instrumented
+
+let getpagesize = foreign "getpagesize" (void @-> returning int)
+
+type t = {
+  task : Mach.task_t;
+  page_size : int;
+  outsize : Mach.mach_vm_size_t ptr;
+  data : Mach.vm_offset_t ptr;
+  count : Mach.mach_msg_type_number_t ptr;
+  regions : Regions.t Lazy.t;  (** For the protection of pages written. *)
+}
+
+let create task =
+  {
+    task;
+    page_size = getpagesize ();
+    outsize = allocate Mach.mach_vm_size_t Unsigned.UInt64.zero;
+    data = allocate Mach.vm_offset_t Unsigned.UInt64.zero;
+    count = allocate Mach.mach_msg_type_number_t 0l;
+    regions = lazy (Regions.create task);
+  }
+
+let page_size t = t.page_size
+
+let address_of_buffer buf off =
+  raw_address_of_ptr (to_voidp (bigarray_start array1 buf +@ off))
+  |> Int64.of_nativeint |> Unsigned.UInt64.of_int64
+
+let read t address buf off len =
+  if off < 0 || len < 0 || off > Bigarray.Array1.dim buf - len then
+    invalid_arg "Task_memory.read";
+  let kr =
+    Mach.mach_vm_read_overwrite t.task
+      (Unsigned.UInt64.of_int address)
+      (Unsigned.UInt64.of_int len)
+      (address_of_buffer buf off)
+      t.outsize
+  in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    let n = Unsigned.UInt64.to_int !@(t.outsize) in
+    if n = len then Ok () else Error (Remote.Backend.Short_transfer n)
+
+let protect t address len prot =
+  Mach.mach_vm_protect t.task
+    (Unsigned.UInt64.of_int address)
+    (Unsigned.UInt64.of_int len)
+    Unsigned.UInt32.zero prot
+
+let writable =
+  Int32.logor Mach.vm_prot_read
+    (Int32.logor Mach.vm_prot_write Mach.vm_prot_copy)
+
+(* Protection of each region overlapping [len] bytes at [address], as
+   [(start, stop, protection)] clipped to them, to put back after a write
+   has lifted it. *)
+let protections t address len =
+  Regions.fold_regions (Lazy.force t.regions) ~start:address
+    ~stop:(address + len) ~depth:2048
+    (fun acc (r : Remote.Region.t) ->
+      let hi = min (Remote.Region.stop r) (address + len) in
+      (max r.start address, hi, Int32.of_int r.protection) :: acc)
+    []
+
+let restore t saved =
+  List.iter (fun (lo, hi, prot) -> ignore (protect t lo (hi - lo) prot)) saved
+
+let write_once t address buf off len =
+  Mach.mach_vm_write t.task
+    (Unsigned.UInt64.of_int address)
+    (address_of_buffer buf off) (Int32.of_int len)
+
+let result kr =
+  if Int32.equal kr Mach.kern_success then Ok ()
+  else Error (Remote.Backend.Kern_return kr)
+
+(** [write t address buf off len] writes with [mach_vm_write]. Pages that
+    refuse the write, such as code, are made writable (copy-on-write, so
+    shared text is never modified) for one [mach_vm_write] and then given
+    back the protection they had. *)
+let write t address buf off len =
+  if off < 0 || len < 0 || off > Bigarray.Array1.dim buf - len then
+    invalid_arg "Task_memory.write";
+  let kr = write_once t address buf off len in
+  result
+    (if not (Int32.equal kr Mach.kern_protection_failure) then kr
+     else
+       let saved = protections t address len in
+       let kr = protect t address len writable in
+       if not (Int32.equal kr Mach.kern_success) then kr
+       else
+         let kr = write_once t address buf off len in
+         restore t saved;
+         kr)
+
+(** [write_spans t spans buf] writes each span with one [mach_vm_write], in
+    address order. Like {!write} it lifts the protection of pages that refuse
+    a write, but they stay writable until every span has been written, so
+    patching many spans of the same code pages costs one [mach_vm_protect]
+    per contiguous range of them, plus one per region to restore it. *)
+let write_spans t spans buf =
+  let n = Array.length spans in
+  let offsets = Array.make (n + 1) 0 in
+  Array.iteri (fun i (_, len) -> offsets.(i + 1) <- offsets.(i) + len) spans;
+  if offsets.(n) > Bigarray.Array1.dim buf then
+    invalid_arg "Task_memory.write_spans";
+  let page a = a land lnot (t.page_size - 1) in
+  (* Ranges made writable so far, most recent first, as [(start, stop)],
+     and the protection each region in them had before. *)
+  let lifted = ref [] and saved = ref [] in
+  let unprotect lo hi =
+    let before = protections t lo (hi - lo) in
+    let kr = protect t lo (hi - lo) writable in
+    if Int32.equal kr Mach.kern_success then saved := before @ !saved;
+    kr
+  in
+  let lift lo hi =
+    match !lifted with
+    | (start, stop) :: rest when stop >= lo ->
+        (* Spans come in address order: extend the last range instead. *)
+        let kr = if hi <= stop then Mach.kern_success else unprotect stop hi in
+        if Int32.equal kr Mach.kern_success then
+          lifted := (start, max stop hi) :: rest;
+        kr
+    | _ ->
+        let kr = unprotect lo hi in
+        if Int32.equal kr Mach.kern_success then lifted := (lo, hi) :: !lifted;
+        kr
+  in
+  let order = Array.init n Fun.id in
+  Array.sort (fun i j -> Int.compare (fst spans.(i)) (fst spans.(j))) order;
+  let results = Array.make n (Ok ()) in
+  Array.iter
+    (fun i ->
+      let address, len = spans.(i) in
+      let kr = write_once t address buf offsets.(i) len in
+      results.(i) <-
+        result
+          (if len = 0 || not (Int32.equal kr Mach.kern_protection_failure) then
+             kr
+           else
+             let hi = page (address + len - 1) + t.page_size in
+             let kr = lift (page address) hi in
+             if not (Int32.equal kr Mach.kern_success) then kr
+             else write_once t address buf offsets.(i) len))
+    order;
+  restore t !saved;
+  results
+
+(* mach_vm_read_list would map every span page-aligned into our address space
+   and each mapping would need its own vm_deallocate, so spans are copied one
+   mach_vm_read_overwrite at a time instead. Callers such as Remote.Batch keep
+   the number of spans down by coalescing neighbouring ranges first. *)
+let read_spans t spans buf =
+  let off = ref 0 in
+  Array.map
+    (fun (address, len) ->
+      let r = read t address buf !off len in
+      off := !off + len;
+      r)
+    spans
+
+(** [view t address len] maps [len] bytes at [address] with [mach_vm_read] and
+    returns the mapped buffer itself, so nothing is copied. The mapping is
+    returned with [vm_deallocate] when the view is released or collected. *)
+let view t address len =
+  let kr =
+    Mach.mach_vm_read t.task
+      (Unsigned.UInt64.of_int address)
+      (Unsigned.UInt64.of_int len)
+      t.data t.count
+  in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    let local = !@(t.data) in
+    let n = Int32.to_int !@(t.count) land 0xffff_ffff in
+    let data =
+      ptr_of_raw_address (Int64.to_nativeint (Unsigned.UInt64.to_int64 local))
+      |> from_voidp char
+      |> bigarray_of_ptr array1 n Bigarray.char
+    in
+    let free () =
+      ignore
+        (Mach.vm_deallocate (Mach.mach_task_self ()) local
+           (Unsigned.UInt64.of_int n))
+    in
+    Ok (Remote.View.make ~free ~address data)
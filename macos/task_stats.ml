@@ -0,0 +1,89 @@
+open Ctypes
+
+(** Resource usage of tasks from [task_info] and [thread_info], as a
+    {!Remote.Backend.TASKS}.
+
+    [MACH_TASK_BASIC_INFO] gives the sizes and the CPU time of threads that
+    have terminated; the live threads' time comes from a [THREAD_BASIC_INFO]
+    each, read in place with {!Remote.Thread_info.time}. Every worker has its
+    own out-parameters and info buffers, so workers on different domains
+    share nothing but the task ports. *)
+
+type t = unit
+
+type worker = {
+  task_info : Remote.Backend.buffer;
+  task_info_ptr : Mach.integer_t ptr;
+  thread_info : Remote.Backend.buffer;
+  thread_info_ptr : Mach.integer_t ptr;
+  count : Mach.mach_msg_type_number_t ptr;
+  list : Mach.thread_act_array_t ptr;
+  threads : Mach.mach_msg_type_number_t ptr;
+}
+
+let create () = ()
+
+let info_buffer words =
+  let buf = Remote.Backend.create_buffer (words * 4) in
+  (buf, bigarray_start array1 buf |> to_voidp |> from_voidp Mach.integer_t)
+
+let worker () =
+  let task_info, task_info_ptr = info_buffer Mach.mach_task_basic_info_count in
+  let thread_info, thread_info_ptr = info_buffer Remote.Thread_info.count in
+  {
+    task_info;
+    task_info_ptr;
+    thread_info;
+    thread_info_ptr;
+    count = allocate Mach.mach_msg_type_number_t 0l;
+    list = allocate Mach.thread_act_array_t Unsigned.UInt64.zero;
+    threads = allocate Mach.mach_msg_type_number_t 0l;
+  }
+
+let timed_out = Remote.Backend.Unix_error Unix.ETIMEDOUT
+
+(* Add the time of the live threads to [stats], releasing every port. The
+   deadline is checked between threads; the rest are still released. *)
+let add_threads w names n ~deadline (stats : Remote.Backend.task_stats) =
+  let late = ref false in
+  for i = 0 to n - 1 do
+    let name = !@(names +@ i) in
+    if (not !late) && Unix.gettimeofday () > deadline then late := true;
+    (if not !late then (
+       w.count <-@ Int32.of_int Remote.Thread_info.count;
+       let kr =
+         Mach.thread_info
+           (Unsigned.UInt64.of_int64 (Unsigned.UInt32.to_int64 name))
+           Mach.thread_basic_info w.thread_info_ptr w.count
+       in
+       (* A thread that exits meanwhile is only missing from the sums. *)
+       if Int32.equal kr Mach.kern_success then (
+         let time = Remote.Thread_info.time w.thread_info in
+         stats.user_time <- stats.user_time + time 0;
+         stats.system_time <- stats.system_time + time 8)));
+    Threads.release_port (Int64.to_int32 (Unsigned.UInt32.to_int64 name))
+  done;
+  Threads.release_array w.list n;
+  if !late then Error timed_out else Ok ()
+
+let collect w task ~deadline (stats : Remote.Backend.task_stats) =
+  let task = Unsigned.UInt64.of_int task in
+  w.count <-@ Int32.of_int Mach.mach_task_basic_info_count;
+  let kr =
+    Mach.task_info task Mach.mach_task_basic_info w.task_info_ptr w.count
+  in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    let b = w.task_info in
+    stats.virtual_size <- Remote.Decode.get_int b 0;
+    stats.resident <- Remote.Decode.get_int b 8;
+    stats.user_time <- Remote.Thread_info.time b 24;
+    stats.system_time <- Remote.Thread_info.time b 32;
+    if Unix.gettimeofday () > deadline then Error timed_out
+    else
+      match Threads.fetch task w.list w.threads with
+      | Error e -> Error e
+      | Ok (names, n) ->
+          stats.threads <- n;
+          add_threads w names n ~deadline stats
@@ -0,0 +1,93 @@
+open Ctypes
+
+(** Suspending a task and moving its threads' register sets with
+    [thread_get_state] and [thread_set_state], as a
+    {!Remote.Backend.THREAD_STATES}.
+
+    Thread ids are thread port names. The send rights {!stop} takes are
+    held until {!resume}, so the names stay valid for the whole stop. *)
+
+type t = {
+  task : Mach.task_t;
+  machine : Remote.Core_file.machine;
+  count : Mach.mach_msg_type_number_t ptr;
+  mutable ports : Mach.thread_act_t list;
+  mutable suspended : bool;
+}
+
+let create task =
+  {
+    task;
+    machine = Host.machine ();
+    count = allocate Mach.mach_msg_type_number_t 0l;
+    ports = [];
+    suspended = false;
+  }
+
+(* Flavor and size in 32-bit words of each register set. *)
+let flavor t set =
+  match (t.machine, set) with
+  | Remote.Core_file.X86_64, Remote.Backend.General ->
+      (Mach.x86_thread_state64, Mach.x86_thread_state_count)
+  | Remote.Core_file.X86_64, Remote.Backend.Float ->
+      (Mach.x86_float_state64, Mach.x86_float_state64_count)
+  | Remote.Core_file.X86_64, Remote.Backend.Exception ->
+      (Mach.x86_exception_state64, Mach.x86_exception_state64_count)
+  | Remote.Core_file.Arm64, Remote.Backend.General ->
+      (Mach.arm_thread_state64, Mach.arm_thread_state64_count)
+  | Remote.Core_file.Arm64, Remote.Backend.Float ->
+      (Mach.arm_neon_state64, Mach.arm_neon_state64_count)
+  | Remote.Core_file.Arm64, Remote.Backend.Exception ->
+      (Mach.arm_exception_state64, Mach.arm_exception_state64_count)
+
+let state_size t set = snd (flavor t set) * 4
+
+let stop t =
+  if t.suspended then invalid_arg "Thread_states.stop: already stopped";
+  let kr = Mach.task_suspend t.task in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    match Threads.list t.task with
+    | Error e ->
+        ignore (Mach.task_resume t.task);
+        Error e
+    | Ok ports ->
+        t.suspended <- true;
+        t.ports <- ports;
+        Ok (Array.of_list (List.map Unsigned.UInt64.to_int ports))
+
+let resume t =
+  Threads.release t.ports;
+  t.ports <- [];
+  if not t.suspended then Ok ()
+  else (
+    t.suspended <- false;
+    let kr = Mach.task_resume t.task in
+    if Int32.equal kr Mach.kern_success then Ok ()
+    else Error (Remote.Backend.Kern_return kr))
+
+let state_ptr buf off =
+  bigarray_start array1 buf +@ off |> to_voidp |> from_voidp Mach.thread_state_t
+
+let get_state t thread set buf off =
+  let flavor, words = flavor t set in
+  t.count <-@ Int32.of_int words;
+  let kr =
+    Mach.thread_get_state
+      (Unsigned.UInt64.of_int thread)
+      flavor (state_ptr buf off) t.count
+  in
+  if Int32.equal kr Mach.kern_success then Ok (Int32.to_int !@(t.count) * 4)
+  else Error (Remote.Backend.Kern_return kr)
+
+let set_state t thread set buf off len =
+  let flavor, _ = flavor t set in
+  let kr =
+    Mach.thread_set_state
+      (Unsigned.UInt64.of_int thread)
+      flavor (state_ptr buf off)
+      (Int32.of_int (len / 4))
+  in
+  if Int32.equal kr Mach.kern_success then Ok ()
+  else Error (Remote.Backend.Kern_return kr)
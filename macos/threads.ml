@@ -0,0 +1,122 @@
+open Ctypes
+
+(** Threads of a task, and register samples of all of them as a
+    {!Remote.Backend.THREADS}.
+
+    The sampler allocates its out-parameters and thread state buffer once.
+    [task_threads] still hands back a fresh array of thread ports per call;
+    both the array and the port rights are returned to the kernel before the
+    task is resumed, so sampling for hours does not leak. *)
+
+module Mach = Mach_instrumented
+
+let address_of p = Unsigned.UInt64.to_int64 p |> Int64.to_nativeint
+
+(* task_threads fills a vm_allocate'd array of 32-bit thread port names. *)
+let fetch task list count =
+  let kr = Mach.task_threads task list count in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    Ok
+      ( from_voidp uint32_t (ptr_of_raw_address (address_of !@list)),
+        Int32.to_int !@count )
+
+let release_array list n =
+  ignore
+    (Mach.vm_deallocate (Mach.mach_task_self ()) !@list
+       (Unsigned.UInt64.of_int (n * 4)))
+
+let release_port name =
+  ignore (Mach.mach_port_deallocate (Mach.mach_task_self ()) name)
+
+(** Thread ports of [task]. The caller owns the send rights and gives them
+    back with {!release}. *)
+let list task =
+  let list = allocate Mach.thread_act_array_t Unsigned.UInt64.zero in
+  let count = allocate Mach.mach_msg_type_number_t 0l in
+  match fetch task list count with
+  | Error e -> Error e
+  | Ok (names, n) ->
+      let ports =
+        List.init n (fun i ->
+            Unsigned.UInt32.to_int64 !@(names +@ i) |> Unsigned.UInt64.of_int64)
+      in
+      release_array list n;
+      Ok ports
+
+let release ports =
+  List.iter
+    (fun port -> release_port (Unsigned.UInt64.to_int64 port |> Int64.to_int32))
+    ports
+
+type t = {
+  task : Mach.task_t;
+  list : Mach.thread_act_array_t ptr;
+  count : Mach.mach_msg_type_number_t ptr;
+  flavor : Mach.thread_state_flavor_t;
+  words : int;
+  state : Remote.Backend.buffer;
+  state_ptr : Mach.thread_state_t ptr;
+  state_count : Mach.mach_msg_type_number_t ptr;
+  pc : int;
+  sp : int;
+  fp : int;
+}
+
+let create task =
+  (* Byte offsets in x86_thread_state64_t and arm_thread_state64_t. *)
+  let flavor, words, pc, sp, fp =
+    match Host.machine () with
+    | Remote.Core_file.X86_64 ->
+        (Mach.x86_thread_state64, Mach.x86_thread_state64_count, 128, 56, 48)
+    | Remote.Core_file.Arm64 ->
+        (Mach.arm_thread_state64, Mach.arm_thread_state64_count, 256, 248, 232)
+  in
+  let state = Remote.Backend.create_buffer (words * 4) in
+  {
+    task;
+    list = allocate Mach.thread_act_array_t Unsigned.UInt64.zero;
+    count = allocate Mach.mach_msg_type_number_t 0l;
+    flavor;
+    words;
+    state;
+    state_ptr =
+      bigarray_start array1 state |> to_voidp |> from_voidp Mach.thread_state_t;
+    state_count = allocate Mach.mach_msg_type_number_t 0l;
+    pc;
+    sp;
+    fp;
+  }
+
+let sample t f =
+  let kr = Mach.task_suspend t.task in
+  if not (Int32.equal kr Mach.kern_success) then
+    Error (Remote.Backend.Kern_return kr)
+  else
+    Fun.protect
+      ~finally:(fun () -> ignore (Mach.task_resume t.task))
+      (fun () ->
+        match fetch t.task t.list t.count with
+        | Error e -> Error e
+        | Ok (names, n) ->
+            let sampled = ref 0 in
+            for i = 0 to n - 1 do
+              let name = !@(names +@ i) in
+              t.state_count <-@ Int32.of_int t.words;
+              let kr =
+                Mach.thread_get_state
+                  (Unsigned.UInt64.of_int64 (Unsigned.UInt32.to_int64 name))
+                  t.flavor t.state_ptr t.state_count
+              in
+              if Int32.equal kr Mach.kern_success then (
+                incr sampled;
+                f
+                  (Int64.to_int (Unsigned.UInt32.to_int64 name))
+                  (Remote.Decode.get_int t.state t.pc)
+                  (Remote.Decode.get_int t.state t.sp)
+                  (Remote.Decode.get_int t.state t.fp));
+              release_port (Int64.to_int32 (Unsigned.UInt32.to_int64 name))
+            done;
+            release_array t.list n;
+            Ok !sampled)
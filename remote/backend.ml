@@ -0,0 +1,307 @@
+(** Signatures shared by the platform backends.
+
+    The tools in this library are written against these signatures rather than
+    against [Mach] directly, so the same code runs over a Mach task on macOS and
+    over a child process on Linux. Addresses are plain [int]s: user space
+    addresses on both x86_64 and arm64 fit comfortably in 63 bits and this
+    avoids boxing an [Unsigned.UInt64.t] per access. *)
+
+type buffer =
+  (char, Bigarray.int8_unsigned_elt, Bigarray.c_layout) Bigarray.Array1.t
+(** Off-heap byte buffer. Backends transfer straight into these, which never
+    move, so no copy through the OCaml heap is needed. *)
+
+let create_buffer len =
+  Bigarray.Array1.create Bigarray.char Bigarray.c_layout len
+
+(** [blit_to_bytes buf off dst dst_off len] copies [len] bytes out of [buf]. *)
+let blit_to_bytes buf off dst dst_off len =
+  if
+    off < 0 || len < 0 || dst_off < 0
+    || off > Bigarray.Array1.dim buf - len
+    || dst_off > Bytes.length dst - len
+  then invalid_arg "Backend.blit_to_bytes";
+  for i = 0 to len - 1 do
+    Bytes.unsafe_set dst (dst_off + i)
+      (Bigarray.Array1.unsafe_get buf (off + i))
+  done
+
+type error =
+  | Kern_return of int32  (** A Mach routine returned this [kern_return_t]. *)
+  | Unix_error of Unix.error  (** A Linux system call failed with this errno. *)
+  | Short_transfer of int  (** Only this many bytes were transferred. *)
+
+let error_to_string = function
+  | Kern_return kr -> Printf.sprintf "kern_return_t %ld" kr
+  | Unix_error e -> Unix.error_message e
+  | Short_transfer n -> Printf.sprintf "short transfer of %d bytes" n
+
+(** Read access to the memory of a target. *)
+module type READER = sig
+  type t
+
+  val page_size : t -> int
+  (** Page size of the target, a power of two. *)
+
+  val read : t -> int -> buffer -> int -> int -> (unit, error) result
+  (** [read t address buf off len] copies [len] bytes of target memory starting
+      at [address] into [buf] at offset [off]. *)
+end
+
+(** A {!READER} that can transfer many ranges per kernel call. *)
+module type VECTORED_READER = sig
+  include READER
+
+  val read_spans :
+    t -> (int * int) array -> buffer -> (unit, error) result array
+  (** [read_spans t spans buf] reads every [(address, len)] of [spans] into
+      [buf], packed back to back in order, using as few calls as the platform
+      allows. One span failing does not stop the others being read. *)
+end
+
+(** A {!READER} that can also change target memory, including pages mapped
+    without write permission such as code. *)
+module type WRITER = sig
+  include READER
+
+  val write : t -> int -> buffer -> int -> int -> (unit, error) result
+  (** [write t address buf off len] copies [len] bytes of [buf] from offset
+      [off] into target memory at [address]. Write protection is lifted for
+      the duration where needed, once per call, so callers should write whole
+      pages rather than scattered bytes. *)
+end
+
+module type VECTORED_WRITER = sig
+  include WRITER
+
+  val write_spans :
+    t -> (int * int) array -> buffer -> (unit, error) result array
+  (** [write_spans t spans buf] writes every [(address, len)] of [spans] from
+      [buf], where they are packed back to back in order, using as few calls
+      as the platform allows. One span failing does not stop the others being
+      written. *)
+end
+
+(** Enumeration of a target's memory map. *)
+module type REGIONS = sig
+  type t
+
+  val fold_regions :
+    t ->
+    start:int ->
+    stop:int ->
+    depth:int ->
+    ('a -> Region.t -> 'a) ->
+    'a ->
+    'a
+  (** [fold_regions t ~start ~stop ~depth f acc] folds [f] over the regions
+      overlapping [start, stop) in address order, descending into submaps up
+      to [depth] where the platform has them. *)
+
+  val regions : t -> start:int -> stop:int -> depth:int -> Region.t Seq.t
+  (** The same regions as an on-demand sequence. Each step queries the target
+      afresh, so the map is never held in memory. *)
+end
+
+(** A {!REGIONS} that can also name the file backing each region. *)
+module type NAMED_REGIONS = sig
+  include REGIONS
+
+  val fold_named_regions :
+    t ->
+    start:int ->
+    stop:int ->
+    depth:int ->
+    ('a -> Region.t -> string -> 'a) ->
+    'a ->
+    'a
+  (** As {!fold_regions} with the backing file's path, or [""] for anonymous
+      memory. *)
+end
+
+(** Change hints used to avoid re-reading memory that cannot have changed. *)
+module type DIRTY = sig
+  type t
+
+  val region_unchanged : t -> before:Region.t -> after:Region.t -> bool
+  (** [true] only if no byte of the region can have changed between two
+      enumerations, judged from the region metadata alone. *)
+
+  val dirty_pages : t -> Region.t -> Bytes.t -> bool
+  (** [dirty_pages t r flags] sets [flags.[i]] to ['\000'] for each page [i] of
+      [r] known to be unchanged since the last {!clear}, and to ['\001']
+      otherwise. Returns [false], leaving [flags] alone, when the platform has
+      no per-page information. *)
+
+  val clear : t -> unit
+  (** Start a new tracking interval. *)
+end
+
+(** Register snapshots of every thread of a target. *)
+module type THREADS = sig
+  type t
+
+  val sample : t -> (int -> int -> int -> int -> unit) -> (int, error) result
+  (** [sample t f] stops every thread of the target, calls [f tid pc sp fp] for
+      each while they are all stopped, then resumes them. Returns the number of
+      threads sampled. *)
+end
+
+(** An exception raised by a thread of a target. Event sources fill one
+    preallocated record in place rather than allocating per exception. *)
+type exception_event = {
+  mutable task : int;  (** Task port name on macOS, process id on Linux. *)
+  mutable thread : int;  (** Thread port name or thread id. *)
+  mutable exception_type : int;  (** An [EXC_*] number from [Mach]. *)
+  mutable code : int;
+  mutable subcode : int;
+  mutable reply : int;  (** Source private token identifying the reply. *)
+}
+
+let exception_event () =
+  { task = 0; thread = 0; exception_type = 0; code = 0; subcode = 0; reply = 0 }
+
+(** How a handled exception is answered. *)
+type exception_action =
+  | Resume  (** Handled: resume the thread as if nothing happened. *)
+  | Forward
+      (** Not handled: pass the exception on, to the next exception port on
+          macOS or as the original signal on Linux. *)
+
+(** A stream of exceptions from any number of targets. *)
+module type EVENTS = sig
+  type t
+
+  val next : t -> timeout:float -> exception_event -> (bool, error) result
+  (** [next t ~timeout ev] waits up to [timeout] seconds (forever if negative)
+      for the next exception and stores it into [ev]. Returns [false] if none
+      arrived in time. *)
+
+  val reply : t -> exception_event -> exception_action -> unit
+  (** Queue the answer to an exception returned by {!next}. The thread stays
+      stopped until {!flush}. *)
+
+  val flush : t -> unit
+  (** Send every queued reply. *)
+end
+
+(** The process table of a host. *)
+module type PROCESSES = sig
+  type t
+
+  val snapshot : t -> buffer -> (int, error) result
+  (** [snapshot t buf] writes one [proc_bsdshortinfo] record
+      ({!Proc_info.size} bytes, the macOS layout) per process into [buf], in
+      increasing pid order, and returns the number of processes. When that is
+      more than [buf] holds, only those that fit are written and the caller
+      should retry with a larger buffer. *)
+end
+
+(** Resource usage of one task, filled in place by a {!TASKS} collector. *)
+type task_stats = {
+  mutable threads : int;
+  mutable user_time : int;  (** Microseconds, all threads. *)
+  mutable system_time : int;  (** Microseconds, all threads. *)
+  mutable resident : int;  (** Bytes. *)
+  mutable virtual_size : int;  (** Bytes. *)
+}
+
+let task_stats () =
+  {
+    threads = 0;
+    user_time = 0;
+    system_time = 0;
+    resident = 0;
+    virtual_size = 0;
+  }
+
+(** Collection of {!task_stats} for many tasks from several domains. *)
+module type TASKS = sig
+  type t
+
+  type worker
+  (** Buffers for one domain, reused for every task it collects. *)
+
+  val worker : t -> worker
+
+  val collect :
+    worker -> int -> deadline:float -> task_stats -> (unit, error) result
+  (** [collect w task ~deadline stats] fills [stats] for [task], a task port
+      on macOS or a pid on Linux. Collection gives up with [ETIMEDOUT] at the
+      first step that starts after [deadline], a [Unix.gettimeofday] time. *)
+end
+
+(** Hardware debug registers of one thread, as the kernel stores them. On
+    x86_64 [values] are DR0 to DR3, [controls] holds DR7 alone and [status]
+    is DR6. On arm64 [values] and [controls] are the watchpoint value and
+    control registers, [WVR] and [WCR], and [status] is unused: the hit is
+    told apart by the faulting address. *)
+type debug_state = {
+  values : int array;
+  controls : int array;
+  mutable status : int;
+}
+
+(** Debug registers of every thread of a target. *)
+module type DEBUG_REGISTERS = sig
+  type t
+
+  val slots : t -> int
+  (** Watchpoints the hardware has: 4 on x86_64, up to 16 on arm64. *)
+
+  val threads : t -> (int list, error) result
+  (** The target's threads as they are now. *)
+
+  val get : t -> int -> debug_state -> (unit, error) result
+  (** [get t thread state] reads the debug registers of a stopped [thread]
+      into [state], whose arrays are {!slots} long ([controls] has one entry
+      on x86_64). *)
+
+  val set : t -> int -> debug_state -> (unit, error) result
+end
+
+(** Register sets of a thread: thread state flavors on macOS, ptrace
+    register sets on Linux. *)
+type register_set =
+  | General  (** Integer registers, program counter, stack pointer, flags. *)
+  | Float  (** Floating point and vector registers, x87 and SSE or NEON. *)
+  | Exception
+      (** The last fault: [x86_exception_state64] or [arm_exception_state64]
+          on macOS, the pending [siginfo_t] on Linux. *)
+
+let register_set_index = function General -> 0 | Float -> 1 | Exception -> 2
+
+(** Stopping a whole target and moving whole register sets of its threads. *)
+module type THREAD_STATES = sig
+  type t
+
+  val stop : t -> (int array, error) result
+  (** Stop every thread of the target and return them. *)
+
+  val resume : t -> (unit, error) result
+  (** Let the threads {!stop} stopped run again. *)
+
+  val state_size : t -> register_set -> int
+  (** Bytes a register set can take. *)
+
+  val get_state :
+    t -> int -> register_set -> buffer -> int -> (int, error) result
+  (** [get_state t thread set buf off] fetches [set] of a stopped [thread]
+      into [buf] at [off], which has {!state_size} bytes free, and returns
+      its length. *)
+
+  val set_state :
+    t -> int -> register_set -> buffer -> int -> int -> (unit, error) result
+  (** [set_state t thread set buf off len] writes back the [len] bytes at
+      [off] that {!get_state} fetched. *)
+end
+
+(** A {!REGIONS} that names the file backing one region on request, for
+    callers that cache names instead of resolving one per region per walk. *)
+module type REGION_NAMES = sig
+  include REGIONS
+
+  val region_name : t -> Region.t -> string
+  (** Path of the file backing a region returned by the last walk, or [""]
+      for anonymous memory. *)
+end
@@ -0,0 +1,102 @@
+(** Scatter-gather reads of many small ranges.
+
+    Stack unwinding and walking linked structures issue lots of small reads per
+    stop. A batch sorts the requested ranges, coalesces overlapping and
+    neighbouring ones into spans and hands all spans to the backend at once, so
+    a stop costs a handful of kernel calls instead of one per range. *)
+
+type plan = {
+  spans : (int * int) array;  (** Coalesced [(address, len)] spans. *)
+  span_of : int array;  (** Index into [spans] of each request. *)
+  offsets : int array;  (** Offset of each span in the packed buffer. *)
+  total : int;  (** Bytes covered by all spans. *)
+}
+
+(** [coalesce ?gap requests] groups [(address, len)] requests into spans.
+    Requests are merged when they overlap, touch, or are at most [gap] bytes
+    apart (default 0); reading a small gap is cheaper than another call. *)
+let coalesce ?(gap = 0) requests =
+  let n = Array.length requests in
+  Array.iter
+    (fun (_, len) -> if len < 0 then invalid_arg "Batch.coalesce")
+    requests;
+  let order = Array.init n Fun.id in
+  Array.sort
+    (fun i j -> Int.compare (fst requests.(i)) (fst requests.(j)))
+    order;
+  let span_start = Array.make n 0 and span_end = Array.make n 0 in
+  let span_of = Array.make n 0 in
+  let m = ref 0 in
+  Array.iter
+    (fun i ->
+      let address, len = requests.(i) in
+      let last = !m - 1 in
+      if !m > 0 && address <= span_end.(last) + gap then
+        span_end.(last) <- max span_end.(last) (address + len)
+      else (
+        span_start.(!m) <- address;
+        span_end.(!m) <- address + len;
+        incr m);
+      span_of.(i) <- !m - 1)
+    order;
+  let spans =
+    Array.init !m (fun s -> (span_start.(s), span_end.(s) - span_start.(s)))
+  in
+  let offsets = Array.make (!m + 1) 0 in
+  Array.iteri (fun s (_, len) -> offsets.(s + 1) <- offsets.(s) + len) spans;
+  { spans; span_of; offsets; total = offsets.(!m) }
+
+module Make (B : Backend.VECTORED_READER) = struct
+  (** [read ?gap t requests] reads every [(address, len)] of [requests] and
+      returns the bytes, or the error, for each one in request order.
+
+      When a span merged from several requests fails, typically because a gap
+      ran into unmapped memory, its requests are retried on their own so one bad
+      pointer does not poison its neighbours. *)
+  let read ?gap t requests =
+    let plan = coalesce ?gap requests in
+    let buf = Backend.create_buffer plan.total in
+    let span_results = B.read_spans t plan.spans buf in
+    let members = Array.make (Array.length plan.spans) 0 in
+    Array.iter (fun s -> members.(s) <- members.(s) + 1) plan.span_of;
+    let results =
+      Array.mapi
+        (fun i (address, len) ->
+          let s = plan.span_of.(i) in
+          match span_results.(s) with
+          | Ok () ->
+              let dst = Bytes.create len in
+              Backend.blit_to_bytes buf
+                (plan.offsets.(s) + address - fst plan.spans.(s))
+                dst 0 len;
+              Ok dst
+          | Error e -> Error e)
+        requests
+    in
+    let retry =
+      List.filter
+        (fun i ->
+          Result.is_error results.(i) && members.(plan.span_of.(i)) > 1)
+        (List.init (Array.length requests) Fun.id)
+      |> Array.of_list
+    in
+    if Array.length retry > 0 then (
+      let spans = Array.map (fun i -> requests.(i)) retry in
+      let buf =
+        Backend.create_buffer
+          (Array.fold_left (fun acc (_, len) -> acc + len) 0 spans)
+      in
+      let off = ref 0 in
+      Array.iteri
+        (fun k r ->
+          let len = snd spans.(k) in
+          (match r with
+          | Ok () ->
+              let dst = Bytes.create len in
+              Backend.blit_to_bytes buf !off dst 0 len;
+              results.(retry.(k)) <- Ok dst
+          | Error e -> results.(retry.(k)) <- Error e);
+          off := !off + len)
+        (B.read_spans t spans buf));
+    results
+end
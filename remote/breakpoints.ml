@@ -0,0 +1,167 @@
+(** Software breakpoints, inserted and removed in batches.
+
+    Insertions and removals are only queued until {!commit}. The bytes that
+    new breakpoints will replace are read a page run at a time, then every
+    change goes to the target in one {!Backend.VECTORED_WRITER.write_spans}
+    call that touches only the trap bytes themselves, so neighbouring bytes
+    the target changes meanwhile are never written back, and protections are
+    lifted once per range of code pages rather than per breakpoint. The bytes
+    each trap replaced are kept in a hash table, so stepping over a breakpoint
+    needs no read. *)
+
+(** [int3] on x86_64 and [brk #0] on arm64, as little-endian bytes packed
+    into an [int]. *)
+let trap = function Core_file.X86_64 -> 0xcc | Core_file.Arm64 -> 0xd4200000
+
+let trap_size = function Core_file.X86_64 -> 1 | Core_file.Arm64 -> 4
+
+module Make (W : Backend.VECTORED_WRITER) = struct
+  type t = {
+    backend : W.t;
+    page_size : int;
+    size : int;
+    trap : int;
+    run_pages : int;
+    buffer : Backend.buffer;
+    inserted : (int, int) Hashtbl.t;  (** Address to the bytes it replaced. *)
+    pending : (int, bool) Hashtbl.t;  (** Address to insert, or remove. *)
+  }
+
+  (** [create ?run_pages backend machine] reads at most [run_pages]
+      consecutive pages per call (default 16). *)
+  let create ?(run_pages = 16) backend machine =
+    let page_size = W.page_size backend in
+    {
+      backend;
+      page_size;
+      size = trap_size machine;
+      trap = trap machine;
+      run_pages;
+      buffer = Backend.create_buffer (run_pages * page_size);
+      inserted = Hashtbl.create 1024;
+      pending = Hashtbl.create 1024;
+    }
+
+  let check t address =
+    if address land (t.size - 1) <> 0 then invalid_arg "Breakpoints: alignment"
+
+  (** [insert t address] queues a breakpoint at [address]. *)
+  let insert t address =
+    check t address;
+    if Hashtbl.mem t.inserted address then Hashtbl.remove t.pending address
+    else Hashtbl.replace t.pending address true
+
+  (** [remove t address] queues the removal of the breakpoint at [address]. *)
+  let remove t address =
+    if Hashtbl.mem t.inserted address then
+      Hashtbl.replace t.pending address false
+    else Hashtbl.remove t.pending address
+
+  (** Whether a breakpoint is in target memory at [address]. *)
+  let mem t address = Hashtbl.mem t.inserted address
+
+  (** [original t address] is the bytes the breakpoint at [address] replaced,
+      little-endian in an [int] of {!trap_size} bytes, to execute in its place
+      when stepping over it. *)
+  let original t address = Hashtbl.find_opt t.inserted address
+
+  let count t = Hashtbl.length t.inserted
+  let pending t = Hashtbl.length t.pending
+
+  let get t buf off =
+    let v = ref 0 in
+    for i = t.size - 1 downto 0 do
+      v := (!v lsl 8) lor Decode.get_uint8 buf (off + i)
+    done;
+    !v
+
+  let set t buf off v =
+    for i = 0 to t.size - 1 do
+      Bigarray.Array1.set buf (off + i)
+        (Char.unsafe_chr ((v lsr (8 * i)) land 0xff))
+    done
+
+  (* Read the [pages] consecutive pages from [first], each of which has
+     breakpoints queued for insertion, and note the bytes they replace. *)
+  let originals t by_page first pages changes =
+    match W.read t.backend first t.buffer 0 (pages * t.page_size) with
+    | Error e -> Error e
+    | Ok () ->
+        for p = 0 to pages - 1 do
+          List.iter
+            (fun address ->
+              let old = get t t.buffer (address - first) in
+              changes := (address, Some old) :: !changes)
+            (Hashtbl.find by_page (first + (p * t.page_size)))
+        done;
+        Ok ()
+
+  (** [commit t] writes every queued change to the target and returns the
+      number of breakpoints inserted or removed. Changes that fail stay
+      queued, and the first error is returned after the others have been
+      tried. *)
+  let commit t =
+    let by_page = Hashtbl.create 64 and changes = ref [] in
+    Hashtbl.iter
+      (fun address insert ->
+        if insert then
+          let page = address land lnot (t.page_size - 1) in
+          let queued =
+            Option.value ~default:[] (Hashtbl.find_opt by_page page)
+          in
+          Hashtbl.replace by_page page (address :: queued)
+        else changes := (address, None) :: !changes)
+      t.pending;
+    let pages =
+      Hashtbl.fold (fun page _ acc -> page :: acc) by_page [] |> Array.of_list
+    in
+    Array.sort compare pages;
+    let n = Array.length pages in
+    let rec runs i error =
+      if i >= n then error
+      else
+        let rec extend j =
+          if
+            j < n
+            && j - i < t.run_pages
+            && pages.(j) = pages.(j - 1) + t.page_size
+          then extend (j + 1)
+          else j
+        in
+        let j = extend (i + 1) in
+        let first = pages.(i) in
+        let count = ((pages.(j - 1) - first) / t.page_size) + 1 in
+        match originals t by_page first count changes with
+        | Ok () -> runs j error
+        | Error e -> runs j (if error = None then Some e else error)
+    in
+    let error = ref (runs 0 None) in
+    let changes = Array.of_list !changes in
+    let buf = Backend.create_buffer (Array.length changes * t.size) in
+    let spans =
+      Array.mapi
+        (fun i (address, old) ->
+          set t buf (i * t.size)
+            (match old with
+            | Some _ -> t.trap
+            | None -> Hashtbl.find t.inserted address);
+          (address, t.size))
+        changes
+    in
+    let results =
+      if spans = [||] then [||] else W.write_spans t.backend spans buf
+    in
+    let written = ref 0 in
+    Array.iteri
+      (fun i r ->
+        match (r, changes.(i)) with
+        | Error e, _ -> if !error = None then error := Some e
+        | Ok (), (address, old) -> (
+            incr written;
+            Hashtbl.remove t.pending address;
+            match old with
+            | Some old -> Hashtbl.replace t.inserted address old
+            | None -> Hashtbl.remove t.inserted address))
+      results;
+    match !error with Some e -> Error e | None -> Ok !written
+end
@@ -0,0 +1,269 @@
+(** Streaming core dumps of a live target.
+
+    The whole layout of a core file follows from the region list and the thread
+    states, so the headers are written first and region contents are then
+    streamed straight after them. Contents are read in chunks into a small ring
+    of buffers: one domain reads the target while another writes finished
+    chunks to the file, and memory use stays at [depth + 2] chunks whatever the
+    size of the target.
+
+    Two formats are produced: an ELF [ET_CORE] file with one [NT_PRSTATUS]
+    note per thread, which gdb and lldb load on Linux, and a Mach-O [MH_CORE]
+    file with one [LC_THREAD] command per thread for macOS. *)
+
+type machine = X86_64 | Arm64
+type format = Elf | Macho
+
+type thread = {
+  tid : int;
+  flavor : int;  (** Mach thread state flavor; ignored for ELF. *)
+  state : string;
+      (** General purpose registers in the kernel's layout: [user_regs_struct]
+          on Linux, the flavor's state structure on macOS. *)
+}
+
+type stats = {
+  regions : int;  (** Regions written to the file. *)
+  skipped : int;  (** Unreadable regions left out. *)
+  bytes : int;  (** Bytes of target memory written. *)
+  errors : int;  (** Chunks that failed to read and were written as zeros. *)
+}
+
+(* Regions worth dumping: readable and not merely a guard page. *)
+let dumpable (r : Region.t) = r.size > 0 && Region.readable r
+
+let align n a = (n + a - 1) / a * a
+let set_u16 b off v = Bytes.set_uint16_le b off v
+let set_u32 b off v = Bytes.set_int32_le b off (Int32.of_int v)
+let set_u64 b off v = Bytes.set_int64_le b off (Int64.of_int v)
+
+(** {2 ELF} *)
+
+let pt_load = 1
+let pt_note = 4
+let nt_prstatus = 1
+let pn_xnum = 0xffff
+
+(* struct elf_prstatus: 112 bytes of signal and process information, then
+   pr_reg, then pr_fpvalid padded to 8 bytes. Only pr_pid matters to gdb. *)
+let prstatus_size regs = 112 + String.length regs + 8
+
+let elf_note_size t = 12 + 8 + align (prstatus_size t.state) 4
+
+(* The ELF header, program headers and notes, as one block. [segments] are
+   [(region, file offset)] pairs. *)
+let elf_headers ~machine ~page_size threads segments =
+  let nseg = List.length segments in
+  let phnum = nseg + 1 in
+  let notes_size = List.fold_left (fun n t -> n + elf_note_size t) 0 threads in
+  (* With PN_XNUM, the real program header count goes in section header 0. *)
+  let shnum = if phnum >= pn_xnum then 1 else 0 in
+  let phoff = 64 in
+  let shoff = phoff + (56 * phnum) in
+  let notes = shoff + (64 * shnum) in
+  let b = Bytes.make (notes + notes_size) '\000' in
+  Bytes.blit_string "\127ELF\002\001\001" 0 b 0 7;
+  set_u16 b 16 4 (* ET_CORE *);
+  set_u16 b 18 (match machine with X86_64 -> 62 | Arm64 -> 183);
+  set_u32 b 20 1;
+  set_u64 b 32 phoff;
+  if shnum > 0 then set_u64 b 40 shoff;
+  set_u16 b 52 64;
+  set_u16 b 54 56;
+  set_u16 b 56 (min phnum pn_xnum);
+  set_u16 b 58 (if shnum > 0 then 64 else 0);
+  set_u16 b 60 shnum;
+  if shnum > 0 then set_u32 b (shoff + 44) phnum;
+  let phdr i ~typ ~flags ~offset ~vaddr ~filesz ~memsz ~align =
+    let p = phoff + (56 * i) in
+    set_u32 b p typ;
+    set_u32 b (p + 4) flags;
+    set_u64 b (p + 8) offset;
+    set_u64 b (p + 16) vaddr;
+    set_u64 b (p + 32) filesz;
+    set_u64 b (p + 40) memsz;
+    set_u64 b (p + 48) align
+  in
+  phdr 0 ~typ:pt_note ~flags:0 ~offset:notes ~vaddr:0 ~filesz:notes_size
+    ~memsz:0 ~align:4;
+  List.iteri
+    (fun i ((r : Region.t), offset) ->
+      let flags =
+        (if Region.readable r then 4 else 0)
+        lor (if Region.writable r then 2 else 0)
+        lor if Region.executable r then 1 else 0
+      in
+      phdr (i + 1) ~typ:pt_load ~flags ~offset ~vaddr:r.start ~filesz:r.size
+        ~memsz:r.size ~align:page_size)
+    segments;
+  ignore
+    (List.fold_left
+       (fun p t ->
+         let desc = prstatus_size t.state in
+         set_u32 b p 5;
+         set_u32 b (p + 4) desc;
+         set_u32 b (p + 8) nt_prstatus;
+         Bytes.blit_string "CORE" 0 b (p + 12) 4;
+         let d = p + 20 in
+         set_u32 b (d + 32) t.tid;
+         Bytes.blit_string t.state 0 b (d + 112) (String.length t.state);
+         p + elf_note_size t)
+       notes threads);
+  b
+
+(** {2 Mach-O} *)
+
+let mh_core = 4
+let lc_segment_64 = 0x19
+let lc_thread = 0x4
+
+let thread_command_size t = 8 + 8 + String.length t.state
+
+let macho_headers ~machine threads segments =
+  let ncmds = List.length segments + List.length threads in
+  let sizeofcmds =
+    (72 * List.length segments)
+    + List.fold_left (fun n t -> n + thread_command_size t) 0 threads
+  in
+  let b = Bytes.make (32 + sizeofcmds) '\000' in
+  set_u32 b 0 0xfeedfacf;
+  (match machine with
+  | X86_64 ->
+      set_u32 b 4 0x01000007;
+      set_u32 b 8 3
+  | Arm64 ->
+      set_u32 b 4 0x0100000c;
+      set_u32 b 8 0);
+  set_u32 b 12 mh_core;
+  set_u32 b 16 ncmds;
+  set_u32 b 20 sizeofcmds;
+  let p =
+    List.fold_left
+      (fun p ((r : Region.t), offset) ->
+        set_u32 b p lc_segment_64;
+        set_u32 b (p + 4) 72;
+        set_u64 b (p + 24) r.start;
+        set_u64 b (p + 32) r.size;
+        set_u64 b (p + 40) offset;
+        set_u64 b (p + 48) r.size;
+        set_u32 b (p + 56) r.max_protection;
+        set_u32 b (p + 60) r.protection;
+        p + 72)
+      32 segments
+  in
+  ignore
+    (List.fold_left
+       (fun p t ->
+         set_u32 b p lc_thread;
+         set_u32 b (p + 4) (thread_command_size t);
+         set_u32 b (p + 8) t.flavor;
+         set_u32 b (p + 12) (String.length t.state / 4);
+         Bytes.blit_string t.state 0 b (p + 16) (String.length t.state);
+         p + thread_command_size t)
+       p threads);
+  b
+
+(* Lay out segment data page aligned after a header block of [header_size]
+   bytes. *)
+let place ~page_size header_size regions =
+  let offset = ref (align header_size page_size) in
+  List.map
+    (fun (r : Region.t) ->
+      let o = !offset in
+      offset := o + r.size;
+      (r, o))
+    regions
+
+(* The header size depends only on the counts, not on the offsets. *)
+let headers ~format ~machine ~page_size threads regions =
+  let build segments =
+    match format with
+    | Elf -> elf_headers ~machine ~page_size threads segments
+    | Macho -> macho_headers ~machine threads segments
+  in
+  let dummy = List.map (fun r -> (r, 0)) regions in
+  let segments = place ~page_size (Bytes.length (build dummy)) regions in
+  (build segments, segments)
+
+let rec write_all fd b off len =
+  if len > 0 then
+    let n = Unix.write fd b off len in
+    write_all fd b (off + n) (len - n)
+
+(** [stream ~read ~chunk_size ~depth fd ~position segments] copies every
+    [(region, offset)] of [segments], in file order, from target memory to
+    [offset] in [fd], which is at [position] on entry. One domain reads
+    [chunk_size] bytes at a time with [read] while another writes, with up
+    to [depth] chunks in flight, through {!Pool.pipeline}. Chunks that
+    cannot be read are written as zeros. Returns the final position, the
+    bytes written and the number of failed reads. *)
+let stream ~read ~chunk_size ~depth fd ~position segments =
+  let slots =
+    Array.init (depth + 2) (fun _ -> Backend.create_buffer chunk_size)
+  in
+  let staging = Bytes.create chunk_size in
+  let errors = ref 0 and bytes = ref 0 in
+  let produce emit =
+    let k = ref 0 in
+    List.iter
+      (fun ((r : Region.t), offset) ->
+        let rec chunks address =
+          if address < Region.stop r then (
+            let len = min chunk_size (Region.stop r - address) in
+            let buf = slots.(!k mod Array.length slots) in
+            incr k;
+            (match read address buf 0 len with
+            | Ok () -> ()
+            | Error _ ->
+                incr errors;
+                Bigarray.Array1.fill (Bigarray.Array1.sub buf 0 len) '\000');
+            emit (offset + (address - r.start), buf, len);
+            chunks (address + len))
+        in
+        chunks r.start)
+      segments
+  in
+  (* Chunks arrive in file order, so only the padding between segments
+     needs a seek. *)
+  let position = ref position in
+  let consume (offset, buf, len) =
+    if offset <> !position then ignore (Unix.lseek fd offset Unix.SEEK_SET);
+    Backend.blit_to_bytes buf 0 staging 0 len;
+    write_all fd staging 0 len;
+    position := offset + len;
+    bytes := !bytes + len
+  in
+  Pool.pipeline ~depth produce consume;
+  (!position, !bytes, !errors)
+
+module Make (B : Backend.READER) = struct
+  (** [write ?chunk_size ?depth backend ~format ~machine ~threads regions path]
+      dumps the readable [regions] of the target and its [threads] to [path].
+      The target should be stopped, or the file will mix memory from different
+      moments. Chunks that cannot be read are written as zeros so the layout
+      announced in the headers holds. *)
+  let write ?(chunk_size = 1 lsl 20) ?(depth = 4) backend ~format ~machine
+      ~threads regions path =
+    let page_size = B.page_size backend in
+    let dumped, skipped = List.partition dumpable regions in
+    let header, segments =
+      headers ~format ~machine ~page_size threads dumped
+    in
+    let fd =
+      Unix.openfile path [ Unix.O_WRONLY; Unix.O_CREAT; Unix.O_TRUNC ] 0o600
+    in
+    Fun.protect
+      ~finally:(fun () -> Unix.close fd)
+      (fun () ->
+        write_all fd header 0 (Bytes.length header);
+        let _, bytes, errors =
+          stream ~read:(B.read backend) ~chunk_size ~depth fd
+            ~position:(Bytes.length header) segments
+        in
+        {
+          regions = List.length dumped;
+          skipped = List.length skipped;
+          bytes;
+          errors;
+        })
+end
@@ -0,0 +1,16 @@
+(** Native-endian loads from a {!Backend.buffer} at arbitrary byte offsets.
+
+    These compile to single unaligned loads, so kernel structures can be
+    decoded in place from the buffer the kernel wrote them into without going
+    through Ctypes [getf] and a boxed [Unsigned] value per field. *)
+
+external get_uint16 : Backend.buffer -> int -> int = "%caml_bigstring_get16"
+external get_int32 : Backend.buffer -> int -> int32 = "%caml_bigstring_get32"
+external get_int64 : Backend.buffer -> int -> int64 = "%caml_bigstring_get64"
+
+let get_uint8 buf off = Char.code (Bigarray.Array1.get buf off)
+let get_uint32 buf off = Int32.to_int (get_int32 buf off) land 0xffff_ffff
+
+(** 64-bit field as an [int]; the top bit is lost, which is harmless for user
+    space addresses, sizes and object ids. *)
+let get_int buf off = Int64.to_int (get_int64 buf off)
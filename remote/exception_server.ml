@@ -0,0 +1,116 @@
+(** Exception server multiplexing any number of targets.
+
+    Handlers are registered per exception type. The server waits for the
+    first exception, then drains whatever else is already pending without
+    blocking, dispatching each as it is decoded, and only then sends the
+    replies of the whole batch together. One event record is reused for every
+    exception, so a busy target costs no allocation per exception. *)
+
+(** Exception types from `mach/exception_types.h`, mirrored here for
+    platforms without [Mach]. *)
+
+let exc_bad_access = 1
+let exc_bad_instruction = 2
+let exc_arithmetic = 3
+let exc_software = 5
+let exc_breakpoint = 6
+let exc_crash = 10
+let exc_soft_signal = 0x10003
+let max_exception = 13
+
+type handler = Backend.exception_event -> Backend.exception_action
+
+type stats = {
+  handled : int;
+  batches : int;
+  largest_batch : int;
+}
+
+module Make (E : Backend.EVENTS) = struct
+  type t = {
+    source : E.t;
+    batch : int;
+    handlers : handler array;
+    event : Backend.exception_event;
+    mutable handled : int;
+    mutable batches : int;
+    mutable largest_batch : int;
+  }
+
+  (** [create ?batch source] answers up to [batch] exceptions (default 64)
+      per round of replies. Exceptions without a handler are forwarded. *)
+  let create ?(batch = 64) source =
+    {
+      source;
+      batch;
+      handlers = Array.make (max_exception + 1) (fun _ -> Backend.Forward);
+      event = Backend.exception_event ();
+      handled = 0;
+      batches = 0;
+      largest_batch = 0;
+    }
+
+  (** [on t exception_type handler] handles [exception_type], an [EXC_*]
+      number. The event passed to [handler] is reused after it returns. *)
+  let on t exception_type handler =
+    if exception_type < 1 || exception_type > max_exception then
+      invalid_arg "Exception_server.on";
+    t.handlers.(exception_type) <- handler
+
+  let dispatch t =
+    let ev = t.event in
+    let action =
+      if ev.exception_type >= 1 && ev.exception_type <= max_exception then
+        t.handlers.(ev.exception_type) ev
+      else Backend.Forward
+    in
+    E.reply t.source ev action
+
+  (** [run_once t ~timeout] waits up to [timeout] seconds for exceptions and
+      handles one batch. Returns how many were handled. *)
+  let run_once t ~timeout =
+    let rec drain n =
+      if n >= t.batch then Ok n
+      else
+        match E.next t.source ~timeout:0. t.event with
+        | Ok true ->
+            dispatch t;
+            drain (n + 1)
+        | Ok false -> Ok n
+        | Error e -> if n > 0 then Ok n else Error e
+    in
+    let r =
+      match E.next t.source ~timeout t.event with
+      | Ok true ->
+          dispatch t;
+          drain 1
+      | Ok false -> Ok 0
+      | Error e -> Error e
+    in
+    (match r with
+    | Ok n when n > 0 ->
+        E.flush t.source;
+        t.handled <- t.handled + n;
+        t.batches <- t.batches + 1;
+        t.largest_batch <- max t.largest_batch n
+    | _ -> ());
+    r
+
+  (** [serve ?timeout t ~until] handles batches until [until ()] holds after
+      one, waiting at most [timeout] seconds (default 0.1) at a time so
+      [until] is polled even when no exception comes. *)
+  let serve ?(timeout = 0.1) t ~until =
+    let rec loop () =
+      match run_once t ~timeout with
+      | Error e -> Error e
+      | Ok _ -> if until () then Ok () else loop ()
+    in
+    loop ()
+
+  let stats t =
+    {
+      handled = t.handled;
+      batches = t.batches;
+      largest_batch = t.largest_batch;
+    }
+end
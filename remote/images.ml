@@ -0,0 +1,244 @@
+(** Table of the images, executables and libraries, a target has mapped.
+
+    Regions are grouped into images by backing object ([object_id_full] on
+    macOS, device and inode on Linux). Each image records its path, its
+    load base and its segments, the file-backed regions in address order.
+    Paths are resolved once per object and cached, so mapping addresses to
+    binaries never asks the kernel for a file name per region per query.
+    On macOS anonymous memory has object ids too; objects that resolve to
+    no path are remembered as such and left out of the table.
+
+    {!Make.refresh} walks the region metadata again, which is cheap, and
+    diffs it against the previous walk. Only objects with a region that
+    appeared, disappeared or changed are regrouped, and only objects not
+    seen before, or with none of their segments left in place, have their
+    path resolved. On macOS the dyld shared cache is one object, so it
+    appears as one image named after the first library resolved in it. *)
+
+type image = {
+  object_id : int;
+  path : string;
+  base : int;
+      (** Address file offset 0 is mapped at: the lowest segment start less
+          its offset. *)
+  segments : Region.t array;  (** Sorted by address. *)
+}
+
+type stats = {
+  mutable walks : int;
+  mutable mapped : int;  (** Regions with an object in the last walk. *)
+  mutable changed : int;  (** Regions that differed in the last walk. *)
+  mutable regrouped : int;  (** Images rebuilt by the last walk. *)
+  mutable resolved : int;  (** Paths asked of the target, in total. *)
+}
+
+type t = {
+  mutable regions : Region.t array;  (** With an object, sorted. *)
+  mutable images : image array;  (** Sorted by base. *)
+  mutable starts : int array;  (** Every segment's start, sorted. *)
+  mutable stops : int array;
+  mutable owners : int array;  (** Index in [images] of each segment. *)
+  names : (int, string) Hashtbl.t;
+      (** Object id to path, [""] for objects that are not images. *)
+  stats : stats;
+}
+
+let create () =
+  {
+    regions = [||];
+    images = [||];
+    starts = [||];
+    stops = [||];
+    owners = [||];
+    names = Hashtbl.create 256;
+    stats =
+      { walks = 0; mapped = 0; changed = 0; regrouped = 0; resolved = 0 };
+  }
+
+let images t = t.images
+let length t = Array.length t.images
+let stats t = t.stats
+
+(* Index of the last segment starting at or before [address], or [-1]. *)
+let floor t address =
+  let starts = t.starts in
+  let rec go lo hi =
+    if hi - lo <= 1 then lo
+    else
+      let mid = (lo + hi) lsr 1 in
+      if Array.unsafe_get starts mid <= address then go mid hi else go lo mid
+  in
+  go (-1) (Array.length starts)
+
+(** [find t address] is the image with a segment holding [address]. *)
+let find t address =
+  let i = floor t address in
+  if i >= 0 && address < t.stops.(i) then Some t.images.(t.owners.(i))
+  else None
+
+(** [find_path t path] is every image mapped from [path]. *)
+let find_path t path =
+  Array.to_list t.images |> List.filter (fun i -> i.path = path)
+
+(* Regions equal as far as the table is concerned. *)
+let same (a : Region.t) (b : Region.t) =
+  a.start = b.start && a.size = b.size && a.object_id = b.object_id
+  && a.offset = b.offset && a.protection = b.protection
+
+(* Object ids of the regions that differ between two sorted walks, and how
+   many regions differ. *)
+let diff old fresh =
+  let touched = Hashtbl.create 16 and changed = ref 0 in
+  let mark (r : Region.t) =
+    incr changed;
+    Hashtbl.replace touched r.object_id ()
+  in
+  let rec go i j =
+    match (i < Array.length old, j < Array.length fresh) with
+    | false, false -> ()
+    | true, false ->
+        mark old.(i);
+        go (i + 1) j
+    | false, true ->
+        mark fresh.(j);
+        go i (j + 1)
+    | true, true ->
+        let a = old.(i) and b = fresh.(j) in
+        if same a b then go (i + 1) (j + 1)
+        else if a.start < b.start then (
+          mark a;
+          go (i + 1) j)
+        else if b.start < a.start then (
+          mark b;
+          go i (j + 1))
+        else (
+          mark a;
+          mark b;
+          decr changed;
+          go (i + 1) (j + 1))
+  in
+  go 0 0;
+  (touched, !changed)
+
+let image_of object_id path segments =
+  let segments = Array.of_list segments in
+  Array.sort (fun (a : Region.t) b -> Int.compare a.start b.start) segments;
+  {
+    object_id;
+    path;
+    base =
+      Array.fold_left
+        (fun base (r : Region.t) -> min base (r.start - r.offset))
+        max_int segments;
+    segments;
+  }
+
+(* Lay every segment out for lookups. *)
+let index t =
+  let n =
+    Array.fold_left (fun n i -> n + Array.length i.segments) 0 t.images
+  in
+  let entries = Array.make n (0, 0, 0) in
+  let k = ref 0 in
+  Array.iteri
+    (fun owner image ->
+      Array.iter
+        (fun (r : Region.t) ->
+          entries.(!k) <- (r.start, Region.stop r, owner);
+          incr k)
+        image.segments)
+    t.images;
+  Array.sort (fun (a, _, _) (b, _, _) -> Int.compare a b) entries;
+  t.starts <- Array.map (fun (s, _, _) -> s) entries;
+  t.stops <- Array.map (fun (_, s, _) -> s) entries;
+  t.owners <- Array.map (fun (_, _, o) -> o) entries
+
+module Make (S : Backend.REGION_NAMES) = struct
+  (** [refresh ?depth t source] walks [source]'s map and brings the table up
+      to date, returning how many images changed, appeared or went away. *)
+  let refresh ?(depth = 2048) t source =
+    let fresh =
+      S.fold_regions source ~start:0 ~stop:max_int ~depth
+        (fun acc (r : Region.t) ->
+          if r.object_id <> 0 && not r.is_submap then r :: acc else acc)
+        []
+      |> Array.of_list
+    in
+    Array.sort (fun (a : Region.t) b -> Int.compare a.start b.start) fresh;
+    let touched, changed = diff t.regions fresh in
+    let s = t.stats in
+    s.walks <- s.walks + 1;
+    s.mapped <- Array.length fresh;
+    s.changed <- changed;
+    t.regions <- fresh;
+    if Hashtbl.length touched = 0 then (
+      s.regrouped <- 0;
+      0)
+    else
+      let groups = Hashtbl.create (Hashtbl.length touched) in
+      Array.iter
+        (fun (r : Region.t) ->
+          if Hashtbl.mem touched r.object_id then
+            Hashtbl.replace groups r.object_id
+              (r
+              :: Option.value ~default:[]
+                   (Hashtbl.find_opt groups r.object_id)))
+        fresh;
+      (* An object that has gone may have its id reused for another file,
+         and so may one whose segments have all been replaced. *)
+      let previous = Hashtbl.create (Hashtbl.length touched) in
+      Array.iter
+        (fun i ->
+          if Hashtbl.mem touched i.object_id then
+            Hashtbl.replace previous i.object_id i.segments)
+        t.images;
+      Hashtbl.iter
+        (fun id () ->
+          match (Hashtbl.find_opt groups id, Hashtbl.find_opt previous id) with
+          | None, _ -> Hashtbl.remove t.names id
+          | Some segments, Some old
+            when not
+                   (List.exists
+                      (fun r -> Array.exists (same r) old)
+                      segments) ->
+              Hashtbl.remove t.names id
+          | Some _, _ -> ())
+        touched;
+      let kept =
+        Array.to_list t.images
+        |> List.filter (fun i -> not (Hashtbl.mem touched i.object_id))
+      in
+      let rebuilt =
+        Hashtbl.fold
+          (fun id segments acc ->
+            let path =
+              match Hashtbl.find_opt t.names id with
+              | Some path -> path
+              | None ->
+                  let first =
+                    List.fold_left
+                      (fun (a : Region.t) (b : Region.t) ->
+                        if b.start < a.start then b else a)
+                      (List.hd segments) segments
+                  in
+                  let path = S.region_name source first in
+                  s.resolved <- s.resolved + 1;
+                  Hashtbl.replace t.names id path;
+                  path
+            in
+            if path = "" then acc else image_of id path segments :: acc)
+          groups []
+      in
+      let images = Array.of_list (List.rev_append rebuilt kept) in
+      Array.sort (fun a b -> Int.compare a.base b.base) images;
+      t.images <- images;
+      index t;
+      s.regrouped <- Hashtbl.length touched;
+      Hashtbl.length touched
+
+  (** [build ?depth source] is a table of every image [source] has mapped. *)
+  let build ?depth source =
+    let t = create () in
+    ignore (refresh ?depth t source);
+    t
+end
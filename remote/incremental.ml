@@ -0,0 +1,193 @@
+(** Incremental memory snapshots as deltas of changed pages.
+
+    The engine remembers a hash of every page it has seen. On each snapshot it
+    skips regions whose metadata proves them untouched, asks the platform which
+    pages of the remaining regions may have been written, reads only those, and
+    keeps the pages whose hash changed. The first snapshot is a delta against
+    nothing, i.e. every readable page. *)
+
+(** 64-bit multiplicative hash of [len] bytes of [buf] from [off]; [len] must
+    be a multiple of 8. *)
+let hash_page buf off len =
+  let h = ref 0x27d4eb2f165667c5 in
+  let i = ref off in
+  while !i < off + len do
+    h := (!h lxor Decode.get_int buf !i) * 0x100000001b3;
+    h := !h lxor (!h lsr 29);
+    i := !i + 8
+  done;
+  !h
+
+(** Hints for platforms that know nothing: every page is hashed. *)
+module Hash_only = struct
+  type t = unit
+
+  let region_unchanged () ~before:_ ~after:_ = false
+  let dirty_pages () _ _ = false
+  let clear () = ()
+end
+
+type delta = {
+  addresses : int array;  (** Addresses of the changed pages, ascending. *)
+  data : Backend.buffer;  (** Their contents, one page after another. *)
+  removed : int array;
+      (** Pages that were in the last snapshot but are gone. *)
+  pages_read : int;
+  pages_skipped : int;  (** Pages not read thanks to hints. *)
+}
+
+(** Contents of the [i]th changed page of [d]. *)
+let page d page_size i = Bigarray.Array1.sub d.data (i * page_size) page_size
+
+module Make (B : Backend.READER) (D : Backend.DIRTY) = struct
+  type t = {
+    backend : B.t;
+    hints : D.t;
+    page_size : int;
+    chunk_pages : int;
+    buf : Backend.buffer;
+    mutable hashes : (int, int) Hashtbl.t;  (** Page address to hash. *)
+    mutable regions : (int, Region.t) Hashtbl.t;  (** By start address. *)
+  }
+
+  (** [create ?chunk_pages backend hints] reads up to [chunk_pages] dirty pages
+      per backend call (default 64). *)
+  let create ?(chunk_pages = 64) backend hints =
+    let page_size = B.page_size backend in
+    {
+      backend;
+      hints;
+      page_size;
+      chunk_pages;
+      buf = Backend.create_buffer (chunk_pages * page_size);
+      hashes = Hashtbl.create 4096;
+      regions = Hashtbl.create 256;
+    }
+
+  (* Changed pages are appended to a buffer that doubles as it fills. *)
+  type out = {
+    mutable arena : Backend.buffer;
+    mutable addresses : int list;
+    mutable count : int;
+  }
+
+  let append t out address src off =
+    if (out.count + 1) * t.page_size > Bigarray.Array1.dim out.arena then (
+      let size = max t.page_size (2 * Bigarray.Array1.dim out.arena) in
+      let bigger = Backend.create_buffer size in
+      Bigarray.Array1.blit out.arena
+        (Bigarray.Array1.sub bigger 0 (Bigarray.Array1.dim out.arena));
+      out.arena <- bigger);
+    Bigarray.Array1.blit
+      (Bigarray.Array1.sub src off t.page_size)
+      (Bigarray.Array1.sub out.arena (out.count * t.page_size) t.page_size);
+    out.addresses <- address :: out.addresses;
+    out.count <- out.count + 1
+
+  (* Read the [n] pages from [address], all flagged dirty, and keep the ones
+     whose hash moved. Unreadable pages are left out of the new snapshot. *)
+  let read_run t out hashes address n =
+    match B.read t.backend address t.buf 0 (n * t.page_size) with
+    | Error _ -> 0
+    | Ok () ->
+        for i = 0 to n - 1 do
+          let a = address + (i * t.page_size) in
+          let h = hash_page t.buf (i * t.page_size) t.page_size in
+          Hashtbl.replace hashes a h;
+          match Hashtbl.find_opt t.hashes a with
+          | Some old when old = h -> ()
+          | _ -> append t out a t.buf (i * t.page_size)
+        done;
+        n
+
+  (** [snapshot t regions] takes the next snapshot of the readable [regions]
+      and returns what changed since the previous one. *)
+  let snapshot t regions =
+    let hashes = Hashtbl.create (Hashtbl.length t.hashes + 64) in
+    let out = { arena = Backend.create_buffer 0; addresses = []; count = 0 } in
+    let read = ref 0 and skipped = ref 0 in
+    (* Take every region's hints, then start the next interval before any
+       page is read, so a write that lands while pages are being read shows
+       up in the next snapshot instead of being lost. [None] for a region
+       proven untouched, else one flag per page. *)
+    let plans =
+      List.map
+        (fun (r : Region.t) ->
+          let pages = r.size / t.page_size in
+          match Hashtbl.find_opt t.regions r.start with
+          | Some before when D.region_unchanged t.hints ~before ~after:r ->
+              (r, None)
+          | before ->
+              let flags = Bytes.create pages in
+              (* Per-page hints only apply to a region we have seen before. *)
+              if not (before <> None && D.dirty_pages t.hints r flags) then
+                Bytes.fill flags 0 pages '\001';
+              (r, Some flags))
+        regions
+    in
+    D.clear t.hints;
+    let carry a =
+      match Hashtbl.find_opt t.hashes a with
+      | Some h -> Hashtbl.replace hashes a h
+      | None -> ()
+    in
+    List.iter
+      (fun ((r : Region.t), plan) ->
+        let pages = r.size / t.page_size in
+        match plan with
+        | None ->
+            for i = 0 to pages - 1 do
+              carry (r.start + (i * t.page_size))
+            done;
+            skipped := !skipped + pages
+        | Some flags ->
+            let rec go i =
+              if i < pages then
+                if Bytes.get flags i = '\000' then (
+                  carry (r.start + (i * t.page_size));
+                  incr skipped;
+                  go (i + 1))
+                else
+                  let rec run n =
+                    if
+                      n < t.chunk_pages
+                      && i + n < pages
+                      && Bytes.get flags (i + n) <> '\000'
+                    then run (n + 1)
+                    else n
+                  in
+                  let n = run 1 in
+                  read :=
+                    !read
+                    + read_run t out hashes (r.start + (i * t.page_size)) n;
+                  go (i + n)
+            in
+            go 0)
+      plans;
+    let removed =
+      Hashtbl.fold
+        (fun a _ acc -> if Hashtbl.mem hashes a then acc else a :: acc)
+        t.hashes []
+      |> List.sort Int.compare |> Array.of_list
+    in
+    t.hashes <- hashes;
+    let by_start = Hashtbl.create (List.length regions) in
+    List.iter
+      (fun (r : Region.t) -> Hashtbl.replace by_start r.start r)
+      regions;
+    t.regions <- by_start;
+    (* Pages were appended region by region in address order, so reversing
+       the list is enough when regions arrive sorted, as enumerators give
+       them. *)
+    let addresses = Array.of_list (List.rev out.addresses) in
+    {
+      addresses;
+      data = Bigarray.Array1.sub out.arena 0 (out.count * t.page_size);
+      removed;
+      pages_read = !read;
+      pages_skipped = !skipped;
+    }
+
+  (** Number of pages in the current snapshot. *)
+  let pages t = Hashtbl.length t.hashes
+end
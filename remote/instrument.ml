@@ -0,0 +1,382 @@
+(** Call counts, latency histograms and outcome tallies per binding.
+
+    A registry holds one probe per instrumented function. While the registry
+    is disabled, the default, a wrapped call costs one field load and a
+    branch more than the bare call. Once enabled, each call is timed and
+    recorded in the calling domain's own shard of the probe, so domains
+    never contend: a shard is only written by its domain and only summed by
+    {!snapshot}, which may therefore see a call counted but not yet timed.
+
+    Latencies go into log-linear buckets as in HdrHistogram: exact below 16
+    ns, then 16 buckets per power of two, so every value is within 1/16 of
+    its bucket's bounds, up to 2{^47} ns. The default clock only has
+    microsecond resolution; pass a finer one to {!create} where there is
+    one, such as [clock_gettime] or [mach_absolute_time]. *)
+
+let sub_bits = 4
+let sub = 1 lsl sub_bits
+let top = 47
+let buckets = (top - sub_bits + 1) * sub
+
+(* Bucket of [ns]: its highest set bit picks the power of two, the next
+   [sub_bits] bits the bucket within it. *)
+let bucket ns =
+  if ns < sub then max ns 0
+  else
+    let ns = min ns ((1 lsl top) - 1) in
+    let rec msb v k = if v <= 1 then k else msb (v lsr 1) (k + 1) in
+    let e = msb ns 0 in
+    ((e - sub_bits + 1) * sub) + ((ns lsr (e - sub_bits)) land (sub - 1))
+
+(** Smallest value that falls in bucket [i]. *)
+let lower i =
+  if i < sub then i
+  else
+    let e = (i / sub) + sub_bits - 1 in
+    (sub + (i mod sub)) lsl (e - sub_bits)
+
+(** Largest value that falls in bucket [i]. *)
+let upper i = if i + 1 >= buckets then (1 lsl top) - 1 else lower (i + 1) - 1
+
+type shard = {
+  counts : int array;
+  mutable calls : int;
+  mutable errors : int;
+  mutable total : int;  (** Nanoseconds. *)
+  mutable max : int;
+  outcomes : (Backend.error, int) Hashtbl.t;
+      (** Errors by value, under the registry's lock: errors are rare, and
+          unlike the counters a table cannot be read while it grows. *)
+}
+
+let shard () =
+  {
+    counts = Array.make buckets 0;
+    calls = 0;
+    errors = 0;
+    total = 0;
+    max = 0;
+    outcomes = Hashtbl.create 8;
+  }
+
+type t = {
+  mutable on : bool;
+  clock : unit -> int;
+  lock : Pool.lock;
+  probes : (string, probe) Hashtbl.t;
+  mutable order : probe list;  (** Newest first. *)
+}
+
+and probe = {
+  name : string;
+  registry : t;
+  shards : shard list ref;  (** One per domain that has called. *)
+  local : shard Pool.local;
+}
+
+let default_clock () =
+  let base = Unix.gettimeofday () in
+  fun () -> int_of_float ((Unix.gettimeofday () -. base) *. 1e9)
+
+(** [create ?clock ()] is an empty, disabled registry. [clock] returns
+    nanoseconds from any fixed origin. *)
+let create ?(clock = default_clock ()) () =
+  {
+    on = false;
+    clock;
+    lock = Pool.lock ();
+    probes = Hashtbl.create 16;
+    order = [];
+  }
+
+let enable t = t.on <- true
+let disable t = t.on <- false
+let enabled t = t.on
+
+(** [probe t name] is the probe called [name], created on first use. Look
+    probes up once, when wrapping, not per call. *)
+let probe t name =
+  Pool.with_lock t.lock (fun () ->
+      match Hashtbl.find_opt t.probes name with
+      | Some p -> p
+      | None ->
+          let shards = ref [] in
+          let local =
+            Pool.local (fun () ->
+                let s = shard () in
+                Pool.with_lock t.lock (fun () -> shards := s :: !shards);
+                s)
+          in
+          let p = { name; registry = t; shards; local } in
+          Hashtbl.replace t.probes name p;
+          t.order <- p :: t.order;
+          p)
+
+let name p = p.name
+let active p = p.registry.on
+
+let record p ns =
+  let s = Pool.get_local p.local in
+  let b = bucket ns in
+  Array.unsafe_set s.counts b (Array.unsafe_get s.counts b + 1);
+  s.calls <- s.calls + 1;
+  s.total <- s.total + ns;
+  if ns > s.max then s.max <- ns;
+  s
+
+let fail p s e =
+  s.errors <- s.errors + 1;
+  Pool.with_lock p.registry.lock (fun () ->
+      Hashtbl.replace s.outcomes e
+        (1 + Option.value ~default:0 (Hashtbl.find_opt s.outcomes e)))
+
+(** [call p f] runs [f ()] and, while the registry is enabled, records its
+    latency and whether it failed, and with which error. *)
+let call p f =
+  if not p.registry.on then f ()
+  else
+    let t0 = p.registry.clock () in
+    let r = f () in
+    let s = record p (p.registry.clock () - t0) in
+    (match r with Ok _ -> () | Error e -> fail p s e);
+    r
+
+(** [kern p f] is {!call} for a Mach routine returning a [kern_return_t],
+    tallying every value other than [KERN_SUCCESS] as a
+    {!Backend.Kern_return}. *)
+let kern p f =
+  if not p.registry.on then f ()
+  else
+    let t0 = p.registry.clock () in
+    let kr = f () in
+    let s = record p (p.registry.clock () - t0) in
+    if not (Int32.equal kr 0l) then fail p s (Backend.Kern_return kr);
+    kr
+
+(** [time p f] records only the call and its latency, for functions without
+    an outcome to speak of. *)
+let time p f =
+  if not p.registry.on then f ()
+  else
+    let t0 = p.registry.clock () in
+    let r = f () in
+    ignore (record p (p.registry.clock () - t0));
+    r
+
+(** {2 Snapshots} *)
+
+type summary = {
+  probe : string;
+  calls : int;
+  errors : int;
+  total_ns : int;
+  max_ns : int;
+  histogram : int array;  (** Calls per bucket, see {!lower} and {!upper}. *)
+  outcomes : (Backend.error * int) list;  (** Most frequent first. *)
+}
+
+let summarize p =
+  let shards = Pool.with_lock p.registry.lock (fun () -> !(p.shards)) in
+  let histogram = Array.make buckets 0 in
+  let outcomes = Hashtbl.create 8 in
+  let calls, errors, total, max_ns =
+    List.fold_left
+      (fun (calls, errors, total, max_ns) (s : shard) ->
+        Array.iteri (fun i n -> histogram.(i) <- histogram.(i) + n) s.counts;
+        Pool.with_lock p.registry.lock (fun () ->
+            Hashtbl.iter
+              (fun e n ->
+                Hashtbl.replace outcomes e
+                  (n + Option.value ~default:0 (Hashtbl.find_opt outcomes e)))
+              s.outcomes);
+        (calls + s.calls, errors + s.errors, total + s.total, max max_ns s.max))
+      (0, 0, 0, 0) shards
+  in
+  {
+    probe = p.name;
+    calls;
+    errors;
+    total_ns = total;
+    max_ns;
+    histogram;
+    outcomes =
+      Hashtbl.fold (fun e n acc -> (e, n) :: acc) outcomes []
+      |> List.sort (fun (_, a) (_, b) -> Int.compare b a);
+  }
+
+(** Summaries of every probe of [t] that has been called, in the order the
+    probes were created. *)
+let snapshot t =
+  let probes = Pool.with_lock t.lock (fun () -> List.rev t.order) in
+  List.map summarize probes |> List.filter (fun s -> s.calls > 0)
+
+(** Zero every probe of [t]. Calls in flight on other domains may land on
+    either side. *)
+let reset t =
+  let probes = Pool.with_lock t.lock (fun () -> t.order) in
+  List.iter
+    (fun p ->
+      Pool.with_lock t.lock (fun () -> !(p.shards))
+      |> List.iter (fun (s : shard) ->
+             Array.fill s.counts 0 buckets 0;
+             s.calls <- 0;
+             s.errors <- 0;
+             s.total <- 0;
+             s.max <- 0;
+             Pool.with_lock t.lock (fun () -> Hashtbl.reset s.outcomes)))
+    probes
+
+(** [quantile s q] is an upper bound on the latency, in nanoseconds, of the
+    fastest [q] of the calls summarized by [s]. *)
+let quantile s q =
+  let rank = max 1 (int_of_float (Float.ceil (q *. float s.calls))) in
+  let rec go i seen =
+    if i = buckets then s.max_ns
+    else
+      let seen = seen + s.histogram.(i) in
+      if seen >= rank then min (upper i) s.max_ns else go (i + 1) seen
+  in
+  if s.calls = 0 then 0 else go 0 0
+
+let mean s = if s.calls = 0 then 0. else float s.total_ns /. float s.calls
+
+let error_label = function
+  | Backend.Kern_return kr -> Printf.sprintf "kern_return %ld" kr
+  | Backend.Unix_error e -> Unix.error_message e
+  | Backend.Short_transfer _ -> "short transfer"
+
+(* Short transfers of different lengths are one outcome. *)
+let labelled s =
+  List.fold_left
+    (fun acc (e, n) ->
+      let l = error_label e in
+      match List.assoc_opt l acc with
+      | Some m -> (l, m + n) :: List.remove_assoc l acc
+      | None -> (l, n) :: acc)
+    [] s.outcomes
+  |> List.rev
+
+(** One line per probe with the call count, error count and mean, median,
+    99th percentile and worst latency in microseconds, followed by one
+    indented line per kind of error. *)
+let to_text summaries =
+  let b = Buffer.create 1024 in
+  Printf.bprintf b "%-32s %10s %8s %10s %10s %10s %10s\n" "probe" "calls"
+    "errors" "mean_us" "p50_us" "p99_us" "max_us";
+  List.iter
+    (fun s ->
+      let us ns = float ns /. 1e3 in
+      Printf.bprintf b "%-32s %10d %8d %10.2f %10.2f %10.2f %10.2f\n" s.probe
+        s.calls s.errors (mean s /. 1e3)
+        (us (quantile s 0.5))
+        (us (quantile s 0.99))
+        (us s.max_ns);
+      List.iter
+        (fun (l, n) -> Printf.bprintf b "  %-30s %10d\n" l n)
+        (labelled s))
+    summaries;
+  Buffer.contents b
+
+(** The summaries as a JSON array. Histograms list only non-empty buckets,
+    as [[lower, upper, calls]] in nanoseconds. *)
+let to_json summaries =
+  let b = Buffer.create 4096 in
+  Buffer.add_char b '[';
+  List.iteri
+    (fun i s ->
+      if i > 0 then Buffer.add_char b ',';
+      Printf.bprintf b "{\"probe\":%S,\"calls\":%d,\"errors\":%d," s.probe
+        s.calls s.errors;
+      Printf.bprintf b "\"total_ns\":%d,\"max_ns\":%d," s.total_ns s.max_ns;
+      Printf.bprintf b "\"p50_ns\":%d,\"p90_ns\":%d,\"p99_ns\":%d,"
+        (quantile s 0.5) (quantile s 0.9) (quantile s 0.99);
+      Buffer.add_string b "\"outcomes\":{";
+      List.iteri
+        (fun j (l, n) ->
+          if j > 0 then Buffer.add_char b ',';
+          Printf.bprintf b "%S:%d" l n)
+        (labelled s);
+      Buffer.add_string b "},\"histogram\":[";
+      let first = ref true in
+      Array.iteri
+        (fun k n ->
+          if n > 0 then (
+            if not !first then Buffer.add_char b ',';
+            first := false;
+            Printf.bprintf b "[%d,%d,%d]" (lower k) (upper k) n))
+        s.histogram;
+      Buffer.add_string b "]}")
+    summaries;
+  Buffer.add_char b ']';
+  Buffer.contents b
+
+(** {2 Backend wrappers}
+
+    Each wraps a backend so that every call through it is recorded under
+    [prefix ^ "." ^ function], [prefix] defaulting to ["backend"]. The
+    results satisfy the same signature, so they drop in anywhere the bare
+    backend does. *)
+
+module Reader (B : Backend.READER) = struct
+  type t = { backend : B.t; read : probe }
+
+  let create ?(prefix = "backend") registry backend =
+    { backend; read = probe registry (prefix ^ ".read") }
+
+  let backend t = t.backend
+  let page_size t = B.page_size t.backend
+
+  let read t address buf off len =
+    if not t.read.registry.on then B.read t.backend address buf off len
+    else call t.read (fun () -> B.read t.backend address buf off len)
+end
+
+module Writer (W : Backend.WRITER) = struct
+  type t = { backend : W.t; read : probe; write : probe }
+
+  let create ?(prefix = "backend") registry backend =
+    {
+      backend;
+      read = probe registry (prefix ^ ".read");
+      write = probe registry (prefix ^ ".write");
+    }
+
+  let backend t = t.backend
+  let page_size t = W.page_size t.backend
+
+  let read t address buf off len =
+    if not t.read.registry.on then W.read t.backend address buf off len
+    else call t.read (fun () -> W.read t.backend address buf off len)
+
+  let write t address buf off len =
+    if not t.write.registry.on then W.write t.backend address buf off len
+    else call t.write (fun () -> W.write t.backend address buf off len)
+end
+
+(** Region walks are timed whole, since the backend makes its own calls. *)
+module Regions (R : Backend.REGIONS) = struct
+  type t = { backend : R.t; fold : probe }
+
+  let create ?(prefix = "backend") registry backend =
+    { backend; fold = probe registry (prefix ^ ".fold_regions") }
+
+  let backend t = t.backend
+
+  let fold_regions t ~start ~stop ~depth f acc =
+    time t.fold (fun () -> R.fold_regions t.backend ~start ~stop ~depth f acc)
+
+  let regions t ~start ~stop ~depth = R.regions t.backend ~start ~stop ~depth
+end
+
+module Threads (T : Backend.THREADS) = struct
+  type t = { backend : T.t; sample : probe }
+
+  let create ?(prefix = "backend") registry backend =
+    { backend; sample = probe registry (prefix ^ ".sample") }
+
+  let backend t = t.backend
+
+  let sample t f =
+    if not t.sample.registry.on then T.sample t.backend f
+    else call t.sample (fun () -> T.sample t.backend f)
+end
@@ -0,0 +1,193 @@
+(** Streaming parser for Linux [/proc/<pid>/maps] listings.
+
+    Produces the same {!Region.t} records as the Mach enumerator, plus the
+    mapped path, so region tools can run against a live Linux process or a
+    recorded map on any platform. Lines are parsed in place without [Scanf] or
+    splitting. *)
+
+type cursor = { line : string; mutable pos : int }
+
+let hex_digit = function
+  | '0' .. '9' as c -> Char.code c - 48
+  | 'a' .. 'f' as c -> Char.code c - 87
+  | 'A' .. 'F' as c -> Char.code c - 55
+  | _ -> -1
+
+(* Hex number at the cursor, or [-1] if it does not fit in an [int]: the
+   vsyscall page lives at the top of the 64-bit address space. *)
+let hex c =
+  let len = String.length c.line in
+  let rec go v =
+    if c.pos >= len then v
+    else
+      let d = hex_digit (String.unsafe_get c.line c.pos) in
+      if d < 0 then v
+      else (
+        c.pos <- c.pos + 1;
+        if v < 0 || v > max_int lsr 4 then go (-1) else go ((v lsl 4) lor d))
+  in
+  go 0
+
+let decimal c =
+  let len = String.length c.line in
+  let rec go v =
+    if c.pos < len then
+      match String.unsafe_get c.line c.pos with
+      | '0' .. '9' as ch ->
+          c.pos <- c.pos + 1;
+          go ((v * 10) + Char.code ch - 48)
+      | _ -> v
+    else v
+  in
+  go 0
+
+let skip c ch =
+  if c.pos < String.length c.line && String.unsafe_get c.line c.pos = ch then (
+    c.pos <- c.pos + 1;
+    true)
+  else false
+
+let rec skip_spaces c = if skip c ' ' then skip_spaces c
+
+let flag c i ch bit =
+  if String.unsafe_get c.line (c.pos + i) = ch then bit else 0
+
+(* splitmix64's finalizer with its multipliers cut to 63 bits. Every step
+   is a bijection of [int]. *)
+let mix x =
+  let x = (x lxor (x lsr 30)) * 0x3f58476d1ce4e5b9 in
+  let x = (x lxor (x lsr 27)) * 0x14d049bb133111eb in
+  x lxor (x lsr 31)
+
+(* A device and an inode do not fit one int together, so they are hashed
+   into a nonzero id. Inodes of the same device only collide if one of them
+   hashes to 0. *)
+let file_id dev inode =
+  match mix (mix dev lxor inode) with 0 -> 1 | id -> id
+
+(** [parse_line line] is the region and path described by one maps line, or
+    [None] if the line is malformed or lies outside the [int] address range. *)
+let parse_line line =
+  let c = { line; pos = 0 } in
+  let start = hex c in
+  let ok = skip c '-' in
+  let stop = hex c in
+  if (not ok) || start < 0 || stop < start || not (skip c ' ') then None
+  else if c.pos + 4 > String.length line then None
+  else
+    let protection =
+      flag c 0 'r' Region.prot_read
+      lor flag c 1 'w' Region.prot_write
+      lor flag c 2 'x' Region.prot_execute
+    in
+    let shared = String.unsafe_get line (c.pos + 3) = 's' in
+    c.pos <- c.pos + 4;
+    skip_spaces c;
+    let offset = hex c in
+    skip_spaces c;
+    let major = hex c in
+    ignore (skip c ':');
+    let minor = hex c in
+    skip_spaces c;
+    let inode = decimal c in
+    skip_spaces c;
+    let path =
+      if c.pos >= String.length line then ""
+      else String.sub line c.pos (String.length line - c.pos)
+    in
+    (* There is no object id on Linux; the device and inode identify the
+       backing file, and anonymous memory has inode 0. *)
+    let object_id =
+      if inode = 0 then 0 else file_id ((major lsl 20) lor minor) inode
+    in
+    let share_mode =
+      if shared then Region.sm_shared
+      else if inode = 0 then Region.sm_private
+      else Region.sm_cow
+    in
+    Some
+      ( Region.make ~start ~size:(stop - start) ~protection ~share_mode
+          ~offset:(max offset 0) ~object_id,
+        path )
+
+(** [fold_channel ?start ?stop ic f acc] folds [f acc region path] over the
+    regions read from [ic] that overlap [start, stop). Lines are consumed one
+    at a time. *)
+let fold_channel ?(start = 0) ?(stop = max_int) ic f acc =
+  let rec loop acc =
+    match In_channel.input_line ic with
+    | None -> acc
+    | Some line -> (
+        match parse_line line with
+        | Some (r, _) when Region.stop r <= start -> loop acc
+        | Some (r, _) when r.Region.start >= stop -> acc
+        | Some (r, path) -> loop (f acc r path)
+        | None -> loop acc)
+  in
+  loop acc
+
+(** Regions of [ic] overlapping [start, stop) as an on-demand sequence. The
+    channel is read as the sequence is consumed and is not closed. *)
+let seq_channel ?(start = 0) ?(stop = max_int) ic =
+  let rec next () =
+    match In_channel.input_line ic with
+    | None -> Seq.Nil
+    | Some line -> (
+        match parse_line line with
+        | Some (r, _) when Region.stop r <= start -> next ()
+        | Some (r, _) when r.Region.start >= stop -> Seq.Nil
+        | Some (r, path) -> Seq.Cons ((r, path), next)
+        | None -> next ())
+  in
+  next
+
+(** [fold_file ?start ?stop path f acc] is {!fold_channel} over the file at
+    [path], e.g. [/proc/<pid>/maps] or a recorded copy of one. *)
+let fold_file ?start ?stop path f acc =
+  In_channel.with_open_text path (fun ic -> fold_channel ?start ?stop ic f acc)
+
+let path_of_pid pid = Printf.sprintf "/proc/%d/maps" pid
+
+(** A recorded maps file as a {!Backend.NAMED_REGIONS}. The file is rescanned
+    on every query. *)
+module Recorded = struct
+  type t = string
+
+  let fold_named_regions path ~start ~stop ~depth:_ f acc =
+    fold_file ~start ~stop path f acc
+
+  let fold_regions path ~start ~stop ~depth f acc =
+    fold_named_regions path ~start ~stop ~depth (fun acc r _ -> f acc r) acc
+
+  (* A sequence over the open file would keep its channel open for as long
+     as the caller holds on to it, so the regions are read when the
+     sequence is first forced and the file is closed straight away. *)
+  let regions path ~start ~stop ~depth:_ () =
+    List.to_seq
+      (List.rev (fold_file ~start ~stop path (fun acc r _ -> r :: acc) []))
+      ()
+end
+
+(** A maps file as a {!Backend.REGION_NAMES}. Paths come with every line, so
+    each walk keeps those of file-backed regions for {!region_name} rather
+    than reading the file again. *)
+module Tracked = struct
+  type t = { path : string; names : (int, string) Hashtbl.t }
+
+  let create path = { path; names = Hashtbl.create 256 }
+
+  let fold_regions t ~start ~stop ~depth:_ f acc =
+    if start = 0 && stop = max_int then Hashtbl.reset t.names;
+    fold_file ~start ~stop t.path
+      (fun acc r name ->
+        if r.Region.object_id <> 0 then
+          Hashtbl.replace t.names r.Region.start name;
+        f acc r)
+      acc
+
+  let regions t ~start ~stop ~depth =
+    Recorded.regions t.path ~start ~stop ~depth
+
+  let region_name t (r : Region.t) =
+    Option.value ~default:"" (Hashtbl.find_opt t.names r.start)
+end
@@ -0,0 +1,165 @@
+(** Rounds of resource usage collection over many tasks.
+
+    A round hands the targets out to workers on a {!Pool} through a shared
+    counter, so a slow task only holds up the worker collecting it while the
+    others carry on with the rest. Each worker reuses its own collector
+    buffers and writes into per-target records allocated once.
+
+    Every task gets [task_deadline] seconds, and the round as a whole
+    [round_deadline]: once that has passed, targets not yet started are
+    skipped. A task that times out is left alone for the next [backoff]
+    rounds so that it cannot eat into every round.
+
+    Deadlines are only checked between kernel calls, which cannot be
+    cancelled, and a round waits for every worker. A call that blocks
+    therefore holds up the round past [round_deadline] until it returns. *)
+
+type status = Collected | Failed | Timed_out | Skipped
+
+type round = {
+  collected : int;
+  failed : int;
+  timed_out : int;
+  skipped : int;
+  threads : int;  (** Over collected tasks. *)
+  cpu_time : int;  (** User and system microseconds, collected tasks. *)
+  cpu_delta : int;
+      (** CPU microseconds used since the previous round by the tasks
+          collected in both. *)
+  resident : int;  (** Bytes, collected tasks. *)
+  elapsed : float;  (** Seconds. *)
+}
+
+module Make (S : Backend.TASKS) = struct
+  type t = {
+    source : S.t;
+    domains : int;
+    workers : S.worker array;
+    task_deadline : float;
+    round_deadline : float;
+    backoff : int;
+    mutable targets : int array;
+    mutable stats : Backend.task_stats array;
+    mutable status : status array;
+    mutable last_cpu : int array;  (** CPU time when last collected, or -1. *)
+    mutable quiet : int array;  (** Rounds left to skip a timed out task. *)
+  }
+
+  (** [create ?domains ?task_deadline ?round_deadline ?backoff source]
+      collects on [domains] workers (default {!Pool.recommended}), giving
+      each task [task_deadline] seconds (default 0.05) and each round
+      [round_deadline] (default 1). *)
+  let create ?(domains = Pool.recommended ()) ?(task_deadline = 0.05)
+      ?(round_deadline = 1.) ?(backoff = 10) source =
+    {
+      source;
+      domains;
+      workers = Array.init domains (fun _ -> S.worker source);
+      task_deadline;
+      round_deadline;
+      backoff;
+      targets = [||];
+      stats = [||];
+      status = [||];
+      last_cpu = [||];
+      quiet = [||];
+    }
+
+  (** [set_targets t targets] replaces the monitored tasks. Targets kept
+      from the previous set keep their history. *)
+  let set_targets t targets =
+    let old = Hashtbl.create (Array.length t.targets) in
+    Array.iteri (fun i task -> Hashtbl.replace old task i) t.targets;
+    let keep f default =
+      Array.map
+        (fun task ->
+          match Hashtbl.find_opt old task with
+          | Some i -> f i
+          | None -> default ())
+        targets
+    in
+    let stats = keep (fun i -> t.stats.(i)) Backend.task_stats in
+    let last_cpu = keep (fun i -> t.last_cpu.(i)) (fun () -> -1) in
+    let quiet = keep (fun i -> t.quiet.(i)) (fun () -> 0) in
+    t.targets <- Array.copy targets;
+    t.stats <- stats;
+    t.status <- Array.make (Array.length targets) Skipped;
+    t.last_cpu <- last_cpu;
+    t.quiet <- quiet
+
+  let collect_one t worker start i =
+    let now = Unix.gettimeofday () in
+    if t.quiet.(i) > 0 then (
+      t.quiet.(i) <- t.quiet.(i) - 1;
+      Skipped)
+    else if now -. start > t.round_deadline then Skipped
+    else
+      let deadline =
+        Float.min (now +. t.task_deadline) (start +. t.round_deadline)
+      in
+      match S.collect worker t.targets.(i) ~deadline t.stats.(i) with
+      | Ok () -> Collected
+      | Error (Backend.Unix_error Unix.ETIMEDOUT) ->
+          t.quiet.(i) <- t.backoff;
+          Timed_out
+      | Error _ -> Failed
+
+  (** [round t] collects every target once and summarises the round. It
+      returns when the last worker has finished its current task. *)
+  let round t =
+    let n = Array.length t.targets in
+    let next = Atomic.make 0 in
+    let start = Unix.gettimeofday () in
+    let work w =
+      let worker = t.workers.(w) in
+      let rec loop () =
+        let i = Atomic.fetch_and_add next 1 in
+        if i < n then (
+          t.status.(i) <- collect_one t worker start i;
+          loop ())
+      in
+      loop ()
+    in
+    ignore (Pool.run t.domains work);
+    let collected = ref 0 and failed = ref 0 and timed_out = ref 0 in
+    let threads = ref 0 and cpu = ref 0 and delta = ref 0 in
+    let resident = ref 0 in
+    for i = 0 to n - 1 do
+      match t.status.(i) with
+      | Collected ->
+          let s = t.stats.(i) in
+          let used = s.user_time + s.system_time in
+          incr collected;
+          threads := !threads + s.threads;
+          cpu := !cpu + used;
+          resident := !resident + s.resident;
+          if t.last_cpu.(i) >= 0 then
+            delta := !delta + max 0 (used - t.last_cpu.(i));
+          t.last_cpu.(i) <- used
+      | Failed ->
+          incr failed;
+          t.last_cpu.(i) <- -1
+      | Timed_out -> incr timed_out
+      | Skipped -> ()
+    done;
+    {
+      collected = !collected;
+      failed = !failed;
+      timed_out = !timed_out;
+      skipped = n - !collected - !failed - !timed_out;
+      threads = !threads;
+      cpu_time = !cpu;
+      cpu_delta = !delta;
+      resident = !resident;
+      elapsed = Unix.gettimeofday () -. start;
+    }
+
+  let length t = Array.length t.targets
+  let target t i = t.targets.(i)
+
+  (** What the last round got for the [i]th target, whose [stats] are only
+      current when it was [Collected]. *)
+  let status t i = t.status.(i)
+
+  let stats t i = t.stats.(i)
+end
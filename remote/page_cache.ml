@@ -0,0 +1,243 @@
+(** Page-granular LRU cache over a {!Backend.READER}.
+
+    Whole target pages are kept in a single off-heap arena, so a debugger that
+    reads a few bytes at a time only pays for a kernel call on a miss. A miss
+    also fetches up to [prefetch] following pages in the same call, which turns
+    a sequential walk into one call per [prefetch + 1] pages.
+
+    The cache cannot tell when the target runs or is written to. Callers must
+    {!invalidate} it on every resume and {!invalidate_range} after writing
+    target memory.
+
+    A cache is not safe to share between domains. *)
+
+let log2 n =
+  let rec go k = if 1 lsl k >= n then k else go (k + 1) in
+  go 0
+
+module Make (B : Backend.READER) = struct
+  type t = {
+    backend : B.t;
+    page_size : int;
+    page_shift : int;
+    capacity : int;  (** Number of page slots in [arena]. *)
+    prefetch : int;  (** Extra pages fetched after a miss. *)
+    arena : Backend.buffer;
+    scratch : Backend.buffer;  (** Landing area for a fetch. *)
+    word : Bytes.t;
+    slot_page : int array;  (** Page number held by each slot, or [-1]. *)
+    prev : int array;  (** LRU links between slots, [-1] terminated. *)
+    next : int array;
+    table : (int, int) Hashtbl.t;  (** Page number to slot. *)
+    mutable head : int;  (** Most recently used slot. *)
+    mutable tail : int;  (** Least recently used slot, the next victim. *)
+    mutable used : int;  (** Slots handed out since the last {!invalidate}. *)
+    mutable hit_count : int;
+    mutable miss_count : int;
+    mutable fetch_count : int;
+  }
+
+  type stats = {
+    hits : int;  (** Page lookups served from the cache. *)
+    misses : int;  (** Page lookups that needed a fetch. *)
+    fetches : int;  (** Calls made to the backend. *)
+    resident : int;  (** Pages currently cached. *)
+  }
+
+  (** [create ?capacity ?prefetch backend] caches up to [capacity] pages of
+      [backend] (default 256) and fetches [prefetch] pages (default 1) after
+      every missed page. *)
+  let create ?(capacity = 256) ?(prefetch = 1) backend =
+    if capacity < 1 then invalid_arg "Page_cache.create: capacity";
+    if prefetch < 0 then invalid_arg "Page_cache.create: prefetch";
+    let page_size = B.page_size backend in
+    if page_size <= 0 || page_size land (page_size - 1) <> 0 then
+      invalid_arg "Page_cache.create: page size is not a power of two";
+    let prefetch = min prefetch (capacity - 1) in
+    {
+      backend;
+      page_size;
+      page_shift = log2 page_size;
+      capacity;
+      prefetch;
+      arena = Backend.create_buffer (capacity * page_size);
+      scratch = Backend.create_buffer ((prefetch + 1) * page_size);
+      word = Bytes.create 8;
+      slot_page = Array.make capacity (-1);
+      prev = Array.make capacity (-1);
+      next = Array.make capacity (-1);
+      table = Hashtbl.create capacity;
+      head = -1;
+      tail = -1;
+      used = 0;
+      hit_count = 0;
+      miss_count = 0;
+      fetch_count = 0;
+    }
+
+  let backend t = t.backend
+  let page_size t = t.page_size
+
+  let unlink t s =
+    let p = t.prev.(s) and n = t.next.(s) in
+    if p >= 0 then t.next.(p) <- n else t.head <- n;
+    if n >= 0 then t.prev.(n) <- p else t.tail <- p;
+    t.prev.(s) <- -1;
+    t.next.(s) <- -1
+
+  let push_front t s =
+    t.prev.(s) <- -1;
+    t.next.(s) <- t.head;
+    if t.head >= 0 then t.prev.(t.head) <- s else t.tail <- s;
+    t.head <- s
+
+  let push_back t s =
+    t.next.(s) <- -1;
+    t.prev.(s) <- t.tail;
+    if t.tail >= 0 then t.next.(t.tail) <- s else t.head <- s;
+    t.tail <- s
+
+  let take_slot t =
+    if t.used < t.capacity then (
+      let s = t.used in
+      t.used <- s + 1;
+      s)
+    else
+      let s = t.tail in
+      unlink t s;
+      if t.slot_page.(s) >= 0 then Hashtbl.remove t.table t.slot_page.(s);
+      t.slot_page.(s) <- -1;
+      s
+
+  let install t page off =
+    let s = take_slot t in
+    Bigarray.Array1.blit
+      (Bigarray.Array1.sub t.scratch off t.page_size)
+      (Bigarray.Array1.sub t.arena (s lsl t.page_shift) t.page_size);
+    t.slot_page.(s) <- page;
+    Hashtbl.replace t.table page s;
+    push_front t s;
+    s
+
+  let fetch_pages t page n =
+    t.fetch_count <- t.fetch_count + 1;
+    B.read t.backend (page lsl t.page_shift) t.scratch 0 (n lsl t.page_shift)
+
+  let fetch t page =
+    t.miss_count <- t.miss_count + 1;
+    (* Only extend over pages that are not already cached, and fall back to
+       the single page if the extension runs into unmapped memory. *)
+    let rec extent n =
+      if n > t.prefetch || Hashtbl.mem t.table (page + n) then n
+      else extent (n + 1)
+    in
+    let n = extent 1 in
+    let fetched =
+      match fetch_pages t page n with
+      | Ok () -> Ok n
+      | Error _ when n > 1 -> (
+          match fetch_pages t page 1 with Ok () -> Ok 1 | Error e -> Error e)
+      | Error e -> Error e
+    in
+    match fetched with
+    | Error e -> Error e
+    | Ok n ->
+        (* The demanded page goes in last so it ends up most recently used. *)
+        for i = n - 1 downto 1 do
+          ignore (install t (page + i) (i lsl t.page_shift))
+        done;
+        Ok (install t page 0)
+
+  let slot t page =
+    match Hashtbl.find_opt t.table page with
+    | Some s ->
+        t.hit_count <- t.hit_count + 1;
+        if t.head <> s then (
+          unlink t s;
+          push_front t s);
+        Ok s
+    | None -> fetch t page
+
+  (** [read_into t address dst off len] copies [len] bytes of target memory
+      starting at [address] into [dst] at [off]. *)
+  let read_into t address dst off len =
+    if off < 0 || len < 0 || off > Bytes.length dst - len then
+      invalid_arg "Page_cache.read_into";
+    let rec loop address off len =
+      if len = 0 then Ok ()
+      else
+        let in_page = address land (t.page_size - 1) in
+        let n = min len (t.page_size - in_page) in
+        match slot t (address lsr t.page_shift) with
+        | Error e -> Error e
+        | Ok s ->
+            let base = (s lsl t.page_shift) + in_page in
+            for i = 0 to n - 1 do
+              Bytes.unsafe_set dst (off + i)
+                (Bigarray.Array1.unsafe_get t.arena (base + i))
+            done;
+            loop (address + n) (off + n) (len - n)
+    in
+    loop address off len
+
+  (** [read t address len] returns [len] bytes of target memory. *)
+  let read t address len =
+    let dst = Bytes.create len in
+    match read_into t address dst 0 len with
+    | Ok () -> Ok dst
+    | Error e -> Error e
+
+  (** Little-endian 64-bit word at [address], the common case for pointer
+      chasing. *)
+  let read_int64 t address =
+    match read_into t address t.word 0 8 with
+    | Ok () -> Ok (Bytes.get_int64_le t.word 0)
+    | Error e -> Error e
+
+  (** Forget every cached page. Call this whenever the target has run. *)
+  let invalidate t =
+    Hashtbl.reset t.table;
+    Array.fill t.slot_page 0 t.capacity (-1);
+    Array.fill t.prev 0 t.capacity (-1);
+    Array.fill t.next 0 t.capacity (-1);
+    t.head <- -1;
+    t.tail <- -1;
+    t.used <- 0
+
+  let drop t s =
+    Hashtbl.remove t.table t.slot_page.(s);
+    t.slot_page.(s) <- -1;
+    (* Park the empty slot where it will be reused first. *)
+    unlink t s;
+    push_back t s
+
+  (** Forget the cached pages overlapping [address, address + len). Call this
+      after writing target memory. *)
+  let invalidate_range t address len =
+    if len > 0 then
+      let first = address lsr t.page_shift
+      and last = (address + len - 1) lsr t.page_shift in
+      if last - first >= Hashtbl.length t.table then
+        Array.iteri
+          (fun s page -> if page >= first && page <= last then drop t s)
+          t.slot_page
+      else
+        for page = first to last do
+          match Hashtbl.find_opt t.table page with
+          | Some s -> drop t s
+          | None -> ()
+        done
+
+  let stats t =
+    {
+      hits = t.hit_count;
+      misses = t.miss_count;
+      fetches = t.fetch_count;
+      resident = Hashtbl.length t.table;
+    }
+
+  let reset_stats t =
+    t.hit_count <- 0;
+    t.miss_count <- 0;
+    t.fetch_count <- 0
+end
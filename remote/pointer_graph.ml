@@ -0,0 +1,335 @@
+(** Conservative reference graph of target memory, for finding leaks.
+
+    Mapped memory is cut into fixed size blocks, the nodes of the graph.
+    Every aligned word of every writable region is read as a possible
+    pointer, and each one that lands inside a mapped region adds an edge from
+    the block holding it to the block it points into. Anything not reachable
+    from the roots, thread registers and stacks, is leaked or only kept alive
+    by other leaked memory.
+
+    Writable memory is scanned in chunks that worker domains claim from a
+    shared counter, as in {!Scanner}. Each worker appends edges to its own
+    flat array; they are then laid out as compressed sparse rows, one
+    [offsets] array indexed by node and one [edges] array of targets, so a
+    graph of millions of nodes is two [int array]s. *)
+
+type t = {
+  shift : int;  (** log2 of the block size. *)
+  starts : int array;  (** Region starts, sorted. *)
+  stops : int array;
+  bases : int array;  (** Node of each region's first block. *)
+  regions : Region.t array;
+  nodes : int;
+  offsets : int array;
+      (** Edges of node [n] are [edges.(offsets.(n))] up to, excluding,
+          [edges.(offsets.(n + 1))]. *)
+  edges : int array;
+}
+
+type stats = {
+  bytes : int;  (** Bytes scanned. *)
+  chunks : int;
+  errors : int;  (** Chunks that could not be read and were skipped. *)
+  words : int;  (** Words that pointed into mapped memory. *)
+}
+
+let add a b =
+  {
+    bytes = a.bytes + b.bytes;
+    chunks = a.chunks + b.chunks;
+    errors = a.errors + b.errors;
+    words = a.words + b.words;
+  }
+
+let zero = { bytes = 0; chunks = 0; errors = 0; words = 0 }
+let nodes t = t.nodes
+let length t = Array.length t.edges
+let block_size t = 1 lsl t.shift
+
+(* Index of the last region starting at or before [address], or [-1]. *)
+let floor t address =
+  let starts = t.starts in
+  let rec go lo hi =
+    if hi - lo <= 1 then lo
+    else
+      let mid = (lo + hi) lsr 1 in
+      if Array.unsafe_get starts mid <= address then go mid hi else go lo mid
+  in
+  go (-1) (Array.length starts)
+
+(** [node t address] is the block holding [address], or [-1] if it is not
+    mapped. *)
+let node t address =
+  let i = floor t address in
+  if i < 0 || address >= Array.unsafe_get t.stops i then -1
+  else Array.unsafe_get t.bases i + ((address - t.starts.(i)) lsr t.shift)
+
+(* Index of the region holding [node]. *)
+let region_of t node =
+  let rec go lo hi =
+    if hi - lo <= 1 then lo
+    else
+      let mid = (lo + hi) lsr 1 in
+      if t.bases.(mid) <= node then go mid hi else go lo mid
+  in
+  go 0 (Array.length t.bases)
+
+let region t node = t.regions.(region_of t node)
+
+(** First address of [node]. *)
+let address t node =
+  let i = region_of t node in
+  t.starts.(i) + ((node - t.bases.(i)) lsl t.shift)
+
+(** [iter_edges t node f] calls [f] on every block [node] points into, each
+    once, in increasing order. *)
+let iter_edges t node f =
+  for k = t.offsets.(node) to t.offsets.(node + 1) - 1 do
+    f (Array.unsafe_get t.edges k)
+  done
+
+(* Growable array of (source, target) pairs, one per worker. *)
+type pairs = { mutable data : int array; mutable len : int }
+
+let push p src dst =
+  if p.len + 2 > Array.length p.data then (
+    let data = Array.make (2 * Array.length p.data) 0 in
+    Array.blit p.data 0 data 0 p.len;
+    p.data <- data);
+  Array.unsafe_set p.data p.len src;
+  Array.unsafe_set p.data (p.len + 1) dst;
+  p.len <- p.len + 2
+
+(* Lay the pairs of every worker out as rows, sorted and without duplicates
+   within each row. *)
+let compress t pairs =
+  let degree = Array.make (t.nodes + 1) 0 in
+  Array.iter
+    (fun p ->
+      let rec go k =
+        if k < p.len then (
+          let s = p.data.(k) in
+          degree.(s + 1) <- degree.(s + 1) + 1;
+          go (k + 2))
+      in
+      go 0)
+    pairs;
+  for n = 1 to t.nodes do
+    degree.(n) <- degree.(n) + degree.(n - 1)
+  done;
+  let fill = Array.sub degree 0 t.nodes in
+  let edges = Array.make degree.(t.nodes) 0 in
+  Array.iter
+    (fun p ->
+      let rec go k =
+        if k < p.len then (
+          let s = p.data.(k) in
+          edges.(fill.(s)) <- p.data.(k + 1);
+          fill.(s) <- fill.(s) + 1;
+          go (k + 2))
+      in
+      go 0)
+    pairs;
+  (* Sort each row and squeeze out repeats, moving rows down in place. *)
+  let offsets = Array.make (t.nodes + 1) 0 in
+  let out = ref 0 in
+  for n = 0 to t.nodes - 1 do
+    let lo = degree.(n) and hi = degree.(n + 1) in
+    offsets.(n) <- !out;
+    if hi > lo then (
+      let row = Array.sub edges lo (hi - lo) in
+      Array.sort Int.compare row;
+      Array.iteri
+        (fun i e ->
+          if i = 0 || e <> row.(i - 1) then (
+            edges.(!out) <- e;
+            incr out))
+        row)
+  done;
+  offsets.(t.nodes) <- !out;
+  { t with offsets; edges = Array.sub edges 0 !out }
+
+(** Regions scanned for pointers: readable and writable. *)
+let scanned (r : Region.t) = Region.readable r && Region.writable r
+
+module Make (B : Backend.READER) = struct
+  (** [build ?domains ?chunk_size ?block ~reader regions] scans every
+      {!scanned} region of [regions] for pointers into any of them, with
+      [block] byte nodes (default 4096, a power of two). [reader] is called
+      once per worker to open that worker's own backend. Regions need not be
+      sorted but must not overlap. *)
+  let build ?(domains = Pool.recommended ()) ?(chunk_size = 1 lsl 20)
+      ?(block = 4096) ~reader regions =
+    if block < 8 || block land (block - 1) <> 0 then
+      invalid_arg "Pointer_graph.build: block";
+    let chunk_size = chunk_size land lnot 7 in
+    let regions =
+      List.filter (fun (r : Region.t) -> r.size > 0) regions |> Array.of_list
+    in
+    Array.sort (fun (a : Region.t) b -> Int.compare a.start b.start) regions;
+    let shift =
+      let rec go k = if 1 lsl k >= block then k else go (k + 1) in
+      go 0
+    in
+    let bases = Array.make (Array.length regions) 0 in
+    let nodes =
+      Array.fold_left
+        (fun (i, n) (r : Region.t) ->
+          bases.(i) <- n;
+          (i + 1, n + ((r.size + block - 1) lsr shift)))
+        (0, 0) regions
+      |> snd
+    in
+    let t =
+      {
+        shift;
+        starts = Array.map (fun (r : Region.t) -> r.start) regions;
+        stops = Array.map Region.stop regions;
+        bases;
+        regions;
+        nodes;
+        offsets = [||];
+        edges = [||];
+      }
+    in
+    let low = if nodes = 0 then 0 else t.starts.(0) in
+    let high = if nodes = 0 then 0 else t.stops.(Array.length regions - 1) in
+    let work =
+      Array.to_list regions |> List.filter scanned
+      |> List.concat_map (fun (r : Region.t) ->
+             let stop = Region.stop r in
+             let rec chunks address acc =
+               if address >= stop then List.rev acc
+               else
+                 let len = min chunk_size (stop - address) in
+                 chunks (address + len) ((address, len) :: acc)
+             in
+             chunks r.start [])
+      |> Array.of_list
+    in
+    let next = Atomic.make 0 in
+    let worker _ =
+      let backend = reader () in
+      let buf = Backend.create_buffer chunk_size in
+      let pairs = { data = Array.make 4096 0; len = 0 } in
+      let stats = ref zero in
+      let rec loop () =
+        let i = Atomic.fetch_and_add next 1 in
+        if i < Array.length work then (
+          let address, len = work.(i) in
+          (match B.read backend address buf 0 len with
+          | Error _ -> stats := add !stats { zero with chunks = 1; errors = 1 }
+          | Ok () ->
+              let words = ref 0 in
+              (* Consecutive words of a block often point into the same
+                 block; only record the first of a run. *)
+              let last_src = ref (-1) and last_dst = ref (-1) in
+              for w = 0 to (len lsr 3) - 1 do
+                let v = Decode.get_int buf (w lsl 3) in
+                if v >= low && v < high then
+                  let dst = node t v in
+                  if dst >= 0 then (
+                    incr words;
+                    let src = node t (address + (w lsl 3)) in
+                    if src <> !last_src || dst <> !last_dst then (
+                      push pairs src dst;
+                      last_src := src;
+                      last_dst := dst))
+              done;
+              stats :=
+                add !stats
+                  { bytes = len; chunks = 1; errors = 0; words = !words });
+          loop ())
+      in
+      loop ();
+      (pairs, !stats)
+    in
+    let results = Pool.run domains worker in
+    let graph = compress t (Array.map fst results) in
+    (graph, Array.fold_left (fun acc (_, s) -> add acc s) zero results)
+end
+
+(** [reachable ?ranges t roots] marks with ['\001'] every node reachable
+    from a root: the node of each address in [roots], such as register
+    values, and every node overlapping an [(address, len)] of [ranges], such
+    as stacks. *)
+let reachable ?(ranges = []) t roots =
+  let marks = Bytes.make t.nodes '\000' in
+  let queue = Array.make (max 1 t.nodes) 0 in
+  let tail = ref 0 in
+  let visit n =
+    if n >= 0 && Bytes.unsafe_get marks n = '\000' then (
+      Bytes.unsafe_set marks n '\001';
+      queue.(!tail) <- n;
+      incr tail)
+  in
+  Array.iter (fun a -> visit (node t a)) roots;
+  List.iter
+    (fun (address, len) ->
+      let a = ref address in
+      while !a < address + len do
+        visit (node t !a);
+        a := (!a land lnot (block_size t - 1)) + block_size t
+      done)
+    ranges;
+  let head = ref 0 in
+  while !head < !tail do
+    let n = queue.(!head) in
+    incr head;
+    iter_edges t n visit
+  done;
+  marks
+
+(** [fold_unreachable ?candidate t marks f acc] folds [f] over the address
+    of every node left unmarked by {!reachable} in regions satisfying
+    [candidate] (default: the {!scanned} ones). Pass a test for heap regions
+    to leave out stacks and globals, which are only pointed to from the
+    outside when something holds their address. *)
+let fold_unreachable ?(candidate = scanned) t marks f acc =
+  let acc = ref acc in
+  Array.iteri
+    (fun i (r : Region.t) ->
+      if candidate r then
+        let blocks = (r.size + block_size t - 1) lsr t.shift in
+        for b = 0 to blocks - 1 do
+          if Bytes.get marks (t.bases.(i) + b) = '\000' then
+            acc := f !acc (r.start + (b lsl t.shift))
+        done)
+    t.regions;
+  !acc
+
+(** Roots of a target from its threads' registers and stacks. *)
+module Roots (S : Backend.THREAD_STATES) = struct
+  (** [collect states ~sp t] stops the target, reads the general registers
+      of every thread and resumes it. Every 8-byte word of those registers
+      is a root address, as any of them may hold the only pointer to a
+      block, and the part of each stack region from the stack pointer up is
+      a root range. [sp] is the byte offset of the stack pointer in the
+      platform's general register set. *)
+  let collect states ~sp t =
+    match S.stop states with
+    | Error e -> Error e
+    | Ok threads ->
+        let buf =
+          Backend.create_buffer (S.state_size states Backend.General)
+        in
+        let addresses = ref [] and ranges = ref [] in
+        Array.iter
+          (fun thread ->
+            (* A thread that has exited since the stop has no roots. *)
+            match S.get_state states thread Backend.General buf 0 with
+            | Error _ -> ()
+            | Ok len ->
+                for w = 0 to (len / 8) - 1 do
+                  addresses := Decode.get_int buf (w * 8) :: !addresses
+                done;
+                if sp + 8 <= len then
+                  let v = Decode.get_int buf sp in
+                  let i = floor t v in
+                  if i >= 0 && v < t.stops.(i) then
+                    ranges := (v, t.stops.(i) - v) :: !ranges)
+          threads;
+        Result.map
+          (fun () -> (Array.of_list !addresses, !ranges))
+          (S.resume states)
+end
@@ -0,0 +1,68 @@
+(** [proc_bsdshortinfo] from `sys/proc_info.h`, as returned by
+    [proc_pidinfo] with [PROC_PIDT_SHORTBSDINFO], decoded straight from the
+    buffer to immediate [int]s. Only the command name allocates. *)
+
+type t = {
+  pid : int;
+  ppid : int;
+  pgid : int;
+  status : int;  (** [p_stat]: one of the [s*] values. *)
+  comm : string;  (** Up to {!maxcomlen} bytes of the process name. *)
+  flags : int;
+  uid : int;
+  gid : int;
+  ruid : int;
+  rgid : int;
+  svuid : int;
+  svgid : int;
+}
+
+(** [PROC_PIDT_SHORTBSDINFO] flavor for [proc_pidinfo]. *)
+let pidt_shortbsdinfo = 13
+
+(** Process states from `sys/proc.h` *)
+
+let sidl = 1
+let srun = 2
+let ssleep = 3
+let sstop = 4
+let szomb = 5
+
+(** [MAXCOMLEN] *)
+let maxcomlen = 16
+
+let size = 64
+
+(* NUL-terminated, or the whole field when it is full. *)
+let comm buf off =
+  let rec len n =
+    if n < maxcomlen && Bigarray.Array1.get buf (off + n) <> '\000' then
+      len (n + 1)
+    else n
+  in
+  String.init (len 0) (fun i -> Bigarray.Array1.get buf (off + i))
+
+(** [decode buf off] decodes the [proc_bsdshortinfo] at [off] in [buf]. *)
+let decode buf off =
+  let u32 o = Decode.get_uint32 buf (off + o) in
+  {
+    pid = u32 0;
+    ppid = u32 4;
+    pgid = u32 8;
+    status = u32 12;
+    comm = comm buf (off + 16);
+    flags = u32 32;
+    uid = u32 36;
+    gid = u32 40;
+    ruid = u32 44;
+    rgid = u32 48;
+    svuid = u32 52;
+    svgid = u32 56;
+  }
+
+(** [decode_array buf n] decodes [n] consecutive records from the start of
+    [buf]. *)
+let decode_array buf n =
+  if n * size > Bigarray.Array1.dim buf then
+    invalid_arg "Proc_info.decode_array";
+  Array.init n (fun i -> decode buf (i * size))
@@ -0,0 +1,174 @@
+(** Snapshots of a host's process table, and what changed between them.
+
+    Each snapshot is kept column by column: the raw [proc_bsdshortinfo]
+    records the producer wrote, plus [int] arrays of the fields a monitor
+    compares. Two snapshots are kept and swapped on every {!Make.refresh}, so
+    once their buffers have grown to fit the host nothing is allocated per
+    refresh. Both are sorted by pid, so the delta is one merge pass. *)
+
+type delta = {
+  added : int;  (** Processes that appeared. *)
+  exited : int;  (** Processes that went away. *)
+  changed : int;  (** Processes whose status or parent changed. *)
+}
+
+module Make (P : Backend.PROCESSES) = struct
+  type table = {
+    mutable length : int;
+    mutable raw : Backend.buffer;
+    mutable pid : int array;
+    mutable ppid : int array;
+    mutable status : int array;
+    mutable uid : int array;
+  }
+
+  type t = {
+    source : P.t;
+    mutable current : table;
+    mutable previous : table;
+    mutable added_pids : int array;
+    mutable exited_pids : int array;
+    mutable changed_pids : int array;
+    mutable delta : delta;
+  }
+
+  let table capacity =
+    {
+      length = 0;
+      raw = Backend.create_buffer (capacity * Proc_info.size);
+      pid = Array.make capacity 0;
+      ppid = Array.make capacity 0;
+      status = Array.make capacity 0;
+      uid = Array.make capacity 0;
+    }
+
+  (** [create ?capacity source] sizes the tables for [capacity] processes
+      (default 1024); they grow as needed. *)
+  let create ?(capacity = 1024) source =
+    {
+      source;
+      current = table capacity;
+      previous = table capacity;
+      added_pids = Array.make capacity 0;
+      exited_pids = Array.make capacity 0;
+      changed_pids = Array.make capacity 0;
+      delta = { added = 0; exited = 0; changed = 0 };
+    }
+
+  let grow tb capacity =
+    let extend a = Array.append a (Array.make (capacity - Array.length a) 0) in
+    tb.raw <- Backend.create_buffer (capacity * Proc_info.size);
+    tb.pid <- extend tb.pid;
+    tb.ppid <- extend tb.ppid;
+    tb.status <- extend tb.status;
+    tb.uid <- extend tb.uid
+
+  (* Snapshot into [tb], growing it until the whole table fits. *)
+  let rec fill t tb =
+    let capacity = Array.length tb.pid in
+    match P.snapshot t.source tb.raw with
+    | Error e -> Error e
+    | Ok n when n > capacity ->
+        grow tb (max n (2 * capacity));
+        fill t tb
+    | Ok n ->
+        for i = 0 to n - 1 do
+          let off = i * Proc_info.size in
+          tb.pid.(i) <- Decode.get_uint32 tb.raw off;
+          tb.ppid.(i) <- Decode.get_uint32 tb.raw (off + 4);
+          tb.status.(i) <- Decode.get_uint32 tb.raw (off + 12);
+          tb.uid.(i) <- Decode.get_uint32 tb.raw (off + 36)
+        done;
+        tb.length <- n;
+        Ok ()
+
+  let ensure a n = if Array.length a >= n then a else Array.make (2 * n) 0
+
+  (* Merge the two pid-sorted tables. *)
+  let diff t =
+    let a = t.previous and b = t.current in
+    t.added_pids <- ensure t.added_pids b.length;
+    t.exited_pids <- ensure t.exited_pids a.length;
+    t.changed_pids <- ensure t.changed_pids b.length;
+    let rec merge i j added exited changed =
+      if i >= a.length then (
+        for k = j to b.length - 1 do
+          t.added_pids.(added + k - j) <- b.pid.(k)
+        done;
+        { added = added + b.length - j; exited; changed })
+      else if j >= b.length then (
+        for k = i to a.length - 1 do
+          t.exited_pids.(exited + k - i) <- a.pid.(k)
+        done;
+        { added; exited = exited + a.length - i; changed })
+      else
+        let p = a.pid.(i) and q = b.pid.(j) in
+        if p < q then (
+          t.exited_pids.(exited) <- p;
+          merge (i + 1) j added (exited + 1) changed)
+        else if q < p then (
+          t.added_pids.(added) <- q;
+          merge i (j + 1) (added + 1) exited changed)
+        else if a.status.(i) <> b.status.(j) || a.ppid.(i) <> b.ppid.(j) then (
+          t.changed_pids.(changed) <- q;
+          merge (i + 1) (j + 1) added exited (changed + 1))
+        else merge (i + 1) (j + 1) added exited changed
+    in
+    t.delta <- merge 0 0 0 0 0
+
+  (** [refresh t] takes a new snapshot and computes what changed since the
+      last one. After the first refresh every process counts as added. *)
+  let refresh t =
+    let next = t.previous in
+    t.previous <- t.current;
+    t.current <- next;
+    match fill t next with
+    | Error e ->
+        (* Keep the last good snapshot current. *)
+        t.current <- t.previous;
+        t.previous <- next;
+        Error e
+    | Ok () ->
+        diff t;
+        Ok t.delta
+
+  let length t = t.current.length
+  let delta t = t.delta
+  let pid t i = t.current.pid.(i)
+  let ppid t i = t.current.ppid.(i)
+  let status t i = t.current.status.(i)
+  let uid t i = t.current.uid.(i)
+
+  (** The whole record of the [i]th process, command name included. *)
+  let info t i = Proc_info.decode t.current.raw (i * Proc_info.size)
+
+  (** [find t pid] is the index of [pid] in the current snapshot, by binary
+      search, or [-1]. *)
+  let find t pid =
+    let tb = t.current in
+    let rec search lo hi =
+      if lo >= hi then -1
+      else
+        let mid = (lo + hi) lsr 1 in
+        let p = tb.pid.(mid) in
+        if p = pid then mid
+        else if p < pid then search (mid + 1) hi
+        else search lo mid
+    in
+    search 0 tb.length
+
+  let iter_added t f =
+    for i = 0 to t.delta.added - 1 do
+      f t.added_pids.(i)
+    done
+
+  let iter_exited t f =
+    for i = 0 to t.delta.exited - 1 do
+      f t.exited_pids.(i)
+    done
+
+  let iter_changed t f =
+    for i = 0 to t.delta.changed - 1 do
+      f t.changed_pids.(i)
+    done
+end
@@ -0,0 +1,159 @@
+(** One entry of a target's virtual memory map.
+
+    The fields follow [vm_region_submap_info_64] from `mach/vm_region.h`, with
+    every field decoded to an immediate [int] or [bool]. Linux producers fill in
+    what [/proc/<pid>/maps] knows and leave the page counters at zero. *)
+
+type t = {
+  start : int;
+  size : int;
+  depth : int;  (** Submap nesting depth the region was found at. *)
+  protection : int;  (** Current [vm_prot_t] bits. *)
+  max_protection : int;
+  inheritance : int;
+  offset : int;  (** Offset into the backing object. *)
+  user_tag : int;
+  pages_resident : int;
+  pages_shared_now_private : int;
+  pages_swapped_out : int;
+  pages_dirtied : int;
+  ref_count : int;
+  shadow_depth : int;
+  external_pager : bool;
+  share_mode : int;  (** One of the [sm_*] values. *)
+  is_submap : bool;
+  behavior : int;
+  object_id : int;  (** [object_id_full], identifies the backing object. *)
+  user_wired_count : int;
+  pages_reusable : int;
+}
+
+(** Protection bits from `mach/vm_prot.h` *)
+
+let prot_read = 0x1
+let prot_write = 0x2
+let prot_execute = 0x4
+
+(** Share modes from `mach/vm_region.h` *)
+
+let sm_cow = 1
+let sm_private = 2
+let sm_empty = 3
+let sm_shared = 4
+let sm_trueshared = 5
+let sm_private_aliased = 6
+let sm_shared_aliased = 7
+let sm_large_page = 8
+let stop r = r.start + r.size
+let contains r address = address >= r.start && address - r.start < r.size
+let readable r = r.protection land prot_read <> 0
+let writable r = r.protection land prot_write <> 0
+let executable r = r.protection land prot_execute <> 0
+
+(** Protection as the familiar [rwx] triple. *)
+let perms r =
+  let b = Bytes.make 3 '-' in
+  if readable r then Bytes.set b 0 'r';
+  if writable r then Bytes.set b 1 'w';
+  if executable r then Bytes.set b 2 'x';
+  Bytes.unsafe_to_string b
+
+(** [vm_region_submap_info_64] is declared under [#pragma pack(4)], so its two
+    64-bit fields sit at 4-byte aligned offsets that a naturally aligned Ctypes
+    structure cannot describe. These are the real offsets. *)
+
+let submap_info_size = 76
+let submap_info_count = submap_info_size / 4
+
+(** [of_submap_info ?off ~start ~size ~depth buf] decodes the
+    [vm_region_submap_info_64] that [mach_vm_region_recurse] wrote into [buf]
+    at [off] (default 0). *)
+let of_submap_info ?(off = 0) ~start ~size ~depth buf =
+  let u32 o = Decode.get_uint32 buf (off + o) in
+  {
+    start;
+    size;
+    depth;
+    protection = u32 0;
+    max_protection = u32 4;
+    inheritance = u32 8;
+    offset = Decode.get_int buf (off + 12);
+    user_tag = u32 20;
+    pages_resident = u32 24;
+    pages_shared_now_private = u32 28;
+    pages_swapped_out = u32 32;
+    pages_dirtied = u32 36;
+    ref_count = u32 40;
+    shadow_depth = Decode.get_uint16 buf (off + 44);
+    external_pager = Decode.get_uint8 buf (off + 46) <> 0;
+    share_mode = Decode.get_uint8 buf (off + 47);
+    is_submap = u32 48 <> 0;
+    behavior = u32 52;
+    object_id = Decode.get_int buf (off + 68);
+    user_wired_count = Decode.get_uint16 buf (off + 60);
+    pages_reusable = u32 64;
+  }
+
+(** [to_submap_info r b off] encodes [r] back into a
+    [vm_region_submap_info_64] at [off] in [b], the inverse of
+    {!of_submap_info}, for saving a map alongside target memory. *)
+let to_submap_info r b off =
+  let u32 o v = Bytes.set_int32_le b (off + o) (Int32.of_int v) in
+  let u64 o v = Bytes.set_int64_le b (off + o) (Int64.of_int v) in
+  u32 0 r.protection;
+  u32 4 r.max_protection;
+  u32 8 r.inheritance;
+  u64 12 r.offset;
+  u32 20 r.user_tag;
+  u32 24 r.pages_resident;
+  u32 28 r.pages_shared_now_private;
+  u32 32 r.pages_swapped_out;
+  u32 36 r.pages_dirtied;
+  u32 40 r.ref_count;
+  Bytes.set_uint16_le b (off + 44) r.shadow_depth;
+  Bytes.set_uint8 b (off + 46) (Bool.to_int r.external_pager);
+  Bytes.set_uint8 b (off + 47) r.share_mode;
+  u32 48 (Bool.to_int r.is_submap);
+  u32 52 r.behavior;
+  u32 56 (r.object_id land 0xffff_ffff);
+  Bytes.set_uint16_le b (off + 60) r.user_wired_count;
+  Bytes.set_uint16_le b (off + 62) 0;
+  u32 64 r.pages_reusable;
+  u64 68 r.object_id
+
+(** [of_submap_infos buf ~regions] decodes the [vm_region_submap_info_64]
+    records packed back to back in [buf], where [regions] gives the start,
+    size and depth each was found at. *)
+let of_submap_infos buf ~regions =
+  if Array.length regions * submap_info_size > Bigarray.Array1.dim buf then
+    invalid_arg "Region.of_submap_infos";
+  Array.mapi
+    (fun i (start, size, depth) ->
+      of_submap_info ~off:(i * submap_info_size) ~start ~size ~depth buf)
+    regions
+
+(** A region with only the fields a map listing knows about. *)
+let make ~start ~size ~protection ~share_mode ~offset ~object_id =
+  {
+    start;
+    size;
+    depth = 0;
+    protection;
+    max_protection = protection;
+    inheritance = 0;
+    offset;
+    user_tag = 0;
+    pages_resident = 0;
+    pages_shared_now_private = 0;
+    pages_swapped_out = 0;
+    pages_dirtied = 0;
+    ref_count = 0;
+    shadow_depth = 0;
+    external_pager = false;
+    share_mode;
+    is_submap = false;
+    behavior = 0;
+    object_id;
+    user_wired_count = 0;
+    pages_reusable = 0;
+  }
@@ -0,0 +1,117 @@
+(** In-memory index answering "which region holds this address".
+
+    Regions are kept sorted by start address in parallel arrays, so a lookup is
+    a binary search over a flat [int array] and allocates nothing. The index is
+    refreshed piecemeal: after the target maps or unmaps memory, only the
+    affected address range is queried again and spliced in, instead of walking
+    the whole map. *)
+
+type t = {
+  mutable starts : int array;
+  mutable stops : int array;
+  mutable regions : Region.t array;
+  mutable names : string array;
+}
+
+let of_array entries =
+  Array.stable_sort
+    (fun ((a : Region.t), _) ((b : Region.t), _) -> Int.compare a.start b.start)
+    entries;
+  {
+    starts = Array.map (fun ((r : Region.t), _) -> r.start) entries;
+    stops = Array.map (fun (r, _) -> Region.stop r) entries;
+    regions = Array.map fst entries;
+    names = Array.map snd entries;
+  }
+
+(** [of_list entries] indexes [(region, name)] pairs, which need not be
+    sorted. Regions must not overlap. *)
+let of_list entries = of_array (Array.of_list entries)
+
+(** Index of a recorded [/proc/<pid>/maps] file. *)
+let of_maps_file path =
+  Maps.fold_file path (fun acc r name -> (r, name) :: acc) [] |> of_list
+
+let length t = Array.length t.starts
+let region t i = t.regions.(i)
+let name t i = t.names.(i)
+
+(* Index of the last region starting at or before [address], or [-1]. *)
+let floor t address =
+  let starts = t.starts in
+  let rec go lo hi =
+    if hi - lo <= 1 then lo
+    else
+      let mid = (lo + hi) lsr 1 in
+      if Array.unsafe_get starts mid <= address then go mid hi else go lo mid
+  in
+  go (-1) (Array.length starts)
+
+(** [find_index t address] is the index of the region containing [address], or
+    [-1] if it is unmapped. *)
+let find_index t address =
+  let i = floor t address in
+  if i >= 0 && address < t.stops.(i) then i else -1
+
+let find t address =
+  let i = find_index t address in
+  if i < 0 then None else Some (t.regions.(i), t.names.(i))
+
+(* Replace entries [first, last) with [fresh]. *)
+let splice t first last fresh =
+  let replace old part =
+    Array.concat
+      [
+        Array.sub old 0 first;
+        part;
+        Array.sub old last (Array.length old - last);
+      ]
+  in
+  t.starts <-
+    replace t.starts (Array.map (fun ((r : Region.t), _) -> r.start) fresh);
+  t.stops <- replace t.stops (Array.map (fun (r, _) -> Region.stop r) fresh);
+  t.regions <- replace t.regions (Array.map fst fresh);
+  t.names <- replace t.names (Array.map snd fresh)
+
+module Make (S : Backend.NAMED_REGIONS) = struct
+  let query source ~start ~stop ~depth =
+    S.fold_named_regions source ~start ~stop ~depth
+      (fun acc r name -> (r, name) :: acc)
+      []
+    |> List.rev |> Array.of_list
+
+  (** [build ?depth source] indexes the whole map of [source]. *)
+  let build ?(depth = 2048) source =
+    of_array (query source ~start:0 ~stop:max_int ~depth)
+
+  (** [refresh_range ?depth t source start stop] queries [source] again for
+      [start, stop) only and replaces what the index held there. Regions that
+      straddle either end are re-queried whole. Returns the number of regions
+      fetched. *)
+  let refresh_range ?(depth = 2048) t source start stop =
+    let n = length t in
+    let first =
+      let i = floor t start in
+      if i >= 0 && t.stops.(i) > start then i else i + 1
+    in
+    let last = max first (floor t (stop - 1) + 1) in
+    let lo = if first < n then min start t.starts.(first) else start in
+    let hi = if last > first then max stop t.stops.(last - 1) else stop in
+    let fresh = query source ~start:lo ~stop:hi ~depth in
+    let k = Array.length fresh in
+    (* A fresh region can reach past what we asked for, e.g. when two
+       neighbours were merged, so widen the span being replaced to match. *)
+    let lo = if k > 0 then min lo (fst fresh.(0)).Region.start else lo in
+    let hi = if k > 0 then max hi (Region.stop (fst fresh.(k - 1))) else hi in
+    let first =
+      let i = floor t lo in
+      if i >= 0 && t.stops.(i) > lo then i else i + 1
+    in
+    let last = max first (floor t (hi - 1) + 1) in
+    splice t first last fresh;
+    k
+
+  (** Re-query the whole map. *)
+  let refresh ?depth t source =
+    refresh_range ?depth t source 0 max_int
+end
@@ -0,0 +1,149 @@
+(** Whole-target sampling profiler.
+
+    Each sample stops every thread, records its program counter, stack and
+    frame pointers and, optionally, the return addresses found by an
+    unwinder, then lets the target run again. Samples go into a ring of flat
+    preallocated arrays, so taking one allocates nothing and a long profile
+    keeps only the most recent [capacity] samples. *)
+
+(** An unwinder is called while the target is stopped as
+    [unwind ~pc ~sp ~fp frames off max] and stores up to [max] return addresses
+    into [frames] from [off], innermost first, returning how many it stored. *)
+type unwinder = pc:int -> sp:int -> fp:int -> int array -> int -> int -> int
+
+module Make (T : Backend.THREADS) = struct
+  type t = {
+    source : T.t;
+    capacity : int;
+    max_frames : int;
+    unwind : unwinder option;
+    times : float array;
+    tids : int array;
+    sps : int array;
+    fps : int array;
+    depths : int array;
+    frames : int array;  (** [max_frames] slots per sample, pc first. *)
+    mutable next : int;
+    mutable total : int;  (** Samples taken, including overwritten ones. *)
+    mutable rounds : int;
+  }
+
+  (** [create ?capacity ?max_frames ?unwind source] keeps the last [capacity]
+      thread samples (default 65536) of up to [max_frames] frames each
+      (default 64, or 1 without an unwinder). *)
+  let create ?(capacity = 65536) ?max_frames ?unwind source =
+    let max_frames =
+      match (max_frames, unwind) with
+      | Some n, _ -> max 1 n
+      | None, Some _ -> 64
+      | None, None -> 1
+    in
+    {
+      source;
+      capacity;
+      max_frames;
+      unwind;
+      times = Array.make capacity 0.;
+      tids = Array.make capacity 0;
+      sps = Array.make capacity 0;
+      fps = Array.make capacity 0;
+      depths = Array.make capacity 0;
+      frames = Array.make (capacity * max_frames) 0;
+      next = 0;
+      total = 0;
+      rounds = 0;
+    }
+
+  (** Take one sample of every thread. *)
+  let sample t =
+    let now = Unix.gettimeofday () in
+    let record tid pc sp fp =
+      let i = t.next in
+      let base = i * t.max_frames in
+      t.times.(i) <- now;
+      t.tids.(i) <- tid;
+      t.sps.(i) <- sp;
+      t.fps.(i) <- fp;
+      t.frames.(base) <- pc;
+      t.depths.(i) <-
+        (1
+        +
+        match t.unwind with
+        | Some unwind when t.max_frames > 1 ->
+            unwind ~pc ~sp ~fp t.frames (base + 1) (t.max_frames - 1)
+        | _ -> 0);
+      t.next <- (if i + 1 = t.capacity then 0 else i + 1);
+      t.total <- t.total + 1
+    in
+    let r = T.sample t.source record in
+    if Result.is_ok r then t.rounds <- t.rounds + 1;
+    r
+
+  (** [run t ~hz ~duration] samples at [hz] rounds per second for [duration]
+      seconds, stopping at the first error. *)
+  let run t ~hz ~duration =
+    let period = 1. /. hz in
+    let stop = Unix.gettimeofday () +. duration in
+    let rec loop due =
+      if due < stop then
+        match sample t with
+        | Error e -> Error e
+        | Ok _ ->
+            let now = Unix.gettimeofday () in
+            let due = Float.max now (due +. period) in
+            if due > now then Unix.sleepf (due -. now);
+            loop due
+      else Ok ()
+    in
+    loop (Unix.gettimeofday ())
+
+  let length t = min t.total t.capacity
+  let total t = t.total
+  let rounds t = t.rounds
+
+  let clear t =
+    t.next <- 0;
+    t.total <- 0;
+    t.rounds <- 0
+
+  (** [iter t f] calls [f time tid ~sp ~fp frames depth] for every retained
+      sample, oldest first, with the stack and frame pointers the thread had.
+      [frames] is only valid during the call. *)
+  let iter t f =
+    let n = length t in
+    let first = if t.total > t.capacity then t.next else 0 in
+    let frames = Array.make t.max_frames 0 in
+    for k = 0 to n - 1 do
+      let i = (first + k) mod t.capacity in
+      let depth = t.depths.(i) in
+      Array.blit t.frames (i * t.max_frames) frames 0 depth;
+      f t.times.(i) t.tids.(i) ~sp:t.sps.(i) ~fp:t.fps.(i) frames depth
+    done
+
+  (** Samples aggregated into folded stacks, [("root;...;leaf", count)],
+      most frequent first, as consumed by flame graph tools. [symbol] names a
+      frame address (hex by default); with [by_thread] (the default) each
+      stack is rooted at its thread. *)
+  let folded ?(symbol = Printf.sprintf "0x%x") ?(by_thread = true) t =
+    let counts = Hashtbl.create 1024 in
+    let b = Buffer.create 256 in
+    iter t (fun _ tid ~sp:_ ~fp:_ frames depth ->
+        Buffer.clear b;
+        if by_thread then Printf.bprintf b "thread-%d" tid;
+        for d = depth - 1 downto 0 do
+          if Buffer.length b > 0 then Buffer.add_char b ';';
+          Buffer.add_string b (symbol frames.(d))
+        done;
+        let key = Buffer.contents b in
+        Hashtbl.replace counts key
+          (1 + Option.value ~default:0 (Hashtbl.find_opt counts key)));
+    Hashtbl.fold (fun k n acc -> (k, n) :: acc) counts []
+    |> List.sort (fun (a, n) (b, m) ->
+           match Int.compare m n with 0 -> String.compare a b | c -> c)
+
+  (** Write {!folded} to [oc] one ["stack count"] line at a time. *)
+  let output_folded ?symbol ?by_thread oc t =
+    List.iter
+      (fun (stack, n) -> Printf.fprintf oc "%s %d\n" stack n)
+      (folded ?symbol ?by_thread t)
+end
@@ -0,0 +1,232 @@
+(** Parallel search of target memory for byte signatures and pointer values.
+
+    Readable ranges are cut into large chunks which worker domains claim from a
+    shared counter, so big and small regions balance out across workers. Each
+    chunk is read with one backend call and matched against every pattern in a
+    single pass: a 256 entry table of anchor bytes rejects almost every
+    position with one load, and only positions whose anchor byte belongs to
+    some pattern are compared in full. *)
+
+type pattern = {
+  bytes : string;
+  mask : string;  (** ['\255'] where the byte must match, ['\000'] for [??]. *)
+  align : int;  (** Matches must start at a multiple of this address. *)
+}
+
+(** [of_string ?align s] matches the bytes of [s] exactly. *)
+let of_string ?(align = 1) s =
+  if s = "" then invalid_arg "Scanner.of_string: empty pattern";
+  { bytes = s; mask = String.make (String.length s) '\255'; align }
+
+(** [of_hex ?align "48 8b ?? ?? 05"] parses space separated hex bytes, with
+    [??] matching any byte. *)
+let of_hex ?(align = 1) s =
+  let tokens = String.split_on_char ' ' s |> List.filter (fun t -> t <> "") in
+  let n = List.length tokens in
+  let bytes = Bytes.make n '\000' and mask = Bytes.make n '\000' in
+  List.iteri
+    (fun i token ->
+      if token <> "??" then (
+        match int_of_string_opt ("0x" ^ token) with
+        | Some b when b >= 0 && b < 256 ->
+            Bytes.set bytes i (Char.chr b);
+            Bytes.set mask i '\255'
+        | _ -> invalid_arg ("Scanner.of_hex: bad byte " ^ token)))
+    tokens;
+  if not (Bytes.contains mask '\255') then
+    invalid_arg "Scanner.of_hex: pattern has no fixed byte";
+  { bytes = Bytes.to_string bytes; mask = Bytes.to_string mask; align }
+
+(** A naturally aligned little-endian 64-bit pointer with value [v]. *)
+let pointer v =
+  let b = Bytes.create 8 in
+  Bytes.set_int64_le b 0 (Int64.of_int v);
+  of_string ~align:8 (Bytes.to_string b)
+
+type matcher = {
+  patterns : pattern array;
+  anchors : int array;  (** Offset of each pattern's first fixed byte. *)
+  by_byte : int array array;  (** Anchor byte to patterns anchored on it. *)
+  interesting : Bytes.t;  (** Non zero for bytes that anchor a pattern. *)
+  max_len : int;
+  stride : int;
+      (** When every pattern is anchored at 0 with the same alignment, only
+          aligned positions are visited. *)
+}
+
+let compile patterns =
+  let patterns = Array.of_list patterns in
+  if Array.length patterns = 0 then invalid_arg "Scanner.compile: no patterns";
+  let anchors =
+    Array.map (fun p -> Option.get (String.index_opt p.mask '\255')) patterns
+  in
+  let lists = Array.make 256 [] in
+  Array.iteri
+    (fun i p ->
+      let b = Char.code p.bytes.[anchors.(i)] in
+      lists.(b) <- i :: lists.(b))
+    patterns;
+  let by_byte = Array.map (fun l -> Array.of_list (List.rev l)) lists in
+  let interesting = Bytes.make 256 '\000' in
+  Array.iteri
+    (fun b l -> if Array.length l > 0 then Bytes.set interesting b '\001')
+    by_byte;
+  let align = patterns.(0).align in
+  let uniform =
+    Array.for_all (fun p -> p.align = align) patterns
+    && Array.for_all (fun a -> a = 0) anchors
+  in
+  {
+    patterns;
+    anchors;
+    by_byte;
+    interesting;
+    max_len =
+      Array.fold_left (fun m p -> max m (String.length p.bytes)) 0 patterns;
+    stride = (if uniform then max 1 align else 1);
+  }
+
+type hit = {
+  pattern : int;  (** Index in the list given to {!compile}. *)
+  address : int;
+}
+
+let full_match p buf start =
+  let len = String.length p.bytes in
+  let rec go k =
+    k = len
+    ||
+    let m = Char.code (String.unsafe_get p.mask k) in
+    Char.code (Bigarray.Array1.unsafe_get buf (start + k)) land m
+    = Char.code (String.unsafe_get p.bytes k) land m
+    && go (k + 1)
+  in
+  go 0
+
+(* Report matches in [buf.{0 .. len - 1}], which holds target memory from
+   [base], that start before [limit]. Bytes past [limit] are overlap with the
+   next chunk and only serve to complete matches starting before it. *)
+let scan_buffer m buf len base limit f =
+  let check i =
+    let c = Char.code (Bigarray.Array1.unsafe_get buf i) in
+    if Bytes.unsafe_get m.interesting c <> '\000' then
+      Array.iter
+        (fun p ->
+          let pat = m.patterns.(p) in
+          let s = i - m.anchors.(p) in
+          if
+            s >= 0 && s < limit
+            && s + String.length pat.bytes <= len
+            && (base + s) mod pat.align = 0
+            && full_match pat buf s
+          then f p (base + s))
+        m.by_byte.(c)
+  in
+  if m.stride = 1 then
+    for i = 0 to len - 1 do
+      check i
+    done
+  else
+    let first = (m.stride - (base mod m.stride)) mod m.stride in
+    let rec go i =
+      if i < len then (
+        check i;
+        go (i + m.stride))
+    in
+    go first
+
+(** [scan_view m view f] searches a whole {!View.t} in the calling domain,
+    without copying it. *)
+let scan_view m view f =
+  let len = View.length view in
+  scan_buffer m (View.data view) len (View.address view) len (fun p address ->
+      f { pattern = p; address })
+
+(** Readable regions of a map as [(address, len)] ranges to scan. *)
+let readable regions =
+  Seq.filter_map
+    (fun r -> if Region.readable r then Some (r.Region.start, r.size) else None)
+    regions
+  |> List.of_seq
+
+type stats = {
+  bytes : int;  (** Bytes scanned. *)
+  chunks : int;
+  errors : int;  (** Chunks that could not be read and were skipped. *)
+  matches : int;
+}
+
+let add a b =
+  {
+    bytes = a.bytes + b.bytes;
+    chunks = a.chunks + b.chunks;
+    errors = a.errors + b.errors;
+    matches = a.matches + b.matches;
+  }
+
+module Make (B : Backend.READER) = struct
+  (** [scan ?domains ?chunk_size ~reader ranges m f] searches every
+      [(address, len)] of [ranges] for the patterns of [m], calling [f] for
+      each hit as it is found. Hits arrive in no particular order; [f] is
+      called under a lock so it need not be thread safe itself. [reader] is
+      called once per worker to open that worker's own backend, as backends
+      keep per-handle call buffers. *)
+  let scan ?(domains = Pool.recommended ()) ?(chunk_size = 1 lsl 20) ~reader
+      ranges m f =
+    let overlap = m.max_len - 1 in
+    let work =
+      List.concat_map
+        (fun (start, len) ->
+          let stop = start + len in
+          let rec chunks address acc =
+            if address >= stop then List.rev acc
+            else
+              let limit = min chunk_size (stop - address) in
+              let read = min (chunk_size + overlap) (stop - address) in
+              chunks (address + limit) ((address, read, limit) :: acc)
+          in
+          chunks start [])
+        ranges
+      |> Array.of_list
+    in
+    let next = Atomic.make 0 in
+    let lock = Pool.lock () in
+    let worker _ =
+      let backend = reader () in
+      let buf = Backend.create_buffer (chunk_size + overlap) in
+      let stats = ref { bytes = 0; chunks = 0; errors = 0; matches = 0 } in
+      let hit p address =
+        Pool.with_lock lock (fun () -> f { pattern = p; address })
+      in
+      let rec loop () =
+        let i = Atomic.fetch_and_add next 1 in
+        if i < Array.length work then (
+          let address, read, limit = work.(i) in
+          (match B.read backend address buf 0 read with
+          | Ok () ->
+              let matches = ref 0 in
+              scan_buffer m buf read address limit (fun p a ->
+                  incr matches;
+                  hit p a);
+              stats :=
+                add !stats
+                  { bytes = limit; chunks = 1; errors = 0; matches = !matches }
+          | Error _ ->
+              stats :=
+                add !stats { bytes = 0; chunks = 1; errors = 1; matches = 0 });
+          loop ())
+      in
+      loop ();
+      !stats
+    in
+    Pool.run domains worker
+    |> Array.fold_left add { bytes = 0; chunks = 0; errors = 0; matches = 0 }
+
+  (** {!scan} collecting the hits, sorted by address. *)
+  let scan_list ?domains ?chunk_size ~reader ranges m =
+    let hits = ref [] in
+    let stats =
+      scan ?domains ?chunk_size ~reader ranges m (fun h -> hits := h :: !hits)
+    in
+    (List.sort (fun a b -> Int.compare a.address b.address) !hits, stats)
+end
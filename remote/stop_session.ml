@@ -0,0 +1,195 @@
+(** Register cache for the time a target is stopped.
+
+    A debugger that asks for registers per query pays a kernel call per
+    thread per query, and one more per edit. A session stops the target
+    once, fetches the general registers of every thread up front and the
+    float and exception sets on first use, serves every read from the
+    cache, and marks edited sets dirty. {!Make.resume} writes back only
+    dirty sets before the target runs again.
+
+    Each register set is cached in one flat buffer with a fixed stride per
+    thread, so a session with hundreds of threads allocates three buffers. *)
+
+type cache = {
+  stride : int;
+  mutable data : Backend.buffer;
+  mutable lengths : int array;  (** 0 until fetched. *)
+  mutable dirty : Bytes.t;
+}
+
+type stats = {
+  mutable stops : int;
+  mutable fetches : int;  (** Register sets fetched from the target. *)
+  mutable hits : int;  (** Reads served from the cache. *)
+  mutable writes : int;  (** Register sets written back. *)
+}
+
+module Make (S : Backend.THREAD_STATES) = struct
+  type t = {
+    backend : S.t;
+    mutable threads : int array;
+    index : (int, int) Hashtbl.t;  (** Thread to its slot in the caches. *)
+    caches : cache array;  (** By {!Backend.register_set_index}. *)
+    mutable stopped : bool;
+    stats : stats;
+  }
+
+  let sets = [| Backend.General; Backend.Float; Backend.Exception |]
+
+  let create backend =
+    {
+      backend;
+      threads = [||];
+      index = Hashtbl.create 64;
+      caches =
+        Array.map
+          (fun set ->
+            {
+              stride = S.state_size backend set;
+              data = Backend.create_buffer 0;
+              lengths = [||];
+              dirty = Bytes.empty;
+            })
+          sets;
+      stopped = false;
+      stats = { stops = 0; fetches = 0; hits = 0; writes = 0 };
+    }
+
+  let backend t = t.backend
+  let stats t = t.stats
+  let stopped t = t.stopped
+
+  (** Threads of the stopped target, in the order the backend listed them. *)
+  let threads t = t.threads
+
+  let fetch t c set slot =
+    t.stats.fetches <- t.stats.fetches + 1;
+    match
+      S.get_state t.backend t.threads.(slot) set c.data (slot * c.stride)
+    with
+    | Error e -> Error e
+    | Ok len ->
+        c.lengths.(slot) <- len;
+        Ok ()
+
+  (** [stop t] stops the target and fetches the general registers of every
+      thread. Threads whose registers cannot be read, typically because they
+      have just exited, are left to fail on first use. *)
+  let stop t =
+    if t.stopped then invalid_arg "Stop_session.stop: already stopped";
+    match S.stop t.backend with
+    | Error e -> Error e
+    | Ok threads ->
+        let n = Array.length threads in
+        t.stopped <- true;
+        t.stats.stops <- t.stats.stops + 1;
+        t.threads <- threads;
+        Hashtbl.reset t.index;
+        Array.iteri (fun i th -> Hashtbl.replace t.index th i) threads;
+        Array.iter
+          (fun c ->
+            if Bigarray.Array1.dim c.data < n * c.stride then
+              c.data <- Backend.create_buffer (n * c.stride);
+            c.lengths <- Array.make n 0;
+            c.dirty <- Bytes.make n '\000')
+          t.caches;
+        let general = t.caches.(Backend.register_set_index Backend.General) in
+        Array.iteri
+          (fun slot _ -> ignore (fetch t general Backend.General slot))
+          threads;
+        Ok n
+
+  (* The cache and slot of [thread]'s [set], fetched if need be. *)
+  let entry t thread set =
+    if not t.stopped then invalid_arg "Stop_session: not stopped";
+    match Hashtbl.find_opt t.index thread with
+    | None -> Error (Backend.Unix_error Unix.ESRCH)
+    | Some slot ->
+        let c = t.caches.(Backend.register_set_index set) in
+        if c.lengths.(slot) > 0 then (
+          t.stats.hits <- t.stats.hits + 1;
+          Ok (c, slot))
+        else Result.map (fun () -> (c, slot)) (fetch t c set slot)
+
+  (** [state t thread set] is [(buf, off, len)], the cached bytes of
+      [thread]'s [set] in the platform's layout. They must not be changed
+      except through {!modify}. *)
+  let state t thread set =
+    Result.map
+      (fun (c, slot) -> (c.data, slot * c.stride, c.lengths.(slot)))
+      (entry t thread set)
+
+  let check name c slot off len =
+    if off < 0 || len < 0 || off > c.lengths.(slot) - len then invalid_arg name
+
+  (** [get_int t thread set off] is the 64-bit register at byte [off] of
+      [thread]'s [set]. *)
+  let get_int t thread set off =
+    Result.map
+      (fun (c, slot) ->
+        check "Stop_session.get_int" c slot off 8;
+        Decode.get_int c.data ((slot * c.stride) + off))
+      (entry t thread set)
+
+  (** [modify t thread set f] calls [f buf off len] on the cached bytes of
+      [thread]'s [set] to change them in place, and marks the set to be
+      written back. *)
+  let modify t thread set f =
+    Result.map
+      (fun (c, slot) ->
+        f c.data (slot * c.stride) c.lengths.(slot);
+        Bytes.set c.dirty slot '\001')
+      (entry t thread set)
+
+  (** [set_int t thread set off v] stores [v] as the 64-bit register at byte
+      [off] of [thread]'s [set]. *)
+  let set_int t thread set off v =
+    modify t thread set (fun buf base len ->
+        if off < 0 || off > len - 8 then invalid_arg "Stop_session.set_int";
+        for i = 0 to 7 do
+          Bigarray.Array1.set buf (base + off + i)
+            (Char.unsafe_chr ((v lsr (8 * i)) land 0xff))
+        done)
+
+  (** Forget every edit since {!stop}. *)
+  let discard t =
+    Array.iter
+      (fun c -> Bytes.fill c.dirty 0 (Bytes.length c.dirty) '\000')
+      t.caches
+
+  (** Number of register sets {!resume} would write back. *)
+  let dirty t =
+    Array.fold_left
+      (fun n c ->
+        let k = ref n in
+        Bytes.iter (fun d -> if d <> '\000' then incr k) c.dirty;
+        !k)
+      0 t.caches
+
+  (** [resume t] writes back every dirty register set, then resumes the
+      target, and returns how many sets were written. The target is resumed
+      even when a write fails; the first error is returned after the others
+      have been tried. *)
+  let resume t =
+    if not t.stopped then invalid_arg "Stop_session.resume: not stopped";
+    let error = ref None and written = ref 0 in
+    Array.iteri
+      (fun i c ->
+        Bytes.iteri
+          (fun slot d ->
+            if d <> '\000' then
+              match
+                S.set_state t.backend t.threads.(slot) sets.(i) c.data
+                  (slot * c.stride) c.lengths.(slot)
+              with
+              | Ok () -> incr written
+              | Error e -> if !error = None then error := Some e)
+          c.dirty)
+      t.caches;
+    t.stats.writes <- t.stats.writes + !written;
+    t.stopped <- false;
+    let resumed = S.resume t.backend in
+    match (!error, resumed) with
+    | Some e, _ | None, Error e -> Error e
+    | None, Ok () -> Ok !written
+end
@@ -0,0 +1,387 @@
+(** Symbol tables of Mach-O and ELF images, for turning sampled program
+    counters into function names.
+
+    An image is mapped read-only and its function symbols are gathered once
+    into a compact index: a sorted table of start addresses, a table of end
+    addresses, name offsets, and one blob of NUL terminated names. The index
+    is an off-heap {!Backend.buffer} in a flat layout that is also its on-disk
+    format, so with a cache directory it is written next to the others under
+    the image's UUID or build-id and later runs map it straight back in,
+    without touching the image again. Lookups are binary searches over the
+    mapped tables and decode a name only when asked for it. *)
+
+type t = {
+  id : string;  (** Mach-O UUID or ELF build-id in hex. *)
+  base : int;  (** Link-time address of the image's first segment. *)
+  count : int;
+  data : Backend.buffer;
+}
+
+(* Index layout, native endian:
+     0  magic "MACHSYM1"
+     8  count
+    16  base
+    24  blob size
+    32  starts, count words
+        stops, count words
+        name offsets into the blob, count words
+        blob *)
+let magic = "MACHSYM1"
+let header_size = 32
+let start t i = Decode.get_int t.data (header_size + (8 * i))
+let stop t i = Decode.get_int t.data (header_size + (8 * (t.count + i)))
+let blob t = header_size + (24 * t.count)
+
+(* NUL terminated string at [off]. *)
+let cstring buf off =
+  let rec len n =
+    if
+      off + n < Bigarray.Array1.dim buf
+      && Bigarray.Array1.get buf (off + n) <> '\000'
+    then len (n + 1)
+    else n
+  in
+  let b = Bytes.create (len 0) in
+  Backend.blit_to_bytes buf off b 0 (Bytes.length b);
+  Bytes.unsafe_to_string b
+
+let length t = t.count
+let id t = t.id
+let base t = t.base
+
+(** Name of symbol [i]. *)
+let name t i =
+  cstring t.data
+    (blob t + Decode.get_int t.data (header_size + (8 * ((2 * t.count) + i))))
+
+(** Link-time address range [[start, stop)] of symbol [i]. *)
+let range t i = (start t i, stop t i)
+
+(* Serialise [(start, size, name)] symbols, a size of 0 meaning "up to the
+   next symbol", or up to [stop] for the last one. Symbols at the same
+   address keep the first name seen. *)
+let encode ~base ~stop symbols =
+  let symbols =
+    List.stable_sort (fun (a, _, _) (b, _, _) -> Int.compare a b) symbols
+    |> List.fold_left
+         (fun acc ((s, _, _) as sym) ->
+           match acc with (s', _, _) :: _ when s = s' -> acc | _ -> sym :: acc)
+         []
+    |> List.rev |> Array.of_list
+  in
+  let n = Array.length symbols in
+  let names = Buffer.create (n * 24) in
+  let offsets =
+    Array.map
+      (fun (_, _, name) ->
+        let o = Buffer.length names in
+        Buffer.add_string names name;
+        Buffer.add_char names '\000';
+        o)
+      symbols
+  in
+  let b = Bytes.make (header_size + (24 * n) + Buffer.length names) '\000' in
+  let set off v = Bytes.set_int64_ne b off (Int64.of_int v) in
+  Bytes.blit_string magic 0 b 0 8;
+  set 8 n;
+  set 16 base;
+  set 24 (Buffer.length names);
+  Array.iteri
+    (fun i (s, size, _) ->
+      let next =
+        if i + 1 < n then (fun (s, _, _) -> s) symbols.(i + 1) else max s stop
+      in
+      set (header_size + (8 * i)) s;
+      set (header_size + (8 * (n + i))) (if size > 0 then s + size else next);
+      set (header_size + (8 * ((2 * n) + i))) offsets.(i))
+    symbols;
+  Buffer.blit names 0 b (header_size + (24 * n)) (Buffer.length names);
+  b
+
+let decode ~id data =
+  let size = Bigarray.Array1.dim data in
+  if size < header_size || String.init 8 (Bigarray.Array1.get data) <> magic
+  then None
+  else
+    let count = Decode.get_int data 8 in
+    if size < header_size + (24 * count) + Decode.get_int data 24 then None
+    else Some { id; base = Decode.get_int data 16; count; data }
+
+let hex buf off len =
+  String.init (2 * len) (fun i ->
+      let b = Decode.get_uint8 buf (off + (i / 2)) in
+      "0123456789abcdef".[if i land 1 = 0 then b lsr 4 else b land 0xf])
+
+(** {2 Images} *)
+
+type image = {
+  image_id : string option;
+  image_base : int;
+  image_stop : int;  (** Link-time end of the image's last segment. *)
+  symbols : unit -> (int * int * string) list;
+}
+
+let elf buf =
+  let shoff = Decode.get_int buf 40 in
+  let shentsize = Decode.get_uint16 buf 58 in
+  let shnum = Decode.get_uint16 buf 60 in
+  let section i = shoff + (i * shentsize) in
+  let sh_type i = Decode.get_uint32 buf (section i + 4) in
+  let sh_offset i = Decode.get_int buf (section i + 24) in
+  let sh_size i = Decode.get_int buf (section i + 32) in
+  let sh_link i = Decode.get_uint32 buf (section i + 40) in
+  let phoff = Decode.get_int buf 32 in
+  let phentsize = Decode.get_uint16 buf 54 in
+  let phnum = Decode.get_uint16 buf 56 in
+  let base = ref max_int and stop = ref 0 in
+  for i = 0 to phnum - 1 do
+    let p = phoff + (i * phentsize) in
+    if Decode.get_uint32 buf p = 1 (* PT_LOAD *) then (
+      let vaddr = Decode.get_int buf (p + 16) in
+      base := min !base vaddr;
+      stop := max !stop (vaddr + Decode.get_int buf (p + 40)))
+  done;
+  (* The GNU build-id note, in any SHT_NOTE section. *)
+  let id = ref None in
+  for i = 0 to shnum - 1 do
+    if sh_type i = 7 then
+      let stop = sh_offset i + sh_size i in
+      let rec notes p =
+        if p + 12 <= stop then (
+          let namesz = Decode.get_uint32 buf p in
+          let descsz = Decode.get_uint32 buf (p + 4) in
+          let desc = p + 12 + ((namesz + 3) land lnot 3) in
+          if Decode.get_uint32 buf (p + 8) = 3 && cstring buf (p + 12) = "GNU"
+          then id := Some (hex buf desc descsz)
+          else notes (desc + ((descsz + 3) land lnot 3)))
+      in
+      notes (sh_offset i)
+  done;
+  let symbols () =
+    let acc = ref [] in
+    for i = 0 to shnum - 1 do
+      (* SHT_SYMTAB or SHT_DYNSYM *)
+      if sh_type i = 2 || sh_type i = 11 then
+        let strtab = sh_offset (sh_link i) in
+        for k = 0 to (sh_size i / 24) - 1 do
+          let p = sh_offset i + (k * 24) in
+          let kind = Decode.get_uint8 buf (p + 4) land 0xf in
+          let value = Decode.get_int buf (p + 8) in
+          (* STT_FUNC or STT_GNU_IFUNC, defined in this image *)
+          if
+            (kind = 2 || kind = 10)
+            && Decode.get_uint16 buf (p + 6) <> 0
+            && value <> 0
+          then
+            acc :=
+              ( value,
+                Decode.get_int buf (p + 16),
+                cstring buf (strtab + Decode.get_uint32 buf p) )
+              :: !acc
+        done
+    done;
+    !acc
+  in
+  {
+    image_id = !id;
+    image_base = (if !base = max_int then 0 else !base);
+    image_stop = !stop;
+    symbols;
+  }
+
+let lc_symtab = 0x2
+let lc_segment_64 = 0x19
+let lc_uuid = 0x1b
+
+(* A thin 64-bit Mach-O image starting at byte [o] of [buf]. *)
+let macho buf o =
+  let ncmds = Decode.get_uint32 buf (o + 16) in
+  let id = ref None and base = ref 0 and stop = ref 0 and symtab = ref None in
+  let rec commands i p =
+    if i < ncmds then (
+      let cmd = Decode.get_uint32 buf p in
+      if cmd = lc_uuid then id := Some (hex buf (p + 8) 16)
+      else if cmd = lc_segment_64 then (
+        let vmaddr = Decode.get_int buf (p + 24) in
+        if cstring buf (p + 8) = "__TEXT" then base := vmaddr;
+        if cstring buf (p + 8) <> "__PAGEZERO" then
+          stop := max !stop (vmaddr + Decode.get_int buf (p + 32)))
+      else if cmd = lc_symtab then
+        symtab :=
+          Some
+            ( Decode.get_uint32 buf (p + 8),
+              Decode.get_uint32 buf (p + 12),
+              Decode.get_uint32 buf (p + 16) );
+      commands (i + 1) (p + Decode.get_uint32 buf (p + 4)))
+  in
+  commands 0 (o + 32);
+  let symbols () =
+    match !symtab with
+    | None -> []
+    | Some (symoff, nsyms, stroff) ->
+        let acc = ref [] in
+        for k = 0 to nsyms - 1 do
+          let p = o + symoff + (k * 16) in
+          let typ = Decode.get_uint8 buf (p + 4) in
+          (* Not a debugging entry, and defined in a section. *)
+          if typ land 0xe0 = 0 && typ land 0x0e = 0x0e then
+            acc :=
+              ( Decode.get_int buf (p + 8),
+                0,
+                cstring buf (o + stroff + Decode.get_uint32 buf p) )
+              :: !acc
+        done;
+        !acc
+  in
+  { image_id = !id; image_base = !base; image_stop = !stop; symbols }
+
+let get_u32_be buf off =
+  (Decode.get_uint8 buf off lsl 24)
+  lor (Decode.get_uint8 buf (off + 1) lsl 16)
+  lor (Decode.get_uint8 buf (off + 2) lsl 8)
+  lor Decode.get_uint8 buf (off + 3)
+
+(* Parse a mapped image. Universal binaries yield the slice for [cputype],
+   or the first 64-bit one. *)
+let image ?cputype buf =
+  if Bigarray.Array1.dim buf < 64 then invalid_arg "Symbols: not an image";
+  match Decode.get_uint32 buf 0 with
+  | 0x464c457f -> elf buf
+  | 0xfeedfacf -> macho buf 0
+  | 0xbebafeca ->
+      let n = get_u32_be buf 4 in
+      let arch i = 8 + (20 * i) in
+      let wanted i =
+        let c = get_u32_be buf (arch i) in
+        match cputype with Some t -> c = t | None -> c land 0x01000000 <> 0
+      in
+      let rec pick i =
+        if i = n then invalid_arg "Symbols: no matching slice"
+        else if wanted i then macho buf (get_u32_be buf (arch i + 8))
+        else pick (i + 1)
+      in
+      pick 0
+  | _ -> invalid_arg "Symbols: not a 64-bit Mach-O or ELF image"
+
+let map_file path =
+  let fd = Unix.openfile path [ Unix.O_RDONLY ] 0 in
+  Fun.protect
+    ~finally:(fun () -> Unix.close fd)
+    (fun () ->
+      Unix.map_file fd Bigarray.char Bigarray.c_layout false [| -1 |]
+      |> Bigarray.array1_of_genarray)
+
+(** [$XDG_CACHE_HOME/mach/symbols], falling back to [~/.cache]. *)
+let default_cache_dir () =
+  let root =
+    match Sys.getenv_opt "XDG_CACHE_HOME" with
+    | Some d when d <> "" -> d
+    | _ ->
+        Filename.concat
+          (Option.value ~default:"." (Sys.getenv_opt "HOME"))
+          ".cache"
+  in
+  Filename.concat (Filename.concat root "mach") "symbols"
+
+let rec mkdir_p dir =
+  if not (Sys.file_exists dir) then (
+    mkdir_p (Filename.dirname dir);
+    try Unix.mkdir dir 0o755 with Unix.Unix_error (Unix.EEXIST, _, _) -> ())
+
+(* Write through a temporary file and rename it into place, so concurrent
+   readers never see a partial index. *)
+let save dir id bytes =
+  mkdir_p dir;
+  let path = Filename.concat dir (id ^ ".sym") in
+  let tmp = Filename.temp_file ~temp_dir:dir id ".tmp" in
+  let oc = open_out_bin tmp in
+  Fun.protect
+    ~finally:(fun () -> close_out oc)
+    (fun () -> output_bytes oc bytes);
+  Unix.rename tmp path;
+  path
+
+(** [of_file ?cache_dir ?cputype path] indexes the image at [path]. With
+    [cache_dir], an index saved there by an earlier run for the same UUID or
+    build-id is mapped instead of being rebuilt, and a fresh one is saved.
+    Images without an id are keyed by path, size and modification time. *)
+let of_file ?cache_dir ?cputype path =
+  let img = image ?cputype (map_file path) in
+  let id =
+    match img.image_id with
+    | Some id -> id
+    | None ->
+        let st = Unix.stat path in
+        Digest.to_hex
+          (Digest.string
+             (Printf.sprintf "%s:%d:%f" path st.Unix.st_size st.Unix.st_mtime))
+  in
+  let cached =
+    match cache_dir with
+    | None -> None
+    | Some dir ->
+        let file = Filename.concat dir (id ^ ".sym") in
+        if Sys.file_exists file then decode ~id (map_file file) else None
+  in
+  match cached with
+  | Some t -> t
+  | None -> (
+      let bytes =
+        encode ~base:img.image_base ~stop:img.image_stop (img.symbols ())
+      in
+      match cache_dir with
+      | Some dir -> Option.get (decode ~id (map_file (save dir id bytes)))
+      | None ->
+          let data = Backend.create_buffer (Bytes.length bytes) in
+          Bytes.iteri (fun i c -> Bigarray.Array1.unsafe_set data i c) bytes;
+          Option.get (decode ~id data))
+
+(** {2 Lookups} *)
+
+(* Last symbol starting at or before [address], or [-1]. *)
+let floor t address =
+  let rec go lo hi =
+    if hi - lo <= 1 then lo
+    else
+      let mid = (lo + hi) lsr 1 in
+      if start t mid <= address then go mid hi else go lo mid
+  in
+  go (-1) t.count
+
+(** [find t address] is the index of the symbol covering link-time
+    [address], or [-1]. *)
+let find t address =
+  let i = floor t address in
+  if i >= 0 && address < stop t i then i else -1
+
+(** [lookup ?slide t pc] names the function holding runtime [pc] of an image
+    loaded [slide] bytes above its link-time address, with the offset of [pc]
+    into it. *)
+let lookup ?(slide = 0) t pc =
+  let address = pc - slide in
+  let i = find t address in
+  if i < 0 then None else Some (name t i, address - start t i)
+
+(** [resolve ?slide t pcs] finds the symbol index of every runtime pc, or
+    [-1]. The pcs are visited in address order, so each search only covers
+    the symbols above the previous hit. *)
+let resolve ?(slide = 0) t pcs =
+  let n = Array.length pcs in
+  let order = Array.init n Fun.id in
+  Array.sort (fun a b -> Int.compare pcs.(a) pcs.(b)) order;
+  let result = Array.make n (-1) in
+  let lo = ref (-1) in
+  Array.iter
+    (fun k ->
+      let address = pcs.(k) - slide in
+      let rec go lo hi =
+        if hi - lo <= 1 then lo
+        else
+          let mid = (lo + hi) lsr 1 in
+          if start t mid <= address then go mid hi else go lo mid
+      in
+      let i = go !lo t.count in
+      lo := i;
+      if i >= 0 && address < stop t i then result.(k) <- i)
+    order;
+  result
@@ -0,0 +1,324 @@
+(** Whole-task snapshot files, served back like a live task.
+
+    A snapshot holds the memory map with every [vm_region_submap_info_64]
+    field and the backing file names, the contents of the readable regions,
+    the thread states and optionally the [proc_bsdshortinfo] of the process.
+    The reader maps the file once and answers reads, region queries and
+    thread samples straight from the mapping, so offline analysis pays page
+    faults instead of kernel calls, and any number of jobs can map the same
+    file and share its pages. A reader is never modified after it is opened,
+    so domains can share one too.
+
+    The layout, all little-endian:
+    {v
+    header   "MACHSNAP", version, machine, page size, region and thread
+             counts, offsets of the region table, thread table and
+             proc info (0 when absent)
+    regions  start, size, data offset (0 when not captured), name offset
+             and length, depth, vm_region_submap_info_64
+    threads  tid, flavor, state length and offset
+    blobs    names, thread states, proc info
+    data     region contents, each starting on a page boundary
+    v} *)
+
+let magic = "MACHSNAP"
+let version = 1
+let header_size = 64
+let region_entry_size = 40 + Region.submap_info_size + 4
+let thread_entry_size = 24
+
+let machine_code = function Core_file.X86_64 -> 0 | Core_file.Arm64 -> 1
+
+let machine_of_code = function
+  | 0 -> Core_file.X86_64
+  | 1 -> Core_file.Arm64
+  | _ -> invalid_arg "Task_snapshot: unknown machine"
+
+type stats = {
+  regions : int;  (** Regions in the map. *)
+  captured : int;  (** Regions whose contents were saved. *)
+  bytes : int;  (** Bytes of target memory saved. *)
+  errors : int;  (** Chunks that failed to read and were saved as zeros. *)
+}
+
+(* Header, tables and blobs as one block, and the data offset of each
+   region, [0] for those not captured. *)
+let layout ~machine ~page_size ~threads ~proc_info regions =
+  let nregions = List.length regions and nthreads = List.length threads in
+  let region_table = header_size in
+  let thread_table = region_table + (nregions * region_entry_size) in
+  let blobs = thread_table + (nthreads * thread_entry_size) in
+  let blob_size =
+    List.fold_left (fun n (_, name) -> n + String.length name) 0 regions
+    + List.fold_left
+        (fun n (t : Core_file.thread) -> n + String.length t.state)
+        0 threads
+    + Option.fold ~none:0 ~some:String.length proc_info
+  in
+  let b = Bytes.make (blobs + blob_size) '\000' in
+  let u32 off v = Bytes.set_int32_le b off (Int32.of_int v) in
+  let u64 off v = Bytes.set_int64_le b off (Int64.of_int v) in
+  let blob = ref blobs in
+  let put s =
+    let off = !blob in
+    Bytes.blit_string s 0 b off (String.length s);
+    blob := off + String.length s;
+    off
+  in
+  Bytes.blit_string magic 0 b 0 8;
+  u32 8 version;
+  u32 12 (machine_code machine);
+  u64 16 page_size;
+  u64 24 nregions;
+  u64 32 nthreads;
+  u64 40 region_table;
+  u64 48 thread_table;
+  let data = ref (Core_file.align (Bytes.length b) page_size) in
+  let placed =
+    List.mapi
+      (fun i ((r : Region.t), name) ->
+        let e = region_table + (region_entry_size * i) in
+        let offset =
+          if Core_file.dumpable r then (
+            let offset = !data in
+            data := Core_file.align (offset + r.size) page_size;
+            offset)
+          else 0
+        in
+        u64 e r.start;
+        u64 (e + 8) r.size;
+        u64 (e + 16) offset;
+        u64 (e + 24) (put name);
+        u32 (e + 32) (String.length name);
+        u32 (e + 36) r.depth;
+        Region.to_submap_info r b (e + 40);
+        (r, offset))
+      regions
+  in
+  List.iteri
+    (fun i (t : Core_file.thread) ->
+      let e = thread_table + (thread_entry_size * i) in
+      u64 e t.tid;
+      u32 (e + 8) t.flavor;
+      u32 (e + 12) (String.length t.state);
+      u64 (e + 16) (put t.state))
+    threads;
+  Option.iter (fun p -> u64 56 (put p)) proc_info;
+  (b, placed)
+
+module Make (B : Backend.READER) = struct
+  (** [write ?chunk_size ?depth backend ~machine ~threads ?proc_info regions
+      path] saves the target behind [backend] to [path]: the [(region, name)]
+      map, the contents of its readable regions, [threads] and the raw
+      [proc_bsdshortinfo] record [proc_info]. As with {!Core_file}, the
+      target should be stopped, one domain reads while another writes, and
+      chunks that cannot be read are saved as zeros. *)
+  let write ?(chunk_size = 1 lsl 20) ?(depth = 4) backend ~machine ~threads
+      ?proc_info regions path =
+    Option.iter
+      (fun p ->
+        if String.length p <> Proc_info.size then
+          invalid_arg "Task_snapshot.write: proc_info")
+      proc_info;
+    let page_size = B.page_size backend in
+    let header, placed =
+      layout ~machine ~page_size ~threads ~proc_info regions
+    in
+    let captured = List.filter (fun (_, offset) -> offset > 0) placed in
+    let fd =
+      Unix.openfile path [ Unix.O_WRONLY; Unix.O_CREAT; Unix.O_TRUNC ] 0o600
+    in
+    Fun.protect
+      ~finally:(fun () -> Unix.close fd)
+      (fun () ->
+        Core_file.write_all fd header 0 (Bytes.length header);
+        let position, bytes, errors =
+          Core_file.stream ~read:(B.read backend) ~chunk_size ~depth fd
+            ~position:(Bytes.length header) captured
+        in
+        (* Pad the last region to its page so the file maps cleanly. *)
+        let stop = Core_file.align position page_size in
+        if stop > position then (
+          ignore (Unix.lseek fd (stop - 1) Unix.SEEK_SET);
+          Core_file.write_all fd (Bytes.make 1 '\000') 0 1);
+        {
+          regions = List.length placed;
+          captured = List.length captured;
+          bytes;
+          errors;
+        })
+end
+
+type t = {
+  file : Backend.buffer;  (** The whole file, mapped read-only. *)
+  machine : Core_file.machine;
+  page_size : int;
+  regions : Region.t array;  (** Sorted by start. *)
+  names : string array;
+  starts : int array;
+  stops : int array;
+  data : int array;  (** File offset of each region's contents, or [0]. *)
+  threads : Core_file.thread array;
+  proc_info : Proc_info.t option;
+}
+
+(** [open_file path] maps the snapshot at [path]. Raises [Invalid_argument]
+    if it is not one. *)
+let open_file path =
+  let fd = Unix.openfile path [ Unix.O_RDONLY ] 0 in
+  let file =
+    Fun.protect
+      ~finally:(fun () -> Unix.close fd)
+      (fun () ->
+        Unix.map_file fd Bigarray.char Bigarray.c_layout false [| -1 |]
+        |> Bigarray.array1_of_genarray)
+  in
+  let size = Bigarray.Array1.dim file in
+  let string off len =
+    let b = Bytes.create len in
+    Backend.blit_to_bytes file off b 0 len;
+    Bytes.unsafe_to_string b
+  in
+  if size < header_size || string 0 8 <> magic then
+    invalid_arg "Task_snapshot: not a snapshot";
+  if Decode.get_uint32 file 8 <> version then
+    invalid_arg "Task_snapshot: unsupported version";
+  let u64 = Decode.get_int file in
+  let nregions = u64 24 and nthreads = u64 32 in
+  let region_table = u64 40 and thread_table = u64 48 in
+  if
+    nregions < 0 || nthreads < 0
+    || region_table + (nregions * region_entry_size) > size
+    || thread_table + (nthreads * thread_entry_size) > size
+  then invalid_arg "Task_snapshot: truncated";
+  let entry i = region_table + (i * region_entry_size) in
+  let regions =
+    Array.init nregions (fun i ->
+        let e = entry i in
+        Region.of_submap_info ~off:(e + 40) ~start:(u64 e) ~size:(u64 (e + 8))
+          ~depth:(Decode.get_uint32 file (e + 36))
+          file)
+  in
+  let order = Array.init nregions Fun.id in
+  Array.sort
+    (fun i j -> Int.compare regions.(i).Region.start regions.(j).Region.start)
+    order;
+  let data =
+    Array.map
+      (fun i ->
+        let offset = u64 (entry i + 16) in
+        if offset > 0 && offset + regions.(i).size > size then
+          invalid_arg "Task_snapshot: truncated";
+        offset)
+      order
+  in
+  let regions = Array.map (fun i -> regions.(i)) order in
+  {
+    file;
+    machine = machine_of_code (Decode.get_uint32 file 12);
+    page_size = u64 16;
+    names =
+      Array.map
+        (fun i ->
+          let e = entry i in
+          string (u64 (e + 24)) (Decode.get_uint32 file (e + 32)))
+        order;
+    regions;
+    starts = Array.map (fun (r : Region.t) -> r.start) regions;
+    stops = Array.map Region.stop regions;
+    data;
+    threads =
+      Array.init nthreads (fun i ->
+          let e = thread_table + (i * thread_entry_size) in
+          {
+            Core_file.tid = u64 e;
+            flavor = Decode.get_uint32 file (e + 8);
+            state = string (u64 (e + 16)) (Decode.get_uint32 file (e + 12));
+          });
+    proc_info =
+      (match u64 56 with 0 -> None | off -> Some (Proc_info.decode file off));
+  }
+
+let machine t = t.machine
+let page_size t = t.page_size
+let threads t = Array.to_list t.threads
+let proc_info t = t.proc_info
+
+(* Index of the last region starting at or before [address], or [-1]. *)
+let floor t address =
+  let rec go lo hi =
+    if hi - lo <= 1 then lo
+    else
+      let mid = (lo + hi) lsr 1 in
+      if t.starts.(mid) <= address then go mid hi else go lo mid
+  in
+  go (-1) (Array.length t.starts)
+
+(** [read t address buf off len] copies saved memory. Like a live read it
+    must fall inside one region, which must have been captured. *)
+let read t address buf off len =
+  let i = floor t address in
+  if i < 0 || t.data.(i) = 0 || address + len > t.stops.(i) then
+    Error (Backend.Short_transfer 0)
+  else (
+    Bigarray.Array1.blit
+      (Bigarray.Array1.sub t.file (t.data.(i) + address - t.starts.(i)) len)
+      (Bigarray.Array1.sub buf off len);
+    Ok ())
+
+let read_spans t spans buf =
+  let off = ref 0 in
+  Array.map
+    (fun (address, len) ->
+      let r = read t address buf !off len in
+      off := !off + len;
+      r)
+    spans
+
+(** [view t address len] is a view into the mapping itself; nothing is
+    copied. *)
+let view t address len =
+  let i = floor t address in
+  if i < 0 || t.data.(i) = 0 || address + len > t.stops.(i) then
+    Error (Backend.Short_transfer 0)
+  else
+    Ok
+      (View.make ~address
+         (Bigarray.Array1.sub t.file (t.data.(i) + address - t.starts.(i)) len))
+
+(** The map as saved. [depth] is ignored: the regions are the ones the
+    snapshot was written with. *)
+let fold_named_regions t ~start ~stop ~depth:_ f acc =
+  let acc = ref acc in
+  for i = max 0 (floor t start) to Array.length t.regions - 1 do
+    if t.stops.(i) > start && t.starts.(i) < stop then
+      acc := f !acc t.regions.(i) t.names.(i)
+  done;
+  !acc
+
+let fold_regions t ~start ~stop ~depth f acc =
+  fold_named_regions t ~start ~stop ~depth (fun acc r _ -> f acc r) acc
+
+let regions t ~start ~stop ~depth =
+  List.to_seq
+    (List.rev (fold_regions t ~start ~stop ~depth (fun acc r -> r :: acc) []))
+
+(* Byte offsets of pc, sp and fp in a saved state: Linux [user_regs_struct]
+   (flavor 0) or the Mach thread state flavors. *)
+let registers t (thread : Core_file.thread) =
+  match t.machine with
+  | Core_file.X86_64 when thread.flavor = 0 -> (128, 152, 32)
+  | Core_file.X86_64 -> (128, 56, 48)
+  | Core_file.Arm64 -> (256, 248, 232)
+
+(** [sample t f] calls [f tid pc sp fp] for every saved thread, as a
+    {!Backend.THREADS}. *)
+let sample t f =
+  Array.iter
+    (fun (thread : Core_file.thread) ->
+      let pc, sp, fp = registers t thread in
+      let reg off = String.get_int64_le thread.state off |> Int64.to_int in
+      if String.length thread.state >= max pc (max sp fp) + 8 then
+        f thread.tid (reg pc) (reg sp) (reg fp))
+    t.threads;
+  Ok (Array.length t.threads)
@@ -0,0 +1,60 @@
+(** [thread_basic_info] from `mach/thread_info.h`, with every field decoded
+    to an immediate [int] straight from the buffer [thread_info] wrote, rather
+    than through Ctypes [getf] and a box per field. *)
+
+type t = {
+  user_time : int;  (** Microseconds. *)
+  system_time : int;  (** Microseconds. *)
+  cpu_usage : int;  (** Scaled by {!usage_scale}. *)
+  policy : int;
+  run_state : int;  (** One of the [th_state_*] values. *)
+  flags : int;
+  suspend_count : int;
+  sleep_time : int;  (** Seconds. *)
+}
+
+(** [TH_USAGE_SCALE]: a [cpu_usage] of this much is one whole CPU. *)
+let usage_scale = 1000
+
+(** Run states from `mach/thread_info.h` *)
+
+let th_state_running = 1
+let th_state_stopped = 2
+let th_state_waiting = 3
+let th_state_uninterruptible = 4
+let th_state_halted = 5
+
+(** Flags from `mach/thread_info.h` *)
+
+let th_flags_swapped = 0x1
+let th_flags_idle = 0x2
+
+(** Size in bytes; [THREAD_BASIC_INFO_COUNT] is this in 32-bit words. *)
+let size = 40
+
+let count = size / 4
+
+(* time_value_t: 32-bit seconds then microseconds. *)
+let time buf off =
+  (Decode.get_uint32 buf off * 1_000_000) + Decode.get_uint32 buf (off + 4)
+
+(** [decode buf off] decodes the [thread_basic_info] at [off] in [buf]. *)
+let decode buf off =
+  let i32 o = Int32.to_int (Decode.get_int32 buf (off + o)) in
+  {
+    user_time = time buf off;
+    system_time = time buf (off + 8);
+    cpu_usage = i32 16;
+    policy = i32 20;
+    run_state = i32 24;
+    flags = i32 28;
+    suspend_count = i32 32;
+    sleep_time = i32 36;
+  }
+
+(** [decode_array buf n] decodes [n] consecutive records from the start of
+    [buf]. *)
+let decode_array buf n =
+  if n * size > Bigarray.Array1.dim buf then
+    invalid_arg "Thread_info.decode_array";
+  Array.init n (fun i -> decode buf (i * size))
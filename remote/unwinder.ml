@@ -0,0 +1,129 @@
+(** Frame pointer stack unwinding over remote reads.
+
+    On both x86_64 and arm64 a function that keeps a frame pointer stores the
+    caller's frame pointer at [fp] and its return address at [fp + 8], so a
+    backtrace is a walk up that chain. Walking it one read per frame costs a
+    kernel round trip per frame; instead, the first read at a frame fetches a
+    chunk of several pages above it, which holds most of the frames further up
+    the stack. Fetched pages stay cached until {!invalidate}, so unwinding
+    every thread of a stopped target shares reads of common stack memory. *)
+
+module Make (B : Backend.READER) = struct
+  type t = {
+    backend : B.t;
+    page_size : int;
+    chunk_pages : int;
+    capacity : int;
+    arena : Backend.buffer;
+    slot_page : int array;  (** Page held by each slot, or [-1]. *)
+    pages : (int, int) Hashtbl.t;  (** Page address to slot. *)
+    mask : int;
+    max_frames : int;
+    mutable next : int;
+    mutable reads : int;
+  }
+
+  (** [create ?chunk_pages ?capacity ?mask ?max_frames backend] reads
+      [chunk_pages] pages per miss (default 4) and caches up to [capacity]
+      pages (default 256). Return addresses are and-ed with [mask], which on
+      arm64e should strip pointer authentication bits. *)
+  let create ?(chunk_pages = 4) ?(capacity = 256) ?(mask = -1)
+      ?(max_frames = 512) backend =
+    let page_size = B.page_size backend in
+    let capacity = max capacity chunk_pages in
+    {
+      backend;
+      page_size;
+      chunk_pages;
+      capacity;
+      arena = Backend.create_buffer (capacity * page_size);
+      slot_page = Array.make capacity (-1);
+      pages = Hashtbl.create capacity;
+      mask;
+      max_frames;
+      next = 0;
+      reads = 0;
+    }
+
+  (** Forget cached stack memory; call whenever the target has run. *)
+  let invalidate t =
+    Hashtbl.reset t.pages;
+    Array.fill t.slot_page 0 t.capacity (-1);
+    t.next <- 0
+
+  (** Backend reads issued so far. *)
+  let reads t = t.reads
+
+  (* Read [n] pages from [page] into consecutive slots. The slots are
+     emptied first: a failed or short read may already have overwritten
+     some of them. *)
+  let fetch t page n =
+    if t.next + n > t.capacity then t.next <- 0;
+    let slot = t.next in
+    for i = slot to slot + n - 1 do
+      let old = t.slot_page.(i) in
+      if old >= 0 then Hashtbl.remove t.pages old;
+      t.slot_page.(i) <- -1
+    done;
+    t.reads <- t.reads + 1;
+    match
+      B.read t.backend page t.arena (slot * t.page_size) (n * t.page_size)
+    with
+    | Error _ -> false
+    | Ok () ->
+        for i = 0 to n - 1 do
+          t.slot_page.(slot + i) <- page + (i * t.page_size);
+          Hashtbl.replace t.pages (page + (i * t.page_size)) (slot + i)
+        done;
+        t.next <- slot + n;
+        true
+
+  (* Slot of the page holding [address]. A miss reads a whole chunk, and
+     falls back to the single page if the chunk runs off the mapping. *)
+  let slot t address =
+    let page = address land lnot (t.page_size - 1) in
+    match Hashtbl.find_opt t.pages page with
+    | Some s -> s
+    | None ->
+        if
+          (t.chunk_pages > 1 && fetch t page t.chunk_pages)
+          || fetch t page 1
+        then Hashtbl.find t.pages page
+        else -1
+
+  (* The word at [address], or [None] if it cannot be read. *)
+  let word t address =
+    let s = slot t address in
+    if s < 0 then None
+    else
+      Some
+        (Decode.get_int t.arena
+           ((s * t.page_size) + (address land (t.page_size - 1))))
+
+  (** [unwind t ~pc ~sp ~fp frames off max] walks the frame pointer chain
+      from [fp], storing up to [max] return addresses into [frames] from
+      [off], and returns how many it stored. It has the type of a
+      {!Sampler.unwinder}. The walk stops at a null or misaligned frame
+      pointer, at one that does not move up the stack, or at memory that
+      cannot be read. *)
+  let unwind t ~pc:_ ~sp ~fp frames off max =
+    let max = min max t.max_frames in
+    let rec walk fp lower n =
+      if n >= max || fp = 0 || fp land 7 <> 0 || fp < lower then n
+      else
+        match (word t fp, word t (fp + 8)) with
+        | Some next, Some ret when ret land t.mask <> 0 ->
+            frames.(off + n) <- ret land t.mask;
+            if next <= fp then n + 1 else walk next (fp + 16) (n + 1)
+        | _ -> n
+    in
+    walk fp sp 0
+
+  (** [backtrace t ~pc ~sp ~fp] is [pc] followed by the return addresses
+      found by {!unwind}. *)
+  let backtrace t ~pc ~sp ~fp =
+    let frames = Array.make (t.max_frames + 1) 0 in
+    frames.(0) <- pc;
+    let n = unwind t ~pc ~sp ~fp frames 1 t.max_frames in
+    Array.sub frames 0 (n + 1)
+end
@@ -0,0 +1,107 @@
+(** Zero-copy views of target memory.
+
+    A view is a {!Backend.buffer} aliasing memory that already holds the target
+    bytes: the region [mach_vm_read] mapped into our address space on macOS, a
+    mapped snapshot file, or an off-heap buffer filled by the backend. Dumping
+    a region through a view never copies it onto the OCaml heap.
+
+    Mapped memory is handed back when the view's buffer is garbage collected,
+    or earlier with {!release}. After release the buffer must not be touched
+    again; that includes slices taken with [Bigarray.Array1.sub], which do not
+    keep the mapping alive on their own. *)
+
+type t = {
+  address : int;  (** Target address of the first byte. *)
+  data : Backend.buffer;
+  released : bool ref;
+  release : unit -> unit;
+}
+
+(** [make ?free ~address data] wraps [data], calling [free] exactly once when
+    the view is released or [data] is collected. [free] must not reference
+    [data], or it would keep [data] alive forever. *)
+let make ?(free = ignore) ~address data =
+  let released = ref false in
+  let release () =
+    if not !released then (
+      released := true;
+      free ())
+  in
+  Gc.finalise_last release data;
+  { address; data; released; release }
+
+let address v = v.address
+let length v = Bigarray.Array1.dim v.data
+let is_released v = !(v.released)
+
+(** The underlying buffer. Raises [Invalid_argument] once released. *)
+let data v = if !(v.released) then invalid_arg "View.data: released" else v.data
+
+let release v = v.release ()
+
+(** Byte at target address [address], which must lie inside the view. *)
+let get v address = Bigarray.Array1.get (data v) (address - v.address)
+
+(** [sub_bytes v address len] copies [len] bytes at target [address] out of the
+    view, for the few callers that do want them on the heap. *)
+let sub_bytes v address len =
+  let dst = Bytes.create len in
+  Backend.blit_to_bytes (data v) (address - v.address) dst 0 len;
+  dst
+
+(** [of_file ?offset ~address ~len path] maps [len] bytes of a snapshot file
+    starting at [offset] read-only, as the view of target memory at [address].
+    The mapping is dropped when the buffer is collected. *)
+let of_file ?(offset = 0) ~address ~len path =
+  let fd = Unix.openfile path [ Unix.O_RDONLY ] 0 in
+  Fun.protect
+    ~finally:(fun () -> Unix.close fd)
+    (fun () ->
+      let data =
+        Unix.map_file fd ~pos:(Int64.of_int offset) Bigarray.char
+          Bigarray.c_layout false [| len |]
+        |> Bigarray.array1_of_genarray
+      in
+      make ~address data)
+
+(** A set of views as a {!Backend.READER}, e.g. over mapped snapshot files.
+    Reads must fall inside a single view; views must not overlap. *)
+module Reader = struct
+  type view = t
+  type t = {
+    views : view array;  (** Sorted by address. *)
+    page_size : int;
+  }
+
+  let create ?(page_size = 4096) views =
+    let views = Array.of_list views in
+    Array.sort (fun a b -> Int.compare a.address b.address) views;
+    { views; page_size }
+
+  let page_size t = t.page_size
+
+  (* Last view starting at or before [address], or [-1]. *)
+  let floor t address =
+    let rec go lo hi =
+      if hi - lo <= 1 then lo
+      else
+        let mid = (lo + hi) lsr 1 in
+        if t.views.(mid).address <= address then go mid hi else go lo mid
+    in
+    go (-1) (Array.length t.views)
+
+  let read t address buf off len =
+    if off < 0 || len < 0 || off > Bigarray.Array1.dim buf - len then
+      invalid_arg "View.Reader.read";
+    let i = floor t address in
+    if i < 0 then Error (Backend.Short_transfer 0)
+    else
+      let v = t.views.(i) in
+      if len > v.address + length v - address then
+        Error (Backend.Short_transfer 0)
+      else (
+        Bigarray.Array1.blit
+          (Bigarray.Array1.sub (data v) (address - v.address) len)
+          (Bigarray.Array1.sub buf off len);
+        Ok ())
+end
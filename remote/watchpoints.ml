@@ -0,0 +1,200 @@
+(** Hardware watchpoints on every thread of a target.
+
+    Debug registers belong to threads, not tasks, so each watchpoint takes
+    the same slot on every thread. Slots are allocated here, encoded into the
+    x86_64 DR7 or arm64 WCR format, and written to all threads by {!commit};
+    threads that appear later get them from {!sync}. A watchpoint costs
+    nothing until it fires, unlike emulation by page protection or single
+    stepping. *)
+
+type kind =
+  | Write  (** Stores. *)
+  | Access  (** Loads and stores. x86_64 has no loads-only watchpoint. *)
+  | Execute  (** Instruction fetch, a hardware breakpoint. x86_64 only. *)
+
+type watch = { address : int; len : int; kind : kind }
+
+(** {2 x86_64 DR7} *)
+
+(* Per slot: local enable at bit 2i, R/W at 16 + 4i and LEN at 18 + 4i. *)
+let dr7_mask slot = (1 lsl (2 * slot)) lor (0xf lsl (16 + (4 * slot)))
+
+let dr7_bits slot w =
+  let rw = match w.kind with Execute -> 0 | Write -> 1 | Access -> 3 in
+  let len = match w.len with 1 -> 0 | 2 -> 1 | 8 -> 2 | _ -> 3 in
+  (1 lsl (2 * slot))
+  lor (rw lsl (16 + (4 * slot)))
+  lor (len lsl (18 + (4 * slot)))
+
+(* DR6 B0 to B3: which slot's condition was met. *)
+let dr6_hits = 0xf
+
+(** {2 arm64 WCR} *)
+
+(* Enable, EL0 only (PAC = 0b10), LSC load/store, and BAS selecting the
+   watched bytes of the doubleword WVR points at. *)
+let wcr w =
+  let lsc = match w.kind with Write -> 2 | Access -> 3 | Execute -> 0 in
+  let bas = ((1 lsl w.len) - 1) lsl (w.address land 7) in
+  1 lor (2 lsl 1) lor (lsc lsl 3) lor (bas lsl 5)
+
+module Make (D : Backend.DEBUG_REGISTERS) = struct
+  type t = {
+    backend : D.t;
+    machine : Core_file.machine;
+    slots : watch option array;
+    state : Backend.debug_state;
+    programmed : (int, unit) Hashtbl.t;  (** Threads that have the slots. *)
+  }
+
+  let create backend machine =
+    let n = D.slots backend in
+    let controls =
+      match machine with Core_file.X86_64 -> 1 | Core_file.Arm64 -> n
+    in
+    {
+      backend;
+      machine;
+      slots = Array.make n None;
+      state =
+        {
+          Backend.values = Array.make n 0;
+          controls = Array.make controls 0;
+          status = 0;
+        };
+      programmed = Hashtbl.create 16;
+    }
+
+  let check t w =
+    let ok_len =
+      match (t.machine, w.kind) with
+      | _, Execute -> w.len = 1 && t.machine = Core_file.X86_64
+      | Core_file.X86_64, _ -> List.mem w.len [ 1; 2; 4; 8 ]
+      | Core_file.Arm64, _ -> w.len >= 1 && w.len <= 8
+    in
+    if not ok_len then invalid_arg "Watchpoints: kind or length";
+    (* x86 needs natural alignment; arm64 needs the range inside one
+       doubleword. *)
+    match t.machine with
+    | Core_file.X86_64 when w.address land (w.len - 1) <> 0 ->
+        invalid_arg "Watchpoints: alignment"
+    | Core_file.Arm64 when (w.address land 7) + w.len > 8 ->
+        invalid_arg "Watchpoints: alignment"
+    | _ -> ()
+
+  (** [add t ~kind ~len address] takes a free slot for a watchpoint on the
+      [len] bytes at [address] and returns it, or [None] when every slot is
+      taken. It is written to the threads by the next {!commit}. *)
+  let add t ~kind ~len address =
+    let w = { address; len; kind } in
+    check t w;
+    let rec free i =
+      if i = Array.length t.slots then None
+      else if t.slots.(i) = None then (
+        t.slots.(i) <- Some w;
+        Some i)
+      else free (i + 1)
+    in
+    free 0
+
+  let remove t slot = t.slots.(slot) <- None
+  let get t slot = t.slots.(slot)
+  let slots t = Array.length t.slots
+
+  (* Put the slots into [t.state], keeping any DR7 bits we do not own. *)
+  let encode t =
+    let s = t.state in
+    match t.machine with
+    | Core_file.X86_64 ->
+        Array.iteri
+          (fun i slot ->
+            let dr7 = s.controls.(0) land lnot (dr7_mask i) in
+            match slot with
+            | None -> s.controls.(0) <- dr7
+            | Some w ->
+                s.values.(i) <- w.address;
+                s.controls.(0) <- dr7 lor dr7_bits i w)
+          t.slots
+    | Core_file.Arm64 ->
+        Array.iteri
+          (fun i slot ->
+            match slot with
+            | None -> s.controls.(i) <- 0
+            | Some w ->
+                s.values.(i) <- w.address land lnot 7;
+                s.controls.(i) <- wcr w)
+          t.slots
+
+  let program t thread =
+    match D.get t.backend thread t.state with
+    | Error e -> Error e
+    | Ok () ->
+        encode t;
+        Result.map
+          (fun () -> Hashtbl.replace t.programmed thread ())
+          (D.set t.backend thread t.state)
+
+  (* Program [threads], or only those not yet programmed, returning the
+     first error once all have been tried. *)
+  let apply t ~all =
+    match D.threads t.backend with
+    | Error e -> Error e
+    | Ok threads ->
+        let live = Hashtbl.create (List.length threads) in
+        List.iter (fun th -> Hashtbl.replace live th ()) threads;
+        Hashtbl.filter_map_inplace
+          (fun th () -> if Hashtbl.mem live th then Some () else None)
+          t.programmed;
+        let n, error =
+          List.fold_left
+            (fun (n, error) th ->
+              if (not all) && Hashtbl.mem t.programmed th then (n, error)
+              else
+                match program t th with
+                | Ok () -> (n + 1, error)
+                | Error e -> (n, if error = None then Some e else error))
+            (0, None) threads
+        in
+        match error with Some e -> Error e | None -> Ok n
+
+  (** [commit t] writes the slots to every thread of the stopped target and
+      returns how many threads were programmed. *)
+  let commit t = apply t ~all:true
+
+  (** [sync t] writes the slots to threads created since the last
+      {!commit} or [sync], such as after a clone or thread creation event. *)
+  let sync t = apply t ~all:false
+
+  (** [hit t thread ~address] is the slot that stopped [thread], if a
+      watchpoint did. [address] is the faulting data address the exception
+      reports, which is how arm64 tells; on x86_64 DR6 is read and cleared
+      instead. *)
+  let hit t thread ~address =
+    match t.machine with
+    | Core_file.X86_64 -> (
+        match D.get t.backend thread t.state with
+        | Error e -> Error e
+        | Ok () ->
+            let bits = t.state.status land dr6_hits in
+            if bits = 0 then Ok None
+            else
+              let rec first i =
+                if bits land (1 lsl i) <> 0 then i else first (i + 1)
+              in
+              t.state.status <- t.state.status land lnot dr6_hits;
+              Result.map
+                (fun () -> Some (first 0))
+                (D.set t.backend thread t.state))
+    | Core_file.Arm64 ->
+        let rec find i =
+          if i = Array.length t.slots then None
+          else
+            match t.slots.(i) with
+            | Some w
+              when address >= w.address land lnot 7
+                   && address < w.address + w.len ->
+                Some i
+            | _ -> find (i + 1)
+        in
+        Ok (find 0)
+end
@@ -0,0 +1,194 @@
+(** Write-combining buffer in front of a {!Backend.VECTORED_WRITER}.
+
+    Patching many small locations one [write] at a time costs a kernel call
+    each, and on code pages a protection change each as well. A write buffer
+    only records writes until {!Make.commit}: each write is merged with every
+    pending extent it overlaps or touches, later bytes winning, so the
+    pending extents stay disjoint and sorted by address, hence by page. A
+    commit hands them all to {!Backend.VECTORED_WRITER.write_spans} at once.
+    Extents grow geometrically, like a [Buffer], so a run of adjacent writes
+    costs linear time rather than a copy of the whole run per write.
+
+    Reads through the buffer see pending writes over target memory, so a
+    write buffer is itself a {!Backend.READER} and can sit under any reader
+    such as {!Page_cache}, which as usual needs
+    {!Page_cache.Make.invalidate_range} after each write. *)
+
+module Extents = Map.Make (Int)
+
+type extent = {
+  mutable data : Backend.buffer;  (** Pending bytes, then room to grow. *)
+  mutable len : int;
+}
+
+module Make (W : Backend.VECTORED_WRITER) = struct
+  type t = {
+    backend : W.t;
+    mutable extents : extent Extents.t;  (** Start to pending bytes. *)
+    mutable bytes : int;  (** Total length of [extents]. *)
+    mutable packed : Backend.buffer;  (** Reused to hand spans to [W]. *)
+  }
+
+  let create backend =
+    {
+      backend;
+      extents = Extents.empty;
+      bytes = 0;
+      packed = Backend.create_buffer (W.page_size backend);
+    }
+
+  let backend t = t.backend
+  let page_size t = W.page_size t.backend
+
+  (** Number of disjoint pending extents, hence of spans the next commit
+      writes. *)
+  let pending t = Extents.cardinal t.extents
+
+  (** Bytes the next commit writes. *)
+  let pending_bytes t = t.bytes
+
+  let check name buf off len =
+    if off < 0 || len < 0 || off > Bigarray.Array1.dim buf - len then
+      invalid_arg name
+
+  let blit src src_off dst dst_off len =
+    Bigarray.Array1.blit
+      (Bigarray.Array1.sub src src_off len)
+      (Bigarray.Array1.sub dst dst_off len)
+
+  (* Extent starting at or before [address] and reaching past it. *)
+  let covering t address =
+    match Extents.find_last_opt (fun a -> a <= address) t.extents with
+    | Some (a, e) when a + e.len > address -> Some (a, e)
+    | _ -> None
+
+  (** [write t address buf off len] queues [len] bytes of [buf] from [off] to
+      be written at [address]. *)
+  let write t address buf off len =
+    check "Write_buffer.write" buf off len;
+    let stop = address + len in
+    match covering t address with
+    | Some (a, e) when a + e.len >= stop ->
+        (* Rewriting bytes already pending: patch them in place. *)
+        blit buf off e.data (address - a) len
+    | _ when len = 0 -> ()
+    | _ ->
+        (* Merge with the extent ending at or after [address], if any, and
+           every extent starting up to [stop]. *)
+        let first =
+          match Extents.find_last_opt (fun a -> a <= address) t.extents with
+          | Some (a, e) when a + e.len >= address -> [ (a, e) ]
+          | _ -> []
+        in
+        let rec following seq acc =
+          match seq () with
+          | Seq.Cons ((a, e), rest) when a <= stop ->
+              following rest ((a, e) :: acc)
+          | _ -> acc
+        in
+        let merged =
+          following (Extents.to_seq_from (address + 1) t.extents) first
+        in
+        let start = List.fold_left (fun lo (a, _) -> min lo a) address merged in
+        let finish =
+          List.fold_left (fun hi (a, e) -> max hi (a + e.len)) stop merged
+        in
+        (* Keep the extent the merge starts with, grown to at least twice its
+           size if it has no room left. *)
+        let e =
+          match List.assoc_opt start merged with
+          | Some e ->
+              let room = Bigarray.Array1.dim e.data in
+              if room < finish - start then (
+                let data =
+                  Backend.create_buffer (max (finish - start) (2 * room))
+                in
+                blit e.data 0 data 0 e.len;
+                e.data <- data);
+              e
+          | None -> { data = Backend.create_buffer (finish - start); len = 0 }
+        in
+        List.iter
+          (fun (a, old) ->
+            if old != e then blit old.data 0 e.data (a - start) old.len;
+            t.extents <- Extents.remove a t.extents;
+            t.bytes <- t.bytes - old.len)
+          merged;
+        blit buf off e.data (address - start) len;
+        e.len <- finish - start;
+        t.extents <- Extents.add start e t.extents;
+        t.bytes <- t.bytes + e.len
+
+  (* Copy the pending bytes that fall in [address, address + len) over [buf]
+     from [off]. *)
+  let overlay t address buf off len =
+    let stop = address + len in
+    let copy a e =
+      let lo = max a address and hi = min (a + e.len) stop in
+      if lo < hi then blit e.data (lo - a) buf (off + lo - address) (hi - lo)
+    in
+    Option.iter (fun (a, e) -> copy a e) (covering t address);
+    let rec following seq =
+      match seq () with
+      | Seq.Cons ((a, e), rest) when a < stop ->
+          copy a e;
+          following rest
+      | _ -> ()
+    in
+    following (Extents.to_seq_from (address + 1) t.extents)
+
+  (** [read t address buf off len] reads target memory as it will be after
+      the next commit. A range wholly inside pending writes is served without
+      touching the target. *)
+  let read t address buf off len =
+    check "Write_buffer.read" buf off len;
+    match covering t address with
+    | Some (a, e) when a + e.len >= address + len ->
+        blit e.data (address - a) buf off len;
+        Ok ()
+    | _ -> (
+        match W.read t.backend address buf off len with
+        | Error e -> Error e
+        | Ok () ->
+            overlay t address buf off len;
+            Ok ())
+
+  (** [discard t] drops every pending write. *)
+  let discard t =
+    t.extents <- Extents.empty;
+    t.bytes <- 0
+
+  (** [commit t] writes every pending extent with one
+      {!Backend.VECTORED_WRITER.write_spans} and returns how many spans it
+      wrote. Extents that fail stay pending, and the first error is returned
+      once the others have been written. *)
+  let commit t =
+    let n = pending t in
+    if n = 0 then Ok 0
+    else (
+      if Bigarray.Array1.dim t.packed < t.bytes then
+        t.packed <-
+          Backend.create_buffer
+            (max t.bytes (2 * Bigarray.Array1.dim t.packed));
+      let spans = Array.make n (0, 0) in
+      let i = ref 0 and off = ref 0 in
+      Extents.iter
+        (fun a e ->
+          blit e.data 0 t.packed !off e.len;
+          spans.(!i) <- (a, e.len);
+          incr i;
+          off := !off + e.len)
+        t.extents;
+      let results = W.write_spans t.backend spans t.packed in
+      let error = ref None in
+      Array.iteri
+        (fun i r ->
+          match r with
+          | Ok () ->
+              let a, len = spans.(i) in
+              t.extents <- Extents.remove a t.extents;
+              t.bytes <- t.bytes - len
+          | Error e -> if !error = None then error := Some e)
+        results;
+      match !error with Some e -> Error e | None -> Ok n)
+end
@@ -0,0 +1,23 @@
+(* Writes the C stubs or the OCaml module binding Mach_bindings.Functions
+   directly, for ../../stubs.
+
+   gen_mach_stubs.exe (c|ml) *)
+
+let prefix = "mach_stub"
+
+let prelude = {|#include <mach/mach.h>
+#include <mach/mach_vm.h>
+|}
+
+let () =
+  let fmt = Format.std_formatter in
+  (match Sys.argv with
+  | [| _; "c" |] ->
+      Format.pp_print_string fmt prelude;
+      Cstubs.write_c fmt ~prefix (module Mach_bindings.Functions)
+  | [| _; "ml" |] ->
+      Cstubs.write_ml fmt ~prefix (module Mach_bindings.Functions)
+  | _ ->
+      prerr_endline "usage: gen_mach_stubs (c|ml)";
+      exit 2);
+  Format.pp_print_flush fmt ()
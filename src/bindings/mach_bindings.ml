@@ -0,0 +1,67 @@
+open Ctypes
+
+(** Routines on the hot paths of the readers, region walks and samplers.
+
+    The argument types are the primitive types the [Mach] typedefs alias, so
+    these descriptions do not depend on [Mach] and [Mach] can re-export
+    whichever instance the build selects. *)
+module Functions (F : Ctypes.FOREIGN) = struct
+  open F
+
+  (* vm_task_entry_t, mach_vm_address_t *, mach_vm_size_t *, natural_t *,
+     vm_region_recurse_info_t, mach_msg_type_number_t * *)
+  let mach_vm_region_recurse =
+    foreign "mach_vm_region_recurse"
+      (uint64_t @-> ptr uint64_t @-> ptr uint64_t @-> ptr int32_t
+     @-> ptr int32_t @-> ptr int32_t @-> returning int32_t)
+
+  (* vm_map_t, mach_vm_address_t, mach_vm_size_t, vm_offset_t *,
+     mach_msg_type_number_t * *)
+  let mach_vm_read =
+    foreign "mach_vm_read"
+      (uint64_t @-> uint64_t @-> uint64_t @-> ptr uint64_t @-> ptr int32_t
+     @-> returning int32_t)
+
+  (* vm_map_t, mach_vm_address_t, mach_vm_size_t, mach_vm_address_t,
+     mach_vm_size_t * *)
+  let mach_vm_read_overwrite =
+    foreign "mach_vm_read_overwrite"
+      (uint64_t @-> uint64_t @-> uint64_t @-> uint64_t @-> ptr uint64_t
+     @-> returning int32_t)
+
+  (* vm_map_t, mach_vm_address_t, vm_offset_t, mach_msg_type_number_t *)
+  let mach_vm_write =
+    foreign "mach_vm_write"
+      (uint64_t @-> uint64_t @-> uint64_t @-> int32_t @-> returning int32_t)
+
+  (* vm_map_t, mach_vm_address_t, mach_vm_size_t, boolean_t, vm_prot_t *)
+  let mach_vm_protect =
+    foreign "mach_vm_protect"
+      (uint64_t @-> uint64_t @-> uint64_t @-> uint32_t @-> int32_t
+     @-> returning int32_t)
+
+  (* thread_act_t, thread_state_flavor_t, thread_state_t,
+     mach_msg_type_number_t * *)
+  let thread_get_state =
+    foreign "thread_get_state"
+      (uint64_t @-> int32_t @-> ptr int32_t @-> ptr int32_t
+     @-> returning int32_t)
+
+  let pid_for_task =
+    foreign "pid_for_task"
+      (uint64_t @-> ptr PosixTypes.pid_t @-> returning int32_t)
+end
+
+(** Dynamic binding through libffi, as [Foreign.foreign] does. *)
+module Libffi = struct
+  type 'a fn = 'a Ctypes.fn
+  type 'a return = 'a
+
+  let ( @-> ) = Ctypes.( @-> )
+  let returning = Ctypes.returning
+
+  type 'a result = 'a
+
+  let foreign name fn = Foreign.foreign name fn
+  let foreign_value name typ = Foreign.foreign_value name typ
+end
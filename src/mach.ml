@@ -185,6 +185,11 @@ let vm_prot_write = Int32.of_int 0x02
 (** Execute permissions *)
 let vm_prot_execute = Int32.of_int 0x04
 
+(** Copy-on-write: when set with [vm_prot_write] on a mapping that cannot be
+    written, such as shared code, [mach_vm_protect] gives the task a private
+    copy instead of failing. *)
+let vm_prot_copy = Int32.of_int 0x10
+
 (** The default protection for newly-created virtual memory *)
 let vm_prot_default = Int32.logor vm_prot_read vm_prot_write
 
@@ -317,36 +322,75 @@ let object_id_full =
 
 let () = seal vm_region_submap_info_64
 
+(* Note: the C structure is declared under #pragma pack(4), so [offset] is a
+   64-bit memory_object_offset_t at byte 12 and [object_id_full] sits at byte
+   68. Ctypes cannot express the packing and lays fields out with natural
+   alignment, so only the leading fields of this view are reliable.
+   Remote.Region.of_submap_info decodes the real layout. *)
+
+(** Number of natural_t in a version 2 [vm_region_submap_info_64] *)
+let vm_region_submap_info_count_64 = 19
+
+(** Share modes from `mach/vm_region.h` *)
+
+let sm_cow = 1
+let sm_private = 2
+let sm_empty = 3
+let sm_shared = 4
+let sm_trueshared = 5
+let sm_private_aliased = 6
+let sm_shared_aliased = 7
+let sm_large_page = 8
+
 type vm_region_submap_info_data_64_t = vm_region_submap_info_64
 
 let vm_region_submap_info_data_64_t = vm_region_submap_info_64
 
 (** Types and functions from `mach/mach_vm.h` *)
 
-let mach_vm_region_recurse =
-  foreign "mach_vm_region_recurse"
-    (vm_task_entry_t @-> ptr mach_vm_address_t @-> ptr mach_vm_size_t
-   @-> ptr natural_t
-    @-> ptr vm_region_recurse_info_t
-    @-> ptr mach_msg_type_number_t @-> returning kern_return_t)
+(* The routines bound in Mach_dispatch go through libffi, or through direct
+   C stubs when built with --profile cstubs; see src/bindings. *)
+
+let mach_vm_region_recurse = Mach_dispatch.mach_vm_region_recurse
 
 (** Routine mach_vm_read *)
-let mach_vm_read =
-  foreign "mach_vm_read"
-    (vm_map_t @-> mach_vm_address_t @-> mach_vm_size_t @-> ptr vm_offset_t
-   @-> ptr mach_msg_type_number_t @-> returning kern_return_t)
+let mach_vm_read = Mach_dispatch.mach_vm_read
 
-(** Routine mach_vm_write *)
-let mach_vm_write =
-  foreign "mach_vm_write"
-    (vm_map_t @-> mach_vm_address_t @-> vm_offset_t @-> mach_msg_type_number_t
+(** Routine mach_vm_read_overwrite
+
+    Copies into a caller supplied buffer rather than mapping a new region, so
+    no [vm_deallocate] is needed afterwards. *)
+let mach_vm_read_overwrite = Mach_dispatch.mach_vm_read_overwrite
+
+(** Types and routine for reading a list of ranges from `mach/vm_types.h` *)
+
+type mach_vm_read_entry
+
+let mach_vm_read_entry : mach_vm_read_entry structure typ =
+  structure "mach_vm_read_entry"
+
+let read_entry_address = field mach_vm_read_entry "address" mach_vm_address_t
+let read_entry_size = field mach_vm_read_entry "size" mach_vm_size_t
+let () = seal mach_vm_read_entry
+
+(** Maximum number of entries accepted by [mach_vm_read_list] *)
+let vm_map_entry_max = 256
+
+(** Routine mach_vm_read_list
+
+    Maps each entry into the caller's address space and replaces its address
+    with the local one. Every mapped entry has to be released with
+    [vm_deallocate]. *)
+let mach_vm_read_list =
+  foreign "mach_vm_read_list"
+    (vm_map_t @-> ptr mach_vm_read_entry @-> natural_t
    @-> returning kern_return_t)
 
+(** Routine mach_vm_write *)
+let mach_vm_write = Mach_dispatch.mach_vm_write
+
 (** Routine mach_vm_protect *)
-let mach_vm_protect =
-  foreign "mach_vm_protect"
-    (vm_map_t @-> mach_vm_address_t @-> mach_vm_size_t @-> boolean_t
-   @-> vm_prot_t @-> returning kern_return_t)
+let mach_vm_protect = Mach_dispatch.mach_vm_protect
 
 (** Routine mach_vm_allocate *)
 let mach_vm_allocate =
@@ -392,6 +436,54 @@ let mach_port_insert_right =
     (ipc_space_t @-> mach_port_name_t @-> mach_port_t @-> int32_t
    @-> returning kern_return_t)
 
+(** Port right types from `mach/port.h` *)
+let mach_port_right_receive : int32 = 1l
+
+let mach_port_right_port_set : int32 = 3l
+
+(** Routine mach_port_move_member
+
+    Moves a receive right into a port set, or out of any set when [after] is
+    [MACH_PORT_NULL]. *)
+let mach_port_move_member =
+  foreign "mach_port_move_member"
+    (ipc_space_t @-> mach_port_name_t @-> mach_port_name_t
+   @-> returning kern_return_t)
+
+(** Types and functions from `mach/message.h` *)
+
+type mach_msg_option_t = integer_t
+
+let mach_msg_option_t = integer_t
+
+type mach_msg_size_t = natural_t
+
+let mach_msg_size_t = natural_t
+
+type mach_msg_timeout_t = natural_t
+
+let mach_msg_timeout_t = natural_t
+let mach_send_msg : mach_msg_option_t = 0x1l
+let mach_rcv_msg : mach_msg_option_t = 0x2l
+let mach_send_timeout : mach_msg_option_t = 0x10l
+let mach_rcv_timeout : mach_msg_option_t = 0x100l
+
+(** [mach_msg] returned because [MACH_RCV_TIMEOUT] expired *)
+let mach_rcv_timed_out : kern_return_t = 0x10004003l
+
+(** Disposition to reply through the send-once right in a request *)
+let mach_msg_type_move_send_once : int32 = 18l
+
+(** Routine mach_msg
+
+    Sends and/or receives a message in a caller supplied buffer, which starts
+    with a [mach_msg_header_t]. *)
+let mach_msg =
+  foreign "mach_msg"
+    (ptr void @-> mach_msg_option_t @-> mach_msg_size_t @-> mach_msg_size_t
+   @-> mach_port_name_t @-> mach_msg_timeout_t @-> mach_port_name_t
+   @-> returning kern_return_t)
+
 (* let mach_port_names = *)
 (*   foreign "mach_port_names" (ipc_space_t @-> ptr mach_port_name_array_t @-> ptr mach_msg_type_number_t *)
 (*     @-> ptr mach_port_type_array_t @-> ptr mach_msg_type_number_t @-> returning kern_return_t) *)
@@ -416,8 +508,7 @@ let task_name_for_pid =
     (mach_port_name_t @-> pid_t @-> ptr mach_port_name_t
    @-> returning kern_return_t)
 
-let pid_for_task =
-  foreign "pid_for_task" (uint64_t @-> ptr pid_t @-> returning kern_return_t)
+let pid_for_task = Mach_dispatch.pid_for_task
 (* foreign "pid_for_task" (mach_port_name_t @-> ptr pid_t @-> returning kern_return_t) *)
 
 (** Types defined in `mach/task_info.h` *)
@@ -505,15 +596,27 @@ let x86_debug_state32 : thread_state_flavor_t = 10l
 let x86_debug_state64 : thread_state_flavor_t = 11l
 let x86_debug_state : thread_state_flavor_t = 12l
 let x86_thread_state_count = 42
+let x86_thread_state64_count = 42
 let x86_float_state_count = 64
+let x86_float_state64_count = 131
+let x86_exception_state64_count = 4
+
+(** [x86_debug_state64_t]: [__dr0] to [__dr7], 64 bits each. *)
+let x86_debug_state64_count = 16
 
 (** Thread state flavors for ARM64 from `mach/arm/thread_status.h` *)
 
 let arm_thread_state64 : thread_state_flavor_t = 6l
 let arm_exception_state64 : thread_state_flavor_t = 7l
+let arm_debug_state64 : thread_state_flavor_t = 15l
 let arm_neon_state64 : thread_state_flavor_t = 17l
 let arm_thread_state64_count = 68
 let arm_neon_state64_count = 256
+let arm_exception_state64_count = 4
+
+(** [arm_debug_state64_t]: [__bvr], [__bcr], [__wvr] and [__wcr], 16 64-bit
+    registers each, then [__mdscr_el1]. *)
+let arm_debug_state64_count = 130
 
 (** x86_64 thread state structure *)
 
@@ -744,6 +847,15 @@ let mach_ports_lookup =
     (task_t @-> ptr mach_port_array_t @-> mach_msg_type_number_t
    @-> returning kern_return_t)
 
+(** [MACH_TASK_BASIC_INFO] flavor for [task_info], a
+    [mach_task_basic_info] of [MACH_TASK_BASIC_INFO_COUNT] words: virtual,
+    resident and peak resident size as 64-bit byte counts, user and system
+    time of terminated threads as [time_value_t], then policy and suspend
+    count. *)
+let mach_task_basic_info : task_flavor_t = 20l
+
+let mach_task_basic_info_count = 12
+
 (** Routine task_info *)
 let task_info =
   foreign "task_info"
@@ -785,10 +897,7 @@ let thread_create_running =
    @-> mach_msg_type_number_t @-> ptr thread_act_t @-> returning kern_return_t)
 
 (** Routine thread_get_state *)
-let thread_get_state =
-  foreign "thread_get_state"
-    (thread_act_t @-> thread_state_flavor_t @-> ptr thread_state_t
-   @-> ptr mach_msg_type_number_t @-> returning kern_return_t)
+let thread_get_state = Mach_dispatch.thread_get_state
 
 (** Routine thread_set_state *)
 let thread_set_state =
@@ -1035,6 +1144,17 @@ let pbsi_rfu =
 
 let () = seal proc_bsdshortinfo
 
+(* int proc_listpids(uint32_t type, uint32_t typeinfo, void *buffer, int buffersize);
+
+   Fills [buffer] with pids and returns the number of bytes used, or, with a
+   null [buffer], the number of bytes needed. *)
+let proc_listpids =
+  foreign "proc_listpids"
+    (uint32_t @-> uint32_t @-> ptr void @-> int @-> returning int)
+
+(** [PROC_ALL_PIDS] type for [proc_listpids] *)
+let proc_all_pids = Unsigned.UInt32.one
+
 (* int proc_pidinfo(int pid, int flavor, uint64_t arg, void *buffer, int buffersize); *)
 let proc_pidinfo =
   foreign "proc_pidinfo"
@@ -0,0 +1,64 @@
+(* Symbol indexes survive encode, decode and lookup, both in memory and
+   through the on-disk cache. *)
+
+let buffer_of_bytes bytes =
+  let data = Remote.Backend.create_buffer (Bytes.length bytes) in
+  Bytes.iteri (fun i c -> Bigarray.Array1.set data i c) bytes;
+  data
+
+let check name ok = if not ok then failwith ("symbols_test: " ^ name)
+
+let round_trip () =
+  let bytes =
+    Remote.Symbols.encode ~base:0x1000 ~stop:0x3000
+      [
+        (0x2000, 0, "last");
+        (0x1000, 0x10, "first");
+        (0x1800, 0, "middle");
+        (0x1800, 0, "alias");
+      ]
+  in
+  match Remote.Symbols.decode ~id:"test" (buffer_of_bytes bytes) with
+  | None -> failwith "symbols_test: decode rejected a fresh index"
+  | Some t ->
+      check "length" (Remote.Symbols.length t = 3);
+      check "base" (Remote.Symbols.base t = 0x1000);
+      check "sized" (Remote.Symbols.lookup t 0x1008 = Some ("first", 8));
+      check "gap" (Remote.Symbols.lookup t 0x1010 = None);
+      check "first name wins"
+        (Remote.Symbols.lookup t 0x1900 = Some ("middle", 0x100));
+      check "slide"
+        (Remote.Symbols.lookup ~slide:0x100 t 0x2100 = Some ("last", 0));
+      check "last stops at the image end"
+        (Remote.Symbols.range t 2 = (0x2000, 0x3000)
+        && Remote.Symbols.lookup t 0x3000 = None);
+      check "below" (Remote.Symbols.lookup t 0xfff = None)
+
+let bad_magic () =
+  let bytes = Remote.Symbols.encode ~base:0 ~stop:0 [] in
+  Bytes.set bytes 0 'X';
+  check "bad magic"
+    (Remote.Symbols.decode ~id:"test" (buffer_of_bytes bytes) = None)
+
+(* Index this executable twice against an empty cache directory: the second
+   run maps the index the first one saved. *)
+let cached () =
+  let dir = Filename.temp_file "symbols_test" "" in
+  Sys.remove dir;
+  let path = Sys.executable_name in
+  let fresh = Remote.Symbols.of_file ~cache_dir:dir path in
+  let mapped = Remote.Symbols.of_file ~cache_dir:dir path in
+  check "cached length"
+    (Remote.Symbols.length mapped = Remote.Symbols.length fresh);
+  for i = 0 to Remote.Symbols.length fresh - 1 do
+    check "cached symbol"
+      (Remote.Symbols.range mapped i = Remote.Symbols.range fresh i
+      && Remote.Symbols.name mapped i = Remote.Symbols.name fresh i)
+  done;
+  Array.iter (fun f -> Sys.remove (Filename.concat dir f)) (Sys.readdir dir);
+  Sys.rmdir dir
+
+let () =
+  round_trip ();
+  bad_magic ();
+  cached ()